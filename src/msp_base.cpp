@@ -45,7 +45,9 @@
  */
 
 #include "msp_base.h"
+#include "msp_coroutine.h"
 #include "msp_protocol.h"
+#include "msp_stream.h"
 
 #if false
 enum defaultsType_e {
@@ -101,3 +103,99 @@ void MspBase::process_reply(msp_context_t& pg, const msp_packet_t& reply)
     (void)pg;
     (void)reply;
 }
+
+/*!
+Returns a payload generator if the reply to cmd_msp is to be streamed, rather than being written into the reply buffer.
+The generator must remain valid until the reply has been sent.
+Only called if HANDLES_STREAM_COMMANDS was passed to the constructor.
+*/
+MspPayloadGenerator* MspBase::process_stream_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src) // NOLINT(readability-convert-member-functions-to-static)
+{
+    (void)pg;
+    (void)cmd_msp;
+    (void)src;
+
+    return nullptr;
+}
+
+/*!
+Returns a payload sink if the payload of cmd_msp is to be streamed to it, rather than being assembled in the input buffer.
+This allows commands with payloads larger than the input buffer to be received.
+*/
+MspPayloadSink* MspBase::get_payload_sink(int16_t cmd_msp, size_t payload_size) // NOLINT(readability-convert-member-functions-to-static)
+{
+    (void)cmd_msp;
+    (void)payload_size;
+
+    return nullptr;
+}
+
+/*!
+Returns a coroutine if cmd_msp is processed by a coroutine handler, which may suspend while waiting for slow operations.
+
+The coroutine runs until its first suspension before this function returns, src is only valid until then.
+dst remains valid until the coroutine completes, when its contents are sent as the reply.
+Only called if HANDLES_COROUTINE_COMMANDS was passed to the constructor.
+*/
+MspCoroutine MspBase::process_command_coroutine(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src) // NOLINT(readability-convert-member-functions-to-static)
+{
+    (void)pg;
+    (void)cmd_msp;
+    (void)dst;
+    (void)src;
+
+    return {};
+}
+
+/*!
+Returns true if cmd_msp is processed by a coroutine handler.
+Used to reply with an error, rather than process the command synchronously, when all the coroutine slots are in use.
+*/
+bool MspBase::is_coroutine_command(int16_t cmd_msp) const // NOLINT(readability-convert-member-functions-to-static)
+{
+    (void)cmd_msp;
+
+    return false;
+}
+
+/*!
+Called when a command handler returns MSP_RESULT_PENDING.
+
+pending_reply should be passed to whatever will supply the reply (for example the flight loop task),
+which then calls pending_reply.complete(). The reply is sent from MspTask::loop() once it has been completed.
+By default the reply is completed immediately as an error, since there is nothing to complete it.
+*/
+void MspBase::set_pending_reply(msp_context_t& pg, int16_t cmd_msp, MspPendingReply& pending_reply) // NOLINT(readability-convert-member-functions-to-static)
+{
+    (void)pg;
+    (void)cmd_msp;
+
+    pending_reply.complete(MSP_RESULT_ERROR, nullptr, 0);
+}
+
+/*!
+Called when a pending reply has not been completed within MspStream::PENDING_REPLY_TIMEOUT_US, for example because whatever was to
+complete it has failed. The client is sent an error reply and pending_reply is freed for reuse, so must not be completed after this returns.
+*/
+void MspBase::expire_pending_reply(msp_context_t& pg, int16_t cmd_msp, MspPendingReply& pending_reply) // NOLINT(readability-convert-member-functions-to-static)
+{
+    (void)pg;
+    (void)cmd_msp;
+    (void)pending_reply;
+}
+
+/*!
+Returns the priority of a command. By default the control commands MSP_SET_RAW_RC and MSP_SET_MOTOR have high priority,
+so they are not delayed behind bulk transfers.
+*/
+msp_priority_e MspBase::get_command_priority(int16_t cmd_msp) const // NOLINT(readability-convert-member-functions-to-static)
+{
+    switch (cmd_msp) {
+    case MSP_SET_RAW_RC:
+        [[fallthrough]];
+    case MSP_SET_MOTOR:
+        return MSP_PRIORITY_HIGH;
+    default:
+        return MSP_PRIORITY_NORMAL;
+    }
+}
@@ -48,6 +48,8 @@
 
 #include <stream_buf_reader.h>
 
+class MspCoroutine;
+class MspPendingReply;
 struct msp_context_t;
 
 enum {
@@ -66,12 +68,27 @@ enum msp_version_e {
     MSP_VERSION_COUNT
 };
 
+// bitmasks of MSP versions, see MspStream::SUPPORTED_VERSIONS
+enum msp_version_mask_e {
+    MSP_VERSION_MASK_V1         = 1U << MSP_V1,
+    MSP_VERSION_MASK_V2_OVER_V1 = 1U << MSP_V2_OVER_V1,
+    MSP_VERSION_MASK_V2_NATIVE  = 1U << MSP_V2_NATIVE,
+    MSP_VERSION_MASK_ALL        = MSP_VERSION_MASK_V1 | MSP_VERSION_MASK_V2_OVER_V1 | MSP_VERSION_MASK_V2_NATIVE
+};
+
 // return positive for ACK, negative on error, zero for no reply
 enum msp_result_e {
     MSP_RESULT_ACK = 1,
     MSP_RESULT_ERROR = -1,
     MSP_RESULT_NO_REPLY = 0,
     MSP_RESULT_CMD_UNKNOWN = -2,   // don't know how to process command, try next handler
+    MSP_RESULT_PENDING = 2,        // reply will be completed later, see MspBase::set_pending_reply()
+};
+
+// commands with high priority are executed ahead of queued normal priority commands, see MspStream::set_frame_queue()
+enum msp_priority_e {
+    MSP_PRIORITY_NORMAL = 0,
+    MSP_PRIORITY_HIGH = 1,
 };
 
 struct msp_packet_t {
@@ -90,6 +107,36 @@ struct msp_const_packet_t {
     uint8_t direction;  // Currently unused
 };
 
+/*!
+Pull-style source of a reply payload, for replies that are too large to be built in the MspStream output buffer.
+
+The payload is pulled in chunks as the serial port has room for them, so it need never be held in memory in its entirety.
+*/
+class MspPayloadGenerator {
+public:
+    virtual ~MspPayloadGenerator() = default;
+    // length of the payload, this is written in the frame header before any of the payload is generated
+    virtual size_t get_payload_length() const = 0;
+    // fill buf with up to len bytes of payload, returning the number of bytes supplied
+    virtual size_t read(uint8_t* buf, size_t len) = 0;
+};
+
+/*!
+Push-style destination for a command payload, for commands whose payload is too large to be assembled in the MspStream input buffer.
+
+The payload is written in chunks as it is received, before its checksum has been verified. So the sink must hold the
+payload provisionally: it is committed if the checksum verifies, otherwise it is aborted.
+*/
+class MspPayloadSink {
+public:
+    virtual ~MspPayloadSink() = default;
+    virtual void write(const uint8_t* data, size_t len) = 0;
+    // called when the whole payload has been received and the checksum has verified, dst is the reply payload
+    virtual msp_result_e commit(msp_context_t& pg, StreamBufWriter& dst) = 0;
+    // called if the frame is abandoned, for example on checksum failure or frame timeout
+    virtual void abort() = 0;
+};
+
 class MspBase {
 public:
     static constexpr uint8_t V2_FRAME_ID = 255;
@@ -126,10 +173,18 @@ public:
 
     static constexpr uint8_t PASSTHROUGH_ESC_4WAY = 0xFF;
 
+    // the optional kinds of command handler provided by a derived class, MspStream only calls the handlers whose flag is set
+    // (debug builds assert if a handler whose flag is not set handles a command)
+    static constexpr uint8_t HANDLES_STREAM_COMMANDS = 0x01;    // overrides process_stream_command()
+    static constexpr uint8_t HANDLES_COROUTINE_COMMANDS = 0x02; // overrides process_command_coroutine() and is_coroutine_command()
+
 public:
     MspBase() = default;
+    explicit MspBase(uint8_t handler_flags) : _handler_flags(handler_flags) {}
     virtual ~MspBase() = default;
 
+    uint8_t get_handler_flags() const { return _handler_flags; }
+
     virtual msp_result_e process_write_command(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src);
 
     virtual msp_result_e process_read_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src);
@@ -137,4 +192,25 @@ public:
     virtual void process_reply(msp_context_t& pg, const msp_packet_t& reply);
 
     virtual msp_result_e process_command(msp_context_t& pg, const msp_const_packet_t& cmd, msp_packet_t& reply);
+
+    // return a payload generator for commands whose reply is streamed, nullptr otherwise
+    virtual MspPayloadGenerator* process_stream_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src);
+
+    // return a coroutine for commands processed by a coroutine handler, an empty MspCoroutine otherwise
+    virtual MspCoroutine process_command_coroutine(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src);
+    // return true for commands processed by a coroutine handler, so they can be refused when all the coroutine slots are in use
+    virtual bool is_coroutine_command(int16_t cmd_msp) const;
+
+    // called when a command returns MSP_RESULT_PENDING, pending_reply is the token used to complete the reply
+    virtual void set_pending_reply(msp_context_t& pg, int16_t cmd_msp, MspPendingReply& pending_reply);
+    // called when a pending reply expires without being completed, after which it may be reused, so the handler must drop it
+    virtual void expire_pending_reply(msp_context_t& pg, int16_t cmd_msp, MspPendingReply& pending_reply);
+
+    // called by the parser, so must be thread safe if commands are executed on a different task
+    virtual msp_priority_e get_command_priority(int16_t cmd_msp) const;
+
+    // return a payload sink for commands whose payload is streamed, nullptr otherwise. Called when the frame header has been received.
+    virtual MspPayloadSink* get_payload_sink(int16_t cmd_msp, size_t payload_size);
+private:
+    const uint8_t _handler_flags {};
 };
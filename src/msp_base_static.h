@@ -0,0 +1,70 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "msp_base.h"
+
+#include <concepts>
+
+
+/*!
+Requirements for a command handler used by MspBaseStatic.
+*/
+template <typename T>
+concept msp_command_handler_c = requires(T& handler, msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src) {
+    { handler.process_write_command(pg, cmd_msp, dst, src) } -> std::same_as<msp_result_e>;
+    { handler.process_read_command(pg, cmd_msp, src) } -> std::same_as<msp_result_e>;
+};
+
+/*!
+CRTP base for a command handler whose type is known at compile time, eg:
+
+class MyMsp : public MspBaseStatic<MyMsp> {
+public:
+    msp_result_e process_write_command(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src) override;
+    msp_result_e process_read_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src) override;
+};
+
+process_command() calls HANDLER's process_write_command() and process_read_command() directly rather than virtually,
+so they can be inlined into it. If HANDLER does not provide one of them, the MspBase default is called.
+*/
+template <typename HANDLER>
+class MspBaseStatic : public MspBase {
+public:
+    using MspBase::MspBase;
+    msp_result_e process_command(msp_context_t& pg, const msp_const_packet_t& cmd, msp_packet_t& reply) final {
+        static_assert(msp_command_handler_c<HANDLER>, "HANDLER does not satisfy msp_command_handler_c");
+        static_assert(std::derived_from<HANDLER, MspBaseStatic<HANDLER>>, "HANDLER must derive from MspBaseStatic<HANDLER>");
+
+        HANDLER& handler = static_cast<HANDLER&>(*this);
+        StreamBufWriter& dst = reply.payload;
+        StreamBufReader src(cmd.payload);
+        // initialize reply by default
+        reply.cmd = cmd.cmd;
+
+        msp_result_e ret = handler.HANDLER::process_write_command(pg, cmd.cmd, dst, src); // NOLINT(cppcoreguidelines-init-variables)
+        if (ret == MSP_RESULT_CMD_UNKNOWN) {
+            ret = handler.HANDLER::process_read_command(pg, cmd.cmd, src);
+        }
+        reply.result = ret;
+        return ret;
+    }
+};
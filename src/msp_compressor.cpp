@@ -0,0 +1,182 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "msp_compressor.h"
+
+#include <algorithm>
+
+
+// NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic,cppcoreguidelines-pro-bounds-constant-array-index)
+namespace {
+
+size_t hash(const uint8_t* p)
+{
+    const uint32_t v = static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8U) | (static_cast<uint32_t>(p[2]) << 16U);
+    return (v * 2654435761U) >> (32U - MspCompressor::HASH_BITS); // Knuth multiplicative hash
+}
+
+// returns the new output length, or zero if the literals do not fit
+size_t put_literals(uint8_t* dst, size_t dst_size, size_t out, const uint8_t* literals, size_t len)
+{
+    while (len > 0) {
+        const size_t run = std::min(len, MspCompressor::LITERAL_RUN_MAX);
+        if (out + 1 + run > dst_size) {
+            return 0;
+        }
+        dst[out++] = static_cast<uint8_t>(run - 1);
+        std::copy_n(literals, run, &dst[out]);
+        out += run;
+        literals += run;
+        len -= run;
+    }
+    return out;
+}
+
+} // end namespace
+
+/*!
+Greedy LZ77: each position is looked up in a hash table of the most recent position with the same first three bytes,
+and the longest match at that single candidate position is taken.
+Positions are stored in the hash table plus one, so that zero means empty.
+*/
+size_t MspCompressor::compress(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_len, std::array<uint16_t, HASH_SIZE>& hash_table)
+{
+    if (src_len == 0 || src_len >= UINT16_MAX) {
+        return 0;
+    }
+    // the output must be smaller than the input to be worth sending
+    dst_size = std::min(dst_size, src_len - 1);
+    hash_table.fill(0);
+
+    size_t out = 0;
+    size_t literal_start = 0;
+    size_t pos = 0;
+    while (pos + MATCH_LENGTH_MIN <= src_len) {
+        const size_t h = hash(&src[pos]);
+        const size_t candidate = hash_table[h];
+        hash_table[h] = static_cast<uint16_t>(pos + 1);
+        if (candidate == 0 || pos + 1 - candidate > FAR_OFFSET_MAX) {
+            ++pos;
+            continue;
+        }
+        const size_t offset = pos + 1 - candidate;
+        const size_t length_max = std::min(MATCH_LENGTH_MAX, src_len - pos);
+        size_t length = 0;
+        while (length < length_max && src[pos + length] == src[pos + length - offset]) {
+            ++length;
+        }
+        // a far match is one byte longer, so only saves space if it is at least one byte longer
+        if (length < MATCH_LENGTH_MIN + (offset > NEAR_OFFSET_MAX ? 1 : 0)) {
+            ++pos;
+            continue;
+        }
+        out = put_literals(dst, dst_size, out, &src[literal_start], pos - literal_start);
+        if (out == 0 && pos > literal_start) {
+            return 0;
+        }
+        const size_t match_size = offset > NEAR_OFFSET_MAX ? 3 : 2;
+        if (out + match_size > dst_size) {
+            return 0;
+        }
+        dst[out++] = static_cast<uint8_t>(0x80U | (length - MATCH_LENGTH_MIN));
+        if (offset > NEAR_OFFSET_MAX) {
+            dst[out++] = static_cast<uint8_t>(0x80U | ((offset - 1) >> 8U));
+        }
+        dst[out++] = static_cast<uint8_t>((offset - 1) & 0xFFU);
+        // hash the positions within the match, so later data can match against them
+        for (size_t ii = pos + 1; ii < pos + length && ii + MATCH_LENGTH_MIN <= src_len; ++ii) {
+            hash_table[hash(&src[ii])] = static_cast<uint16_t>(ii + 1);
+        }
+        pos += length;
+        literal_start = pos;
+    }
+    if (literal_start < src_len) {
+        out = put_literals(dst, dst_size, out, &src[literal_start], src_len - literal_start);
+    }
+    return out;
+}
+
+size_t MspCompressor::decompress(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_len)
+{
+    size_t out = 0;
+    size_t in = 0;
+    while (in < src_len) {
+        const uint8_t token = src[in++];
+        if ((token & 0x80U) == 0) {
+            const size_t run = static_cast<size_t>(token) + 1;
+            if (in + run > src_len || out + run > dst_size) {
+                return DECOMPRESS_ERROR;
+            }
+            std::copy_n(&src[in], run, &dst[out]);
+            in += run;
+            out += run;
+            continue;
+        }
+        const size_t length = static_cast<size_t>(token & 0x7FU) + MATCH_LENGTH_MIN;
+        if (in >= src_len) {
+            return DECOMPRESS_ERROR;
+        }
+        size_t offset = src[in++];
+        if (offset & 0x80U) {
+            if (in >= src_len) {
+                return DECOMPRESS_ERROR;
+            }
+            offset = ((offset & 0x7FU) << 8U) | src[in++];
+        }
+        ++offset;
+        if (offset > out || out + length > dst_size) {
+            return DECOMPRESS_ERROR;
+        }
+        // byte by byte, since the match may overlap the bytes it produces
+        for (size_t ii = 0; ii < length; ++ii) {
+            dst[out] = dst[out - offset];
+            ++out;
+        }
+    }
+    return out;
+}
+// NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic,cppcoreguidelines-pro-bounds-constant-array-index)
+
+size_t MspCompressor::compress(const uint8_t* data, size_t len)
+{
+    if (len < COMPRESSION_THRESHOLD) {
+        return 0;
+    }
+    const size_t compressed_len = compress(&_buf[0], _buf.size(), data, len, _hash_table);
+    if (compressed_len == 0) {
+        ++_statistics.not_compressed;
+        return 0;
+    }
+    ++_statistics.compressed;
+    _statistics.bytes_in += static_cast<uint32_t>(len);
+    _statistics.bytes_out += static_cast<uint32_t>(compressed_len);
+    return compressed_len;
+}
+
+size_t MspCompressor::decompress(const uint8_t* data, size_t len)
+{
+    const size_t decompressed_len = decompress(&_buf[0], _buf.size(), data, len);
+    if (decompressed_len == DECOMPRESS_ERROR) {
+        ++_statistics.decompress_errors;
+    } else {
+        ++_statistics.decompressed;
+    }
+    return decompressed_len;
+}
@@ -0,0 +1,92 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+
+/*!
+Fixed memory LZ77 compression of reply payloads, negotiated using the MSPv2 flags byte.
+
+A client that can decompress replies sets FLAG_COMPRESSED in the flags of its MSPv2 requests. The reply to such a request is
+compressed if it is at least COMPRESSION_THRESHOLD bytes long and compression makes it smaller, in which case the reply is sent
+with FLAG_COMPRESSED set; otherwise it is sent as normal. This suits large, redundant replies such as MSP_BOXNAMES,
+MSP_OSD_CHAR_READ, MSP2_GET_TEXT, and MSP_DATAFLASH_READ of blackbox logs.
+
+No heap is used: compression uses a HASH_SIZE entry hash table and both directions use a BUFFER_SIZE byte output buffer.
+
+Compressed format, a sequence of tokens:
+    0LLLLLLL                        L + 1 literal bytes follow
+    1LLLLLLL 0OOOOOOO               match of length L + 3, O + 1 bytes back (near match)
+    1LLLLLLL 1OOOOOOO OOOOOOOO      match of length L + 3, O + 1 bytes back (far match, high bits of O first)
+Matches may overlap the bytes they produce, so runs are encoded as a literal followed by a match with an offset of 1.
+*/
+class MspCompressor {
+public:
+    static constexpr uint8_t FLAG_COMPRESSED = 0x20;
+#if defined(MSP_COMPRESSOR_BUFFER_SIZE)
+    static constexpr size_t BUFFER_SIZE = MSP_COMPRESSOR_BUFFER_SIZE;
+#else
+    static constexpr size_t BUFFER_SIZE = 512;
+#endif
+#if defined(MSP_COMPRESSOR_COMPRESSION_THRESHOLD)
+    static constexpr size_t COMPRESSION_THRESHOLD = MSP_COMPRESSOR_COMPRESSION_THRESHOLD;
+#else
+    static constexpr size_t COMPRESSION_THRESHOLD = 32; // shorter replies are sent uncompressed
+#endif
+    static constexpr size_t HASH_BITS = 8;
+    static constexpr size_t HASH_SIZE = 1U << HASH_BITS;
+    static constexpr size_t LITERAL_RUN_MAX = 128;
+    static constexpr size_t MATCH_LENGTH_MIN = 3;
+    static constexpr size_t MATCH_LENGTH_MAX = MATCH_LENGTH_MIN + 127;
+    static constexpr size_t NEAR_OFFSET_MAX = 128;
+    static constexpr size_t FAR_OFFSET_MAX = 32768;
+    static constexpr size_t DECOMPRESS_ERROR = SIZE_MAX;
+    struct statistics_t {
+        uint32_t compressed;
+        uint32_t not_compressed;    // attempted, but compression did not make the payload smaller
+        uint32_t bytes_in;          // uncompressed size of the compressed payloads
+        uint32_t bytes_out;         // compressed size of the compressed payloads
+        uint32_t decompressed;
+        uint32_t decompress_errors;
+    };
+public:
+    static bool is_compressed(uint8_t flags) { return (flags & FLAG_COMPRESSED) != 0; }
+    // flags with the compression bit cleared, as seen by the command handler or reply handler
+    static uint8_t strip_flags(uint8_t flags) { return static_cast<uint8_t>(flags & ~FLAG_COMPRESSED); }
+
+    // compresses into the buffer, returns the compressed length, or zero if the payload is not worth compressing
+    size_t compress(const uint8_t* data, size_t len);
+    // decompresses into the buffer, returns the decompressed length, or DECOMPRESS_ERROR if the data is corrupt or too large
+    size_t decompress(const uint8_t* data, size_t len);
+    uint8_t* get_buf() { return &_buf[0]; }
+    const statistics_t& get_statistics() const { return _statistics; }
+
+    // returns the compressed length, or zero if the compressed data would not be smaller than the input or would not fit in dst
+    static size_t compress(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_len, std::array<uint16_t, HASH_SIZE>& hash_table);
+    static size_t decompress(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_len);
+private:
+    std::array<uint16_t, HASH_SIZE> _hash_table {};
+    std::array<uint8_t, BUFFER_SIZE> _buf {};
+    statistics_t _statistics {};
+};
@@ -0,0 +1,70 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "msp_coroutine.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#if !defined(MSP_COROUTINE_FRAME_SIZE)
+enum { MSP_COROUTINE_FRAME_SIZE = 256 };
+#endif
+#if !defined(MSP_COROUTINE_FRAME_COUNT)
+enum { MSP_COROUTINE_FRAME_COUNT = 4 };
+#endif
+
+namespace {
+// Statically allocated pool of coroutine frames.
+// The pool is shared by all MspStreams, which may run in different tasks, so slots are claimed and released atomically.
+struct alignas(std::max_align_t) coroutine_frame_t {
+    std::array<uint8_t, MSP_COROUTINE_FRAME_SIZE> data;
+};
+std::array<coroutine_frame_t, MSP_COROUTINE_FRAME_COUNT> coroutine_frames; // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+std::array<std::atomic<bool>, MSP_COROUTINE_FRAME_COUNT> coroutine_frame_in_use {}; // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+} // end namespace
+
+/*!
+Allocates a coroutine frame from the pool, returns nullptr if the frame is too large or the pool is exhausted.
+Returning nullptr causes get_return_object_on_allocation_failure() to be called.
+*/
+void* MspCoroutine::promise_type::operator new(size_t size) noexcept
+{
+    if (size > MSP_COROUTINE_FRAME_SIZE) {
+        return nullptr;
+    }
+    for (size_t ii = 0; ii < coroutine_frames.size(); ++ii) {
+        if (!coroutine_frame_in_use[ii].exchange(true, std::memory_order_acquire)) {
+            return &coroutine_frames[ii];
+        }
+    }
+    return nullptr;
+}
+
+void MspCoroutine::promise_type::operator delete(void* ptr, size_t size) noexcept
+{
+    (void)size;
+    for (size_t ii = 0; ii < coroutine_frames.size(); ++ii) {
+        if (ptr == &coroutine_frames[ii]) {
+            coroutine_frame_in_use[ii].store(false, std::memory_order_release);
+            return;
+        }
+    }
+}
@@ -0,0 +1,143 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "msp_base.h"
+
+#include <coroutine>
+#include <cstddef>
+#include <utility>
+
+
+/*!
+Return type for MSP command handlers that are written as C++20 coroutines.
+
+A coroutine handler can suspend while it waits for a slow operation (for example a flash read or EEPROM write) to complete,
+rather than blocking the MSP task. It runs until its first suspension when the command is received and is then resumed
+from MspTask::loop() (via MspSerial::process_output()) until it co_returns its msp_result_e.
+The MspBase providing coroutine handlers must pass MspBase::HANDLES_COROUTINE_COMMANDS to the MspBase constructor.
+
+Coroutine frames are allocated from a statically allocated pool, not the heap. If the pool is exhausted the coroutine
+is not started and allocation_failed() returns true.
+
+A default constructed MspCoroutine is empty, and is returned by handlers for commands that are not processed by a coroutine.
+*/
+class MspCoroutine {
+public:
+    class promise_type {
+    public:
+        MspCoroutine get_return_object() { return MspCoroutine(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        static MspCoroutine get_return_object_on_allocation_failure() { return MspCoroutine(ALLOCATION_FAILED); }
+        // run eagerly, so the command payload can be read before the first suspension
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_always final_suspend() const noexcept { return {}; }
+        void return_value(msp_result_e result) { _result = result; }
+        void unhandled_exception() { _result = MSP_RESULT_ERROR; }
+
+        static void* operator new(size_t size) noexcept;
+        static void operator delete(void* ptr, size_t size) noexcept;
+
+        bool is_ready() { return _ready_fn == nullptr || _ready_fn(_ready_arg); }
+        void set_ready_fn(bool (*ready_fn)(void*), void* ready_arg) { _ready_fn = ready_fn; _ready_arg = ready_arg; }
+        msp_result_e get_result() const { return _result; }
+    private:
+        bool (*_ready_fn)(void*) {}; // coroutine is resumed when this returns true, nullptr means resume at the next opportunity
+        void* _ready_arg {};
+        msp_result_e _result { MSP_RESULT_ERROR };
+    };
+    using handle_t = std::coroutine_handle<promise_type>;
+public:
+    MspCoroutine() = default;
+    ~MspCoroutine() { destroy(); }
+    MspCoroutine(MspCoroutine&& other) noexcept : _handle(std::exchange(other._handle, nullptr)), _allocation_failed(other._allocation_failed) {}
+    MspCoroutine& operator=(MspCoroutine&& other) noexcept {
+        if (this != &other) {
+            destroy();
+            _handle = std::exchange(other._handle, nullptr);
+            _allocation_failed = other._allocation_failed;
+        }
+        return *this;
+    }
+    // MspCoroutine is not copyable
+    MspCoroutine(const MspCoroutine&) = delete;
+    MspCoroutine& operator=(const MspCoroutine&) = delete;
+public:
+    bool is_empty() const { return !_handle; }
+    bool allocation_failed() const { return _allocation_failed; }
+    bool is_done() const { return _handle && _handle.done(); }
+    msp_result_e get_result() const { return _handle.promise().get_result(); }
+    // resumes the coroutine if what it is waiting for is ready, returns true if it was resumed
+    bool resume() {
+        promise_type& promise = _handle.promise();
+        if (_handle.done() || !promise.is_ready()) {
+            return false;
+        }
+        promise.set_ready_fn(nullptr, nullptr);
+        _handle.resume();
+        return true;
+    }
+    void destroy() {
+        if (_handle) {
+            _handle.destroy();
+            _handle = nullptr;
+        }
+    }
+private:
+    enum allocation_failed_e { ALLOCATION_FAILED };
+    explicit MspCoroutine(handle_t handle) : _handle(handle) {}
+    explicit MspCoroutine(allocation_failed_e) : _allocation_failed(true) {}
+private:
+    handle_t _handle {};
+    bool _allocation_failed {};
+};
+
+/*!
+Awaitable that suspends a coroutine handler until it is next resumed, ie until the next MspTask::loop().
+*/
+class MspYield {
+public:
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(MspCoroutine::handle_t handle) const noexcept { (void)handle; }
+    void await_resume() const noexcept {}
+};
+
+inline MspYield msp_yield() { return {}; }
+
+/*!
+Awaitable that suspends a coroutine handler until predicate() returns true, for example when a flash device is no longer busy.
+
+The predicate is stored in the awaiter, which is held in the coroutine frame, so it is polled without any allocation.
+*/
+template <typename PREDICATE>
+class MspWaitUntil {
+public:
+    explicit MspWaitUntil(PREDICATE predicate) : _predicate(std::move(predicate)) {}
+    bool await_ready() { return _predicate(); }
+    void await_suspend(MspCoroutine::handle_t handle) noexcept { handle.promise().set_ready_fn(&MspWaitUntil::ready, this); }
+    void await_resume() const noexcept {}
+private:
+    static bool ready(void* arg) { return static_cast<MspWaitUntil*>(arg)->_predicate(); }
+private:
+    PREDICATE _predicate;
+};
+
+template <typename PREDICATE>
+MspWaitUntil<PREDICATE> msp_wait_until(PREDICATE predicate) { return MspWaitUntil<PREDICATE>(std::move(predicate)); }
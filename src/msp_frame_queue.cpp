@@ -0,0 +1,68 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "msp_frame_queue.h"
+
+/*!
+Returns the slot to fill with the next frame, or nullptr if the queue is full, in which case the frame is dropped.
+The slot is not visible to the consumer until push() is called.
+*/
+MspFrameQueue::frame_t* MspFrameQueue::acquire()
+{
+    const uint32_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) >= SLOT_COUNT) {
+        _dropped_frame_count.store(_dropped_frame_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    return &_frames[head % SLOT_COUNT];
+}
+
+/*!
+Publishes the slot returned by acquire().
+*/
+void MspFrameQueue::push()
+{
+    _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/*!
+Returns the oldest queued frame, or nullptr if the queue is empty.
+*/
+const MspFrameQueue::frame_t* MspFrameQueue::front() const
+{
+    const uint32_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    return &_frames[tail % SLOT_COUNT];
+}
+
+/*!
+Releases the frame returned by front(), so that its slot can be reused.
+*/
+void MspFrameQueue::pop()
+{
+    _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+size_t MspFrameQueue::size() const
+{
+    return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+}
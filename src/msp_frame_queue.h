@@ -0,0 +1,71 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "msp_stream.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+/*!
+Fixed capacity queue of received MSP frames, used to decouple frame parsing from command execution.
+
+The MspStream parser copies each completed command frame into a slot and queues it. The frames are executed later by
+MspStream::process_queued_frames(), which may be in a different task or on a different core.
+
+The queue is a lock-free single producer, single consumer ring buffer: acquire() and push() must only be called
+by the parser and front() and pop() must only be called by the executor. No heap allocation is used.
+*/
+class MspFrameQueue {
+public:
+#if defined(MSP_FRAME_QUEUE_SLOT_COUNT)
+    static constexpr size_t SLOT_COUNT = MSP_FRAME_QUEUE_SLOT_COUNT;
+#else
+    static constexpr size_t SLOT_COUNT = 4;
+#endif
+    // indices are free running, so the slot count must be a power of two for them to wrap correctly
+    static_assert((SLOT_COUNT & (SLOT_COUNT - 1)) == 0, "MSP_FRAME_QUEUE_SLOT_COUNT must be a power of two");
+    struct frame_t {
+        msp_version_e msp_version;
+        int16_t cmd;
+        uint8_t flags;
+        uint16_t size;
+        std::array<uint8_t, MspStream::MSP_STREAM_INBUF_SIZE> payload;
+    };
+public:
+    // producer side
+    frame_t* acquire();
+    void push();
+    // consumer side
+    const frame_t* front() const;
+    void pop();
+
+    size_t size() const;
+    uint32_t get_dropped_frame_count() const { return _dropped_frame_count.load(std::memory_order_relaxed); }
+private:
+    std::atomic<uint32_t> _head {}; // written only by the producer
+    std::atomic<uint32_t> _tail {}; // written only by the consumer
+    std::atomic<uint32_t> _dropped_frame_count {}; // written only by the producer, read by any task
+    std::array<frame_t, SLOT_COUNT> _frames {};
+};
@@ -0,0 +1,152 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "msp_link_statistics.h"
+
+#include <stream_buf_writer.h>
+
+
+void MspLinkStatistics::record_wire_bytes(direction_e direction, size_t len)
+{
+    add(_counters[direction == TX ? TX_WIRE : RX_WIRE], len);
+}
+
+void MspLinkStatistics::record_frame(direction_e direction, msp_version_e msp_version, size_t payload_len, size_t framing_len)
+{
+    if (direction == TX) {
+        add(_counters[TX_PAYLOAD], payload_len);
+        add(_tx_frames[msp_version], 1);
+        add(_tx_framing_bytes[msp_version], framing_len);
+    } else {
+        add(_counters[RX_PAYLOAD], payload_len);
+        add(_rx_frames[msp_version], 1);
+        add(_rx_framing_bytes[msp_version], framing_len);
+    }
+}
+
+void MspLinkStatistics::record_send_time(uint32_t busy_us, uint32_t wait_us)
+{
+    add(_tx_busy_us, busy_us);
+    add(_tx_wait_us, wait_us);
+}
+
+void MspLinkStatistics::record_retransmitted_frame()
+{
+    add(_tx_retransmitted_frames, 1);
+}
+
+/*!
+Takes a snapshot of the byte counters every WINDOW_BUCKET_US, the rates are the change in the counters since the oldest snapshot.
+*/
+void MspLinkStatistics::update_rates(uint32_t time_microseconds)
+{
+    const bucket_t& latest = _buckets[_bucket_index];
+    if (_bucket_count > 0 && time_microseconds - latest.time_microseconds < WINDOW_BUCKET_US) {
+        return;
+    }
+    _bucket_index = (_bucket_index + 1) % WINDOW_BUCKET_COUNT;
+    bucket_t& bucket = _buckets[_bucket_index];
+    bucket.time_microseconds = time_microseconds;
+    for (size_t ii = 0; ii < RATE_COUNTER_COUNT; ++ii) {
+        bucket.counters[ii] = _counters[ii].load(std::memory_order_relaxed);
+    }
+    if (_bucket_count < WINDOW_BUCKET_COUNT) {
+        ++_bucket_count;
+    }
+    if (_bucket_count < 2) {
+        return;
+    }
+
+    const bucket_t& oldest = _buckets[(_bucket_index + WINDOW_BUCKET_COUNT + 1 - _bucket_count) % WINDOW_BUCKET_COUNT];
+    const uint32_t elapsed_us = time_microseconds - oldest.time_microseconds;
+    for (size_t ii = 0; ii < RATE_COUNTER_COUNT; ++ii) {
+        const uint64_t delta = bucket.counters[ii] - oldest.counters[ii];
+        _rates[ii].store(static_cast<uint32_t>(delta * 1000000U / elapsed_us), std::memory_order_relaxed);
+    }
+}
+
+msp_link_statistics_t MspLinkStatistics::get_statistics() const
+{
+    msp_link_statistics_t ret {
+        .tx_wire_bytes = _counters[TX_WIRE].load(std::memory_order_relaxed),
+        .tx_payload_bytes = _counters[TX_PAYLOAD].load(std::memory_order_relaxed),
+        .rx_wire_bytes = _counters[RX_WIRE].load(std::memory_order_relaxed),
+        .rx_payload_bytes = _counters[RX_PAYLOAD].load(std::memory_order_relaxed),
+        .tx_busy_us = _tx_busy_us.load(std::memory_order_relaxed),
+        .tx_wait_us = _tx_wait_us.load(std::memory_order_relaxed),
+        .tx_wire_rate = _rates[TX_WIRE].load(std::memory_order_relaxed),
+        .tx_payload_rate = _rates[TX_PAYLOAD].load(std::memory_order_relaxed),
+        .rx_wire_rate = _rates[RX_WIRE].load(std::memory_order_relaxed),
+        .rx_payload_rate = _rates[RX_PAYLOAD].load(std::memory_order_relaxed),
+        .tx_frames = {},
+        .tx_framing_bytes = {},
+        .rx_frames = {},
+        .rx_framing_bytes = {},
+        .tx_retransmitted_frames = _tx_retransmitted_frames.load(std::memory_order_relaxed)
+    };
+    for (size_t ii = 0; ii < MSP_VERSION_COUNT; ++ii) {
+        ret.tx_frames[ii] = _tx_frames[ii].load(std::memory_order_relaxed);
+        ret.tx_framing_bytes[ii] = _tx_framing_bytes[ii].load(std::memory_order_relaxed);
+        ret.rx_frames[ii] = _rx_frames[ii].load(std::memory_order_relaxed);
+        ret.rx_framing_bytes[ii] = _rx_framing_bytes[ii].load(std::memory_order_relaxed);
+    }
+    return ret;
+}
+
+void MspLinkStatistics::reset()
+{
+    for (auto* counters : { &_counters, &_rates }) {
+        for (auto& counter : *counters) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+    for (auto* counters : { &_tx_frames, &_tx_framing_bytes, &_rx_frames, &_rx_framing_bytes }) {
+        for (auto& counter : *counters) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+    _tx_busy_us.store(0, std::memory_order_relaxed);
+    _tx_wait_us.store(0, std::memory_order_relaxed);
+    _tx_retransmitted_frames.store(0, std::memory_order_relaxed);
+    _bucket_count = 0;
+}
+
+void MspLinkStatistics::write_payload(StreamBufWriter& dst) const
+{
+    const msp_link_statistics_t statistics = get_statistics();
+
+    dst.write_u32(statistics.tx_wire_bytes);
+    dst.write_u32(statistics.tx_payload_bytes);
+    dst.write_u32(statistics.rx_wire_bytes);
+    dst.write_u32(statistics.rx_payload_bytes);
+    dst.write_u32(statistics.tx_busy_us);
+    dst.write_u32(statistics.tx_wait_us);
+    dst.write_u32(statistics.tx_wire_rate);
+    dst.write_u32(statistics.tx_payload_rate);
+    dst.write_u32(statistics.rx_wire_rate);
+    dst.write_u32(statistics.rx_payload_rate);
+    for (size_t ii = 0; ii < MSP_VERSION_COUNT; ++ii) {
+        dst.write_u32(statistics.tx_frames[ii]);
+        dst.write_u32(statistics.tx_framing_bytes[ii]);
+        dst.write_u32(statistics.rx_frames[ii]);
+        dst.write_u32(statistics.rx_framing_bytes[ii]);
+    }
+    dst.write_u32(statistics.tx_retransmitted_frames);
+}
@@ -0,0 +1,104 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "msp_base.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+struct msp_link_statistics_t {
+    uint32_t tx_wire_bytes;     // bytes written to the serial port
+    uint32_t tx_payload_bytes;  // payload bytes of frames sent
+    uint32_t rx_wire_bytes;     // bytes read from the serial port, including noise
+    uint32_t rx_payload_bytes;  // payload bytes of valid frames received
+    uint32_t tx_busy_us;        // time spent in send_frame() writing to the serial port
+    uint32_t tx_wait_us;        // time spent in send_frame() waiting for space in the serial port transmit buffer
+    // rates over the sliding window, in bytes per second
+    uint32_t tx_wire_rate;
+    uint32_t tx_payload_rate;
+    uint32_t rx_wire_rate;
+    uint32_t rx_payload_rate;
+    // frame counts and framing (header and checksum) bytes, by MSP version
+    std::array<uint32_t, MSP_VERSION_COUNT> tx_frames;
+    std::array<uint32_t, MSP_VERSION_COUNT> tx_framing_bytes;
+    std::array<uint32_t, MSP_VERSION_COUNT> rx_frames;
+    std::array<uint32_t, MSP_VERSION_COUNT> rx_framing_bytes;
+    uint32_t tx_retransmitted_frames; // frames resent unchanged (eg by MspReliableWindow), included in tx_wire_bytes but not in tx_frames
+};
+
+/*!
+Link utilisation and goodput accounting for an MspSerial.
+
+The counters are updated by the tasks that send and receive, and may be read from any task.
+Each counter is written with a relaxed load and store rather than a read-modify-write, since read-modify-write atomics are not lock-free
+on all targets, so increments made concurrently by two tasks (eg the parser and a separate command executor) may occasionally be lost.
+*/
+class MspLinkStatistics {
+public:
+    enum direction_e { TX, RX };
+    // the rates are calculated over a sliding window of WINDOW_BUCKET_COUNT buckets
+#if defined(MSP_LINK_STATISTICS_WINDOW_BUCKET_US)
+    static constexpr uint32_t WINDOW_BUCKET_US = MSP_LINK_STATISTICS_WINDOW_BUCKET_US;
+#else
+    static constexpr uint32_t WINDOW_BUCKET_US = 125000;
+#endif
+    static constexpr size_t WINDOW_BUCKET_COUNT = 8;
+    static constexpr size_t MSP_PAYLOAD_SIZE = 11 * sizeof(uint32_t) + 4 * MSP_VERSION_COUNT * sizeof(uint32_t);
+public:
+    void record_wire_bytes(direction_e direction, size_t len);
+    void record_frame(direction_e direction, msp_version_e msp_version, size_t payload_len, size_t framing_len);
+    void record_send_time(uint32_t busy_us, uint32_t wait_us);
+    void record_retransmitted_frame();
+    // called periodically by the receiving task, to update the sliding window rates
+    void update_rates(uint32_t time_microseconds);
+    msp_link_statistics_t get_statistics() const;
+    uint32_t get_wire_bytes(direction_e direction) const { return _counters[direction == TX ? TX_WIRE : RX_WIRE].load(std::memory_order_relaxed); }
+    void reset();
+    // writes the statistics as the payload of an MSP2_LINK_STATISTICS reply
+    void write_payload(StreamBufWriter& dst) const;
+private:
+    enum { TX_WIRE, TX_PAYLOAD, RX_WIRE, RX_PAYLOAD, RATE_COUNTER_COUNT };
+    struct bucket_t {
+        uint32_t time_microseconds;
+        std::array<uint32_t, RATE_COUNTER_COUNT> counters;
+    };
+    static void add(std::atomic<uint32_t>& counter, size_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + static_cast<uint32_t>(value), std::memory_order_relaxed);
+    }
+private:
+    std::array<std::atomic<uint32_t>, RATE_COUNTER_COUNT> _counters {};
+    std::array<std::atomic<uint32_t>, RATE_COUNTER_COUNT> _rates {};
+    std::atomic<uint32_t> _tx_busy_us {};
+    std::atomic<uint32_t> _tx_wait_us {};
+    std::atomic<uint32_t> _tx_retransmitted_frames {};
+    std::array<std::atomic<uint32_t>, MSP_VERSION_COUNT> _tx_frames {};
+    std::array<std::atomic<uint32_t>, MSP_VERSION_COUNT> _tx_framing_bytes {};
+    std::array<std::atomic<uint32_t>, MSP_VERSION_COUNT> _rx_frames {};
+    std::array<std::atomic<uint32_t>, MSP_VERSION_COUNT> _rx_framing_bytes {};
+    // sliding window, only accessed by update_rates()
+    std::array<bucket_t, WINDOW_BUCKET_COUNT> _buckets {};
+    size_t _bucket_index {};
+    size_t _bucket_count {};
+};
@@ -402,6 +402,13 @@ static constexpr uint16_t MSP2_GET_LED_STRIP_CONFIG_VALUES    = 0x3008;
 static constexpr uint16_t MSP2_SET_LED_STRIP_CONFIG_VALUES    = 0x3009;
 static constexpr uint16_t MSP2_SENSOR_CONFIG_ACTIVE           = 0x300A;
 
+// MultiWiiSerialProtocol library commands
+// The firmware command blocks are 0x1000 (common), 0x2000 (INAV) and 0x3000 (Betaflight), the library reserves 0x7F00-0x7FFF
+// for commands it answers itself, rather than passing to MspBase. The range is below 0x8000 so that it fits the int16_t command ids.
+static constexpr uint16_t MSP2_LIBRARY_COMMAND_RANGE_BEGIN    = 0x7F00;
+static constexpr uint16_t MSP2_LIBRARY_COMMAND_RANGE_END      = 0x7FFF;
+static constexpr uint16_t MSP2_LINK_STATISTICS                = 0x7F00;  // returns the link statistics of the MSP port, see MspLinkStatistics
+
 // MSP2_SET_TEXT and MSP2_GET_TEXT variable types
 static constexpr uint8_t MSP2TEXT_PILOT_NAME                      = 1;
 static constexpr uint8_t MSP2TEXT_CRAFT_NAME                      = 2;
@@ -0,0 +1,139 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "msp_reliable_window.h"
+
+#include <algorithm>
+
+
+/*!
+Releases retained replies that are WINDOW_SIZE_MAX or more sequence numbers behind the request, since the client
+can only have sent this request once it had received them.
+Replies further behind than SEQUENCE_COUNT - WINDOW_SIZE_MAX are ahead of the request, which must be a repeat.
+
+Sequence numbers are remembered as executed, whether or not their reply was retained, until they are released in the same way,
+so that a repeated request is never executed again.
+*/
+const MspReliableWindow::frame_t* MspReliableWindow::on_request(uint8_t sequence, bool& duplicate)
+{
+    sequence &= SEQUENCE_MASK;
+    for (uint8_t behind = WINDOW_SIZE_MAX; behind <= SEQUENCE_COUNT - WINDOW_SIZE_MAX; ++behind) {
+        _executed = static_cast<uint16_t>(_executed & ~(1U << ((sequence - behind) & SEQUENCE_MASK)));
+    }
+    const frame_t* retained = nullptr;
+    for (auto& frame : _frames) {
+        if (!frame.in_use) {
+            continue;
+        }
+        const uint8_t behind = (sequence - frame.sequence) & SEQUENCE_MASK;
+        if (behind == 0) {
+            retained = &frame;
+        } else if (behind >= WINDOW_SIZE_MAX && behind <= SEQUENCE_COUNT - WINDOW_SIZE_MAX) {
+            frame.in_use = false;
+            ++_statistics.acknowledged;
+        }
+    }
+    duplicate = retained || (_executed & (1U << sequence)) != 0;
+    _executed = static_cast<uint16_t>(_executed | (1U << sequence));
+    if (duplicate) {
+        ++_statistics.duplicates;
+    }
+    if (retained) {
+        ++_statistics.retransmitted;
+    }
+    return retained;
+}
+
+void MspReliableWindow::retain(uint8_t sequence, const uint8_t* header, size_t header_len, const uint8_t* data, size_t data_len, const uint8_t* crc, size_t crc_len)
+{
+    const size_t len = header_len + data_len + crc_len;
+    if (len > FRAME_SIZE) {
+        ++_statistics.not_retained;
+        return;
+    }
+    // use a free slot, or evict the oldest reply
+    frame_t* slot = &_frames[0];
+    for (auto& frame : _frames) {
+        if (!frame.in_use) {
+            slot = &frame;
+            break;
+        }
+        if (frame.age - slot->age > UINT32_MAX / 2) { // frame is older than slot, allowing for wraparound
+            slot = &frame;
+        }
+    }
+    if (slot->in_use) {
+        ++_statistics.evicted;
+    }
+    std::copy_n(header, header_len, &slot->buf[0]);
+    if (data_len > 0) {
+        std::copy_n(data, data_len, &slot->buf[header_len]);
+    }
+    std::copy_n(crc, crc_len, &slot->buf[header_len + data_len]);
+    slot->len = len;
+    slot->sequence = sequence & SEQUENCE_MASK;
+    slot->age = _age++;
+    slot->in_use = true;
+    ++_statistics.retained;
+}
+
+size_t MspReliableWindow::on_ack(uint16_t acknowledged, std::array<const frame_t*, SLOT_COUNT>& retransmit)
+{
+    // release the acknowledged replies, noting the age of the most recent
+    bool any_acknowledged = false;
+    uint32_t newest_acknowledged_age = 0;
+    for (auto& frame : _frames) {
+        if (frame.in_use && (acknowledged & (1U << frame.sequence))) {
+            if (!any_acknowledged || frame.age - newest_acknowledged_age < UINT32_MAX / 2) {
+                newest_acknowledged_age = frame.age;
+            }
+            any_acknowledged = true;
+            frame.in_use = false;
+            ++_statistics.acknowledged;
+        }
+    }
+    if (!any_acknowledged) {
+        return 0;
+    }
+    // replies sent before the most recent acknowledged reply have been missed
+    size_t count = 0;
+    for (const auto& frame : _frames) {
+        if (frame.in_use && newest_acknowledged_age - frame.age < UINT32_MAX / 2) {
+            retransmit[count++] = &frame;
+        }
+    }
+    std::sort(retransmit.begin(), retransmit.begin() + static_cast<std::ptrdiff_t>(count), [](const frame_t* a, const frame_t* b) { return static_cast<int32_t>(a->age - b->age) < 0; });
+    _statistics.retransmitted += static_cast<uint32_t>(count);
+    return count;
+}
+
+size_t MspReliableWindow::get_retained_count() const
+{
+    return static_cast<size_t>(std::count_if(_frames.begin(), _frames.end(), [](const frame_t& frame) { return frame.in_use; }));
+}
+
+void MspReliableWindow::reset()
+{
+    for (auto& frame : _frames) {
+        frame.in_use = false;
+    }
+    _executed = 0;
+    _statistics = {};
+}
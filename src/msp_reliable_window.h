@@ -0,0 +1,111 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+
+/*!
+Sliding window reliable delivery of replies, using the MSPv2 flags byte.
+
+A client that wants reliable delivery sets FLAG_RELIABLE and a 4-bit sequence number in the flags of its MSPv2 requests,
+and may have up to WINDOW_SIZE_MAX requests outstanding rather than waiting for each reply in turn.
+The reply to a reliable request carries the same flags, and the encoded reply frame is retained until it is acknowledged.
+
+If a reply is lost the client resends the request with the same sequence number: the request is not executed a second time,
+instead the retained reply is retransmitted. If the reply was not retained (there was no reply, or it was deferred, streamed,
+or too large to retain) the repeated request is answered with an empty ACK, so a non-idempotent command is still only executed once.
+The client acknowledges replies with a frame with FLAG_RELIABLE and FLAG_ACK set whose payload is a uint16_t bitmap of the
+sequence numbers it has received. The acknowledged replies are released and any retained replies sent before the most recent
+acknowledged reply, which the client has therefore missed, are retransmitted (selective repeat).
+Receiving a request implicitly acknowledges replies WINDOW_SIZE_MAX or more sequence numbers behind it: since the client has
+at most WINDOW_SIZE_MAX requests outstanding, up to WINDOW_SIZE_MAX - 1 retained replies may be ahead of a repeated request,
+so replies more than SEQUENCE_COUNT - WINDOW_SIZE_MAX behind are taken to be ahead.
+
+Flags byte:
+    bit 0   reserved (used by Betaflight as "don't reply")
+    bits 1-4 sequence number
+    bit 5   MspCompressor::FLAG_COMPRESSED
+    bit 6   FLAG_ACK
+    bit 7   FLAG_RELIABLE
+
+Retention uses SLOT_COUNT fixed buffers of FRAME_SIZE bytes; replies that are too large, for example streamed replies,
+are sent without being retained.
+*/
+class MspReliableWindow {
+public:
+    static constexpr uint8_t FLAG_RELIABLE = 0x80;
+    static constexpr uint8_t FLAG_ACK = 0x40;
+    static constexpr uint8_t SEQUENCE_SHIFT = 1;
+    static constexpr uint8_t SEQUENCE_MASK = 0x0F;
+    static constexpr uint8_t SEQUENCE_COUNT = SEQUENCE_MASK + 1;
+    static constexpr uint8_t WINDOW_SIZE_MAX = SEQUENCE_COUNT / 4;
+#if defined(MSP_RELIABLE_WINDOW_SLOT_COUNT)
+    static constexpr size_t SLOT_COUNT = MSP_RELIABLE_WINDOW_SLOT_COUNT;
+#else
+    static constexpr size_t SLOT_COUNT = 4;
+#endif
+#if defined(MSP_RELIABLE_WINDOW_FRAME_SIZE)
+    static constexpr size_t FRAME_SIZE = MSP_RELIABLE_WINDOW_FRAME_SIZE;
+#else
+    static constexpr size_t FRAME_SIZE = 272; // header, 256 byte payload, and checksum
+#endif
+    static_assert(SLOT_COUNT <= WINDOW_SIZE_MAX);
+    struct frame_t {
+        std::array<uint8_t, FRAME_SIZE> buf;
+        size_t len;
+        uint32_t age;   // order in which the frames were retained
+        uint8_t sequence;
+        bool in_use;
+    };
+    struct statistics_t {
+        uint32_t retained;
+        uint32_t not_retained;  // too large to retain
+        uint32_t acknowledged;
+        uint32_t retransmitted;
+        uint32_t duplicates;    // requests received again, answered with the retained reply or an empty ACK
+        uint32_t evicted;       // replies released without being acknowledged, to make room for newer replies
+    };
+public:
+    static bool is_reliable(uint8_t flags) { return (flags & FLAG_RELIABLE) != 0; }
+    static bool is_ack(uint8_t flags) { return (flags & FLAG_ACK) != 0; }
+    static uint8_t get_sequence(uint8_t flags) { return (flags >> SEQUENCE_SHIFT) & SEQUENCE_MASK; }
+    static uint8_t make_flags(uint8_t sequence) { return static_cast<uint8_t>(FLAG_RELIABLE | ((sequence & SEQUENCE_MASK) << SEQUENCE_SHIFT)); }
+    // flags with the reliability bits cleared, as seen by the command handler
+    static uint8_t strip_flags(uint8_t flags) { return static_cast<uint8_t>(flags & ~(FLAG_RELIABLE | FLAG_ACK | (SEQUENCE_MASK << SEQUENCE_SHIFT))); }
+
+    // called when a reliable request is received, sets duplicate if the request has already been executed,
+    // and returns the retained reply if there is one
+    const frame_t* on_request(uint8_t sequence, bool& duplicate);
+    void retain(uint8_t sequence, const uint8_t* header, size_t header_len, const uint8_t* data, size_t data_len, const uint8_t* crc, size_t crc_len);
+    // releases the acknowledged replies and fills retransmit with the frames the client has missed, oldest first, returning their count
+    size_t on_ack(uint16_t acknowledged, std::array<const frame_t*, SLOT_COUNT>& retransmit);
+    size_t get_retained_count() const;
+    const statistics_t& get_statistics() const { return _statistics; }
+    void reset();
+private:
+    std::array<frame_t, SLOT_COUNT> _frames {};
+    uint32_t _age {};
+    uint16_t _executed {}; // bitmap of the sequence numbers in the window whose requests have been executed
+    statistics_t _statistics {};
+};
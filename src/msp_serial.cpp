@@ -48,10 +48,21 @@
 #include "msp_serial_port_base.h"
 #include "msp_stream.h"
 
-#include <stream_buf_writer.h>
+#include <time_microseconds.h>
 
 static void yield();
+static void yield_task();
+static void sleep_for_us(uint32_t us);
 
+// hint to the CPU that this is a spin-wait loop
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || (defined(__ARM_ARCH) && __ARM_ARCH >= 6)
+    __asm__ volatile("yield");
+#endif
+}
 
 #if defined(FRAMEWORK_USE_FREERTOS)
 #if defined(FRAMEWORK_ESPIDF) || defined(FRAMEWORK_ARDUINO_ESP32)
@@ -68,34 +79,149 @@ static void yield();
 #endif
 
 void yield() { taskYIELD(); }
+static void yield_task() { taskYIELD(); }
+static void sleep_for_us(uint32_t us)
+{
+    // sleeping for a whole tick when less than a tick is required would leave the transmitter idle, so yield instead
+    const TickType_t ticks = pdMS_TO_TICKS(us / 1000);
+    if (ticks == 0) {
+        taskYIELD();
+    } else {
+        vTaskDelay(ticks);
+    }
+}
 
 #else
 
+static void yield_task() { cpu_relax(); }
+
 #if defined(FRAMEWORK_RPI_PICO)
 #include <pico/time.h>
 static void yield() { sleep_ms(1); }
+static void sleep_for_us(uint32_t us) { sleep_us(us); }
 #else
 static void yield() {}
+static void sleep_for_us(uint32_t us)
+{
+    const uint32_t start_us = time_us();
+    while (time_us() - start_us < us) {
+        cpu_relax();
+    }
+}
 #endif
 #endif
 
 
 MspSerial::MspSerial(MspStream& msp_stream, MspSerialPortBase& msp_serial_port) :
     _msp_stream(msp_stream),
-    _msp_serial_port(msp_serial_port)
+    _msp_serial_port(&msp_serial_port)
+{
+    msp_stream.set_msp_serial(this);
+}
+
+MspSerial::MspSerial(MspStream& msp_stream) :
+    _msp_stream(msp_stream)
 {
     msp_stream.set_msp_serial(this);
 }
 
+void MspSerial::set_tx_wait_policy(msp_tx_wait_policy_e tx_wait_policy, uint32_t baud_rate)
+{
+    _tx_wait_policy = (tx_wait_policy == MSP_TX_WAIT_SLEEP && baud_rate == 0) ? MSP_TX_WAIT_YIELD : tx_wait_policy;
+    _baud_rate = baud_rate;
+}
+
+/*!
+Returns the time taken to transmit len bytes at the baud rate set by set_tx_wait_policy().
+*/
+uint32_t MspSerial::get_tx_drain_time_us(size_t len) const
+{
+    if (_baud_rate == 0) {
+        return 0;
+    }
+    return static_cast<uint32_t>((static_cast<uint64_t>(len) * BITS_PER_BYTE * 1000000U + _baud_rate - 1) / _baud_rate);
+}
+
+/*!
+With MSP_TX_WAIT_SLEEP, sleeps until there should be room for the rest of the frame, or until the transmit buffer should have drained if the rest
+of the frame is larger than the buffer. Since the buffer size is estimated from the largest write so far, this errs on the side of sleeping too little.
+*/
+void MspSerial::wait_for_write(size_t bytes_remaining)
+{
+    switch (_tx_wait_policy) {
+    case MSP_TX_WAIT_SPIN:
+        cpu_relax();
+        break;
+    case MSP_TX_WAIT_YIELD:
+        yield_task();
+        break;
+    case MSP_TX_WAIT_SLEEP:
+        sleep_for_us(get_tx_drain_time_us(std::min(bytes_remaining, _tx_buffer_size_estimate)));
+        break;
+    default:
+        yield();
+        break;
+    }
+}
+
 /*!
 Called from MspTask::loop()
 */
 void MspSerial::process_input(msp_context_t& pg)
 {
-    while (_msp_serial_port.is_data_available()) {
-        const uint8_t in_char = _msp_serial_port.read_byte();
-        _msp_stream.put_char(pg, in_char, nullptr); // This will invoke MspSerial::send_frame(), when a completed frame is received
+    process_input_from(pg, *_msp_serial_port);
+}
+
+/*!
+Returns the size of the next chunk of input to read, limited so that the byte budget is not exceeded.
+*/
+size_t MspSerial::get_input_chunk_size(size_t byte_count) const
+{
+    if (_input_budget.max_bytes == 0) {
+        return INPUT_CHUNK_SIZE;
+    }
+    return std::min(INPUT_CHUNK_SIZE, _input_budget.max_bytes - std::min(byte_count, static_cast<size_t>(_input_budget.max_bytes)));
+}
+
+bool MspSerial::is_input_budget_exhausted(size_t byte_count, size_t frame_count, uint32_t elapsed_us)
+{
+    if ((_input_budget.max_bytes != 0 && byte_count >= _input_budget.max_bytes)
+        || (_input_budget.max_frames != 0 && frame_count >= _input_budget.max_frames)
+        || (_input_budget.max_microseconds != 0 && elapsed_us >= _input_budget.max_microseconds)) {
+        ++_input_budget_exhausted_count;
+        return true;
     }
+    return false;
+}
+
+/*!
+Called from MspTask::loop(), after process_input().
+Executes any queued commands and sends the replies of commands whose processing has been deferred, for example to a coroutine handler.
+
+If the MspStream has a frame queue, this may instead be called from a separate task (for example on the other core of a dual core processor),
+so that commands are executed concurrently with the parsing done in process_input(). See MspTask::set_process_output().
+*/
+void MspSerial::process_output(msp_context_t& pg)
+{
+    _msp_stream.process_queued_frames(pg);
+    _msp_stream.resume_coroutines(pg);
+    _msp_stream.expire_pending_replies(pg, time_us());
+    _msp_stream.send_completed_replies();
+    if (is_tx_flush_due(time_us())) {
+        flush_tx();
+    }
+}
+
+void MspSerial::set_tx_coalescing(size_t packet_size, uint32_t flush_timeout_us)
+{
+    flush_tx();
+    _tx_packet_size = std::min(packet_size, TX_COALESCE_BUFFER_SIZE);
+    _tx_flush_timeout_us = flush_timeout_us;
+}
+
+void MspSerial::flush_tx()
+{
+    flush_tx_to(*_msp_serial_port);
 }
 
 /*!
@@ -103,8 +229,6 @@ Called from  MspStream::serial_encode() which is called from MspStream::process_
 */
 size_t MspSerial::send_frame(const uint8_t* header, size_t header_len, const uint8_t* data, size_t data_len, const uint8_t* crc, size_t crc_len)
 {
-    const size_t total_frame_length = header_len + data_len + crc_len;
-
     // We are allowed to send out the response if
     //  a) TX buffer is completely empty (we are talking to well-behaving party that follows request-response scheduling;
     //     this allows us to transmit jumbo frames bigger than TX buffer (serialWriteBuf will block, but for jumbo frames we don't care)
@@ -116,29 +240,20 @@ size_t MspSerial::send_frame(const uint8_t* header, size_t header_len, const uin
     // buffer empty if Serial.available_for_write() >= SERIAL_TX_BUFFER_SIZE - 1
     // if (total_frame_length <= Serial.available_for_write())
 
+    return send_frame_to(*_msp_serial_port, header, header_len, data, data_len, crc, crc_len);
+}
 
-    // write the header
-    while (_msp_serial_port.available_for_write() < header_len) {
-        yield();
-    }
-    _msp_serial_port.write(header, header_len);
-
-    // write the data
-
-    StreamBufReader sbuf(data, data_len);
-    while (sbuf.bytes_remaining() > 0) {
-        const size_t available = _msp_serial_port.available_for_write();
-        const size_t writeLen = std::min(available, static_cast<size_t>(sbuf.bytes_remaining()));
-        _msp_serial_port.write(sbuf.ptr(), writeLen);
-        sbuf.advance(writeLen);
-        yield();
-    }
+/*!
+Writes part of a frame, blocking until it has all been written to the serial port.
 
-    // write the crc
-    while (_msp_serial_port.available_for_write() < crc_len) {
-        yield();
-    }
-    _msp_serial_port.write(crc, crc_len);
+Called from MspStream::serial_encode_generated() which sends a frame in parts as the payload is generated.
+*/
+size_t MspSerial::send_frame_part(const uint8_t* data, size_t len)
+{
+    return send_frame_part_to(*_msp_serial_port, data, len);
+}
 
-    return total_frame_length;
+size_t MspSerial::available_for_write() const
+{
+    return _msp_serial_port->available_for_write();
 }
@@ -46,24 +46,305 @@
 
 #pragma once
 
+#include "msp_link_statistics.h"
+#include "msp_stream.h"
+
+#include <algorithm>
 #include <array>
+#include <concepts>
 #include <cstddef>
 #include <cstdint>
+#include <stream_buf_reader.h>
+#include <time_microseconds.h>
 
 
-class MspStream;
 class MspSerialPortBase;
 struct msp_context_t;
 
+// limits on the input processed by each call to MspSerial::process_input(), zero means no limit
+struct msp_input_budget_t {
+    uint32_t max_bytes;
+    uint32_t max_frames;
+    uint32_t max_microseconds;
+};
+
+// how MspSerial waits for space in the serial port transmit buffer when sending a frame
+enum msp_tx_wait_policy_e {
+    MSP_TX_WAIT_DEFAULT,    // taskYIELD() under FreeRTOS, sleep_ms(1) on the bare Raspberry Pi Pico, otherwise spin
+    MSP_TX_WAIT_SPIN,       // busy-wait, with a CPU pause hint
+    MSP_TX_WAIT_YIELD,      // yield to other tasks of the same priority, spins if there is no scheduler
+    MSP_TX_WAIT_SLEEP,      // sleep for the estimated time for the transmit buffer to drain, calculated from the baud rate
+    MSP_TX_WAIT_NOTIFY      // block in MspSerialPortBase::wait_for_write_space(), falls back to MSP_TX_WAIT_DEFAULT if the port does not support it
+};
 
 class MspSerial {
+public:
+    static constexpr size_t INPUT_CHUNK_SIZE = 64;
+    static constexpr uint32_t BITS_PER_BYTE = 10; // start bit, 8 data bits, stop bit
+    // timeout for MSP_TX_WAIT_NOTIFY when the baud rate is not known
+    static constexpr uint32_t TX_NOTIFY_TIMEOUT_US = 10000;
+#if defined(MSP_SERIAL_TX_COALESCE_BUFFER_SIZE)
+    static constexpr size_t TX_COALESCE_BUFFER_SIZE = MSP_SERIAL_TX_COALESCE_BUFFER_SIZE;
+#else
+    static constexpr size_t TX_COALESCE_BUFFER_SIZE = 64; // a full speed USB packet
+#endif
 public:
     virtual ~MspSerial() = default;
     MspSerial(MspStream& msp_stream, MspSerialPortBase& msp_serial_port);
 
     virtual size_t send_frame(const uint8_t* headerr, size_t header_len, const uint8_t* data, size_t data_len, const uint8_t* crc, size_t crc_len);
+    virtual size_t send_frame_part(const uint8_t* data, size_t len);
+    // called after the last part of a frame sent with send_frame_part()
+    virtual void send_frame_end() {}
+    virtual size_t available_for_write() const;
     virtual void process_input(msp_context_t& pg);
-private:
+    virtual void process_output(msp_context_t& pg);
+
+    MspLinkStatistics& get_link_statistics() { return _link_statistics; }
+    const MspLinkStatistics& get_link_statistics() const { return _link_statistics; }
+
+    // unprocessed input is left in the serial port, and the parser continues from where it left off on the next call to process_input()
+    // the frame and time limits are checked after each chunk of input, so may be exceeded by up to one chunk
+    void set_input_budget(const msp_input_budget_t& input_budget) { _input_budget = input_budget; }
+    const msp_input_budget_t& get_input_budget() const { return _input_budget; }
+    uint32_t get_input_budget_exhausted_count() const { return _input_budget_exhausted_count; }
+
+    // baud_rate is required by MSP_TX_WAIT_SLEEP, to estimate the drain time, and is used by MSP_TX_WAIT_NOTIFY to set the timeout
+    void set_tx_wait_policy(msp_tx_wait_policy_e tx_wait_policy, uint32_t baud_rate = 0);
+    msp_tx_wait_policy_e get_tx_wait_policy() const { return _tx_wait_policy; }
+    uint32_t get_tx_drain_time_us(size_t len) const;
+
+    // TX coalescing, for transports where each write has a cost, eg USB CDC where each write may become a USB packet.
+    // Frames are accumulated and written to the serial port in packets of packet_size bytes (at most TX_COALESCE_BUFFER_SIZE),
+    // a partial packet is written at the end of the process_input() or process_output() call in which it was started, or,
+    // if flush_timeout_us is non-zero, at the end of the first such call after it has been held for flush_timeout_us.
+    // If the MspStream has a frame queue, replies are only written by process_output(), so only process_output() flushes,
+    // and process_input() does not touch the coalescing buffer, which may be in use by another task.
+    // A packet_size of zero disables coalescing.
+    void set_tx_coalescing(size_t packet_size, uint32_t flush_timeout_us);
+    size_t get_tx_coalescing_packet_size() const { return _tx_packet_size; }
+    size_t get_tx_coalesced_len() const { return _tx_coalesce_len; }
+    virtual void flush_tx();
+protected:
+    // for derived classes that access their serial port directly, see MspSerialStatic
+    explicit MspSerial(MspStream& msp_stream);
+    // The implementation of the serial port functions, parameterised on the port type, so that MspSerial can use them with
+    // an MspSerialPortBase and MspSerialStatic with a port whose functions can be inlined.
+    template <typename PORT>
+    void process_input_from(msp_context_t& pg, PORT& port);
+    template <typename PORT>
+    size_t send_frame_to(PORT& port, const uint8_t* header, size_t header_len, const uint8_t* data, size_t data_len, const uint8_t* crc, size_t crc_len);
+    template <typename PORT>
+    size_t send_frame_part_to(PORT& port, const uint8_t* data, size_t len);
+    template <typename PORT>
+    void flush_tx_to(PORT& port);
+    template <typename PORT>
+    uint32_t write_data(PORT& port, const uint8_t* data, size_t len);
+    template <typename PORT>
+    uint32_t write_port(PORT& port, const uint8_t* data, size_t len);
+    template <typename PORT>
+    static size_t read_port(PORT& port, uint8_t* buf, size_t len);
+    // called while waiting for room in the serial port transmit buffer, with the number of bytes still to be written
+    // MSP_TX_WAIT_NOTIFY needs the port, so there is no overload without one for derived classes to use
+    template <typename PORT>
+    void wait_for_write(PORT& port, size_t bytes_remaining);
+    // the space to wait for with MSP_TX_WAIT_NOTIFY, and the time after which to give up
+    size_t get_tx_notify_len(size_t bytes_remaining) const { return std::min(bytes_remaining, _tx_buffer_size_estimate); }
+    uint32_t get_tx_notify_timeout_us(size_t len) const { return _baud_rate == 0 ? TX_NOTIFY_TIMEOUT_US : 2 * get_tx_drain_time_us(len) + 1000; }
+    template <typename WRITE_PORT>
+    uint32_t write_coalesced(const uint8_t* data, size_t len, WRITE_PORT write_port);
+    bool is_tx_flush_due(uint32_t time_microseconds) const {
+        return _tx_coalesce_len > 0 && (_tx_flush_timeout_us == 0 || time_microseconds - _tx_coalesce_start_us >= _tx_flush_timeout_us);
+    }
+    // the largest single write so far, an estimate of the size of the serial port transmit buffer
+    void record_write_len(size_t len) { _tx_buffer_size_estimate = std::max(_tx_buffer_size_estimate, len); }
+    size_t get_input_chunk_size(size_t byte_count) const;
+    bool is_input_budget_exhausted(size_t byte_count, size_t frame_count, uint32_t elapsed_us);
+protected:
     MspStream& _msp_stream;
-    MspSerialPortBase& _msp_serial_port;
+    MspLinkStatistics _link_statistics;
+    msp_input_budget_t _input_budget {};
+    uint32_t _input_budget_exhausted_count {};
+    msp_tx_wait_policy_e _tx_wait_policy { MSP_TX_WAIT_DEFAULT };
+    uint32_t _baud_rate {};
+    size_t _tx_buffer_size_estimate { 1 };
+    std::array<uint8_t, TX_COALESCE_BUFFER_SIZE> _tx_coalesce_buf {};
+    size_t _tx_packet_size {};
+    size_t _tx_coalesce_len {};
+    uint32_t _tx_flush_timeout_us {};
+    uint32_t _tx_coalesce_start_us {};
+private:
+    // waits according to the TX wait policy, for when the port does not support MSP_TX_WAIT_NOTIFY
+    void wait_for_write(size_t bytes_remaining);
+private:
+    MspSerialPortBase* _msp_serial_port {};
 };
+
+/*!
+Copies data into the coalescing buffer, calling write_port(data, len) to write each full packet.
+When the buffer is empty, whole packets are written directly from data.
+Returns the time spent waiting for space in the serial port transmit buffer.
+*/
+template <typename WRITE_PORT>
+inline uint32_t MspSerial::write_coalesced(const uint8_t* data, size_t len, WRITE_PORT write_port)
+{
+    uint32_t wait_us = 0;
+    while (len > 0) {
+        if (_tx_coalesce_len == 0) {
+            if (len >= _tx_packet_size) {
+                const size_t direct_len = len - len % _tx_packet_size;
+                wait_us += write_port(data, direct_len);
+                data += direct_len; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+                len -= direct_len;
+                continue;
+            }
+            _tx_coalesce_start_us = time_us();
+        }
+        const size_t copy_len = std::min(len, _tx_packet_size - _tx_coalesce_len);
+        std::copy_n(data, copy_len, &_tx_coalesce_buf[_tx_coalesce_len]);
+        _tx_coalesce_len += copy_len;
+        data += copy_len; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        len -= copy_len;
+        if (_tx_coalesce_len == _tx_packet_size) {
+            _tx_coalesce_len = 0;
+            wait_us += write_port(&_tx_coalesce_buf[0], _tx_packet_size);
+        }
+    }
+    return wait_us;
+}
+
+/*!
+Reads input from the port in chunks and passes it to the parser, until there is no more input or the input budget is exhausted.
+*/
+template <typename PORT>
+inline void MspSerial::process_input_from(msp_context_t& pg, PORT& port)
+{
+    std::array<uint8_t, INPUT_CHUNK_SIZE> buf; // NOLINT(cppcoreguidelines-pro-type-member-init,hicpp-member-init)
+    const uint32_t start_us = time_us();
+    size_t byte_count = 0;
+    size_t frame_count = 0;
+    while (true) {
+        const size_t len = read_port(port, &buf[0], get_input_chunk_size(byte_count));
+        if (len == 0) {
+            break;
+        }
+        _link_statistics.record_wire_bytes(MspLinkStatistics::RX, len);
+        const uint32_t time_microseconds = time_us();
+        frame_count += _msp_stream.put_buf(pg, &buf[0], len, time_microseconds); // This will invoke send_frame(), when a completed frame is received
+        byte_count += len;
+        if (is_input_budget_exhausted(byte_count, frame_count, time_microseconds - start_us)) {
+            break;
+        }
+    }
+    const uint32_t time_microseconds = time_us();
+    if (!_msp_stream.has_frame_queue() && is_tx_flush_due(time_microseconds)) {
+        flush_tx();
+    }
+    _link_statistics.update_rates(time_microseconds);
+}
+
+template <typename PORT>
+inline size_t MspSerial::send_frame_to(PORT& port, const uint8_t* header, size_t header_len, const uint8_t* data, size_t data_len, const uint8_t* crc, size_t crc_len)
+{
+    const uint32_t start_us = time_us();
+    uint32_t wait_us = write_data(port, header, header_len);
+    wait_us += write_data(port, data, data_len);
+    wait_us += write_data(port, crc, crc_len);
+    const uint32_t elapsed_us = time_us() - start_us;
+    _link_statistics.record_send_time(elapsed_us - std::min(wait_us, elapsed_us), wait_us);
+    return header_len + data_len + crc_len;
+}
+
+template <typename PORT>
+inline size_t MspSerial::send_frame_part_to(PORT& port, const uint8_t* data, size_t len)
+{
+    const uint32_t start_us = time_us();
+    const uint32_t wait_us = write_data(port, data, len);
+    const uint32_t elapsed_us = time_us() - start_us;
+    _link_statistics.record_send_time(elapsed_us - std::min(wait_us, elapsed_us), wait_us);
+    return len;
+}
+
+/*!
+Writes any partial packet held in the coalescing buffer.
+*/
+template <typename PORT>
+inline void MspSerial::flush_tx_to(PORT& port)
+{
+    if (_tx_coalesce_len == 0) {
+        return;
+    }
+    const size_t len = _tx_coalesce_len;
+    _tx_coalesce_len = 0;
+    const uint32_t start_us = time_us();
+    const uint32_t wait_us = write_port(port, &_tx_coalesce_buf[0], len);
+    const uint32_t elapsed_us = time_us() - start_us;
+    _link_statistics.record_send_time(elapsed_us - std::min(wait_us, elapsed_us), wait_us);
+}
+
+template <typename PORT>
+inline uint32_t MspSerial::write_data(PORT& port, const uint8_t* data, size_t len)
+{
+    if (_tx_packet_size == 0) {
+        return write_port(port, data, len);
+    }
+    return write_coalesced(data, len, [this, &port](const uint8_t* packet, size_t packet_len) { return write_port(port, packet, packet_len); });
+}
+
+/*!
+Writes data to the serial port as space becomes available in its transmit buffer.
+Returns the time spent waiting for space.
+*/
+template <typename PORT>
+inline uint32_t MspSerial::write_port(PORT& port, const uint8_t* data, size_t len)
+{
+    uint32_t wait_us = 0;
+    StreamBufReader sbuf(data, len);
+    while (sbuf.bytes_remaining() > 0) {
+        const size_t write_len = std::min(static_cast<size_t>(port.available_for_write()), static_cast<size_t>(sbuf.bytes_remaining()));
+        const size_t written = port.write(sbuf.ptr(), write_len);
+        _link_statistics.record_wire_bytes(MspLinkStatistics::TX, written);
+        record_write_len(written);
+        sbuf.advance(written);
+        if (sbuf.bytes_remaining() > 0) {
+            const uint32_t wait_start_us = time_us();
+            wait_for_write(port, sbuf.bytes_remaining());
+            wait_us += time_us() - wait_start_us;
+        }
+    }
+    return wait_us;
+}
+
+/*!
+Reads up to len bytes, using the port's read(buf, len) function if it has one, otherwise reading a byte at a time.
+*/
+template <typename PORT>
+inline size_t MspSerial::read_port(PORT& port, uint8_t* buf, size_t len)
+{
+    if constexpr (requires { { port.read(buf, len) } -> std::convertible_to<size_t>; }) {
+        return port.read(buf, len);
+    } else {
+        size_t count = 0;
+        while (count < len && port.is_data_available()) {
+            buf[count++] = port.read_byte(); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        }
+        return count;
+    }
+}
+
+/*!
+With MSP_TX_WAIT_NOTIFY, blocks in the port's wait_for_write_space(), if it has one, otherwise waits according to the TX wait policy.
+*/
+template <typename PORT>
+inline void MspSerial::wait_for_write(PORT& port, size_t bytes_remaining)
+{
+    if constexpr (requires { { port.wait_for_write_space(bytes_remaining, uint32_t {}) } -> std::convertible_to<bool>; }) {
+        if (_tx_wait_policy == MSP_TX_WAIT_NOTIFY) {
+            const size_t len = get_tx_notify_len(bytes_remaining);
+            if (port.wait_for_write_space(len, get_tx_notify_timeout_us(len))) {
+                return;
+            }
+        }
+    }
+    wait_for_write(bytes_remaining);
+}
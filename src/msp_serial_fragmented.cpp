@@ -0,0 +1,239 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "msp_serial_fragmented.h"
+#include "msp_serial_port_base.h"
+
+#include <algorithm>
+#include <time_microseconds.h>
+
+
+MspSerialFragmented::MspSerialFragmented(MspStream& msp_stream, MspSerialPortBase& msp_serial_port, size_t mtu) :
+    MspSerial(msp_stream),
+    _port(msp_serial_port),
+    _mtu(std::clamp(mtu, HEADER_SIZE + 1, MTU_MAX))
+{
+}
+
+size_t MspSerialFragmented::available_for_write() const
+{
+    return _port.available_for_write();
+}
+
+size_t MspSerialFragmented::send_frame(const uint8_t* header, size_t header_len, const uint8_t* data, size_t data_len, const uint8_t* crc, size_t crc_len)
+{
+    append_tx(header, header_len);
+    append_tx(data, data_len);
+    append_tx(crc, crc_len);
+    write_fragment(true);
+    return header_len + data_len + crc_len;
+}
+
+/*!
+Called from MspStream::serial_encode_generated(), the frame is completed by send_frame_end().
+*/
+size_t MspSerialFragmented::send_frame_part(const uint8_t* data, size_t len)
+{
+    append_tx(data, len);
+    return len;
+}
+
+void MspSerialFragmented::send_frame_end()
+{
+    write_fragment(true);
+}
+
+void MspSerialFragmented::append_tx(const uint8_t* data, size_t len)
+{
+    while (len > 0) {
+        if (_tx_fragment_len == _mtu) {
+            // the fragment is full and there is more of the frame, so it is not the last fragment
+            write_fragment(false);
+        }
+        const size_t copy_len = std::min(len, _mtu - _tx_fragment_len);
+        std::copy_n(data, copy_len, &_tx_fragment[_tx_fragment_len]);
+        _tx_fragment_len += copy_len;
+        data += copy_len; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        len -= copy_len;
+    }
+}
+
+/*!
+Writes the fragment being built, waiting until the serial port can take all of it, since it must be sent as a single packet.
+Fragments beyond FRAGMENT_COUNT_MAX are not sent, so the receiver will discard the frame.
+*/
+void MspSerialFragmented::write_fragment(bool last)
+{
+    if (!_tx_overflow) {
+        _tx_fragment[0] = static_cast<uint8_t>((_tx_sequence & SEQUENCE_MASK) | (last ? LAST_FRAGMENT : 0U));
+        _tx_fragment[1] = _tx_index;
+        const uint32_t start_us = time_us();
+        uint32_t wait_us = 0;
+        while (_port.available_for_write() < _tx_fragment_len) {
+            const uint32_t wait_start_us = time_us();
+            wait_for_write(_port, _tx_fragment_len);
+            wait_us += time_us() - wait_start_us;
+        }
+        const size_t written = _port.write(&_tx_fragment[0], _tx_fragment_len);
+        _link_statistics.record_wire_bytes(MspLinkStatistics::TX, written);
+        record_write_len(written);
+        const uint32_t elapsed_us = time_us() - start_us;
+        _link_statistics.record_send_time(elapsed_us - std::min(wait_us, elapsed_us), wait_us);
+        ++_fragment_statistics.fragments_sent;
+    }
+    if (_tx_index == FRAGMENT_COUNT_MAX - 1) {
+        _tx_overflow = true;
+    } else {
+        ++_tx_index;
+    }
+    _tx_fragment_len = HEADER_SIZE;
+    if (last) {
+        ++_tx_sequence;
+        _tx_index = 0;
+        _tx_overflow = false;
+    }
+}
+
+void MspSerialFragmented::process_input(msp_context_t& pg)
+{
+    std::array<uint8_t, MTU_MAX> buf; // NOLINT(cppcoreguidelines-pro-type-member-init,hicpp-member-init)
+    const uint32_t start_us = time_us();
+    size_t byte_count = 0;
+    size_t frame_count = 0;
+    while (true) {
+        const size_t len = _port.read(&buf[0], _mtu);
+        if (len == 0) {
+            break;
+        }
+        _link_statistics.record_wire_bytes(MspLinkStatistics::RX, len);
+        const uint32_t time_microseconds = time_us();
+        frame_count += put_fragment(pg, &buf[0], len, time_microseconds);
+        byte_count += len;
+        if (is_input_budget_exhausted(byte_count, frame_count, time_microseconds - start_us)) {
+            break;
+        }
+    }
+    _link_statistics.update_rates(time_us());
+}
+
+MspSerialFragmented::slot_t* MspSerialFragmented::find_slot(uint8_t sequence)
+{
+    for (auto& slot : _slots) {
+        if (slot.in_use && slot.sequence == sequence) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+bool MspSerialFragmented::is_recently_completed(uint8_t sequence) const
+{
+    return std::find(_recently_completed.begin(), _recently_completed.end(), sequence) != _recently_completed.end();
+}
+
+/*!
+Adds a received fragment to its frame, and passes the frame to the MspStream once all its fragments have been received.
+*/
+size_t MspSerialFragmented::put_fragment(msp_context_t& pg, const uint8_t* fragment, size_t len, uint32_t time_microseconds)
+{
+    ++_fragment_statistics.fragments_received;
+    const size_t chunk_size = _mtu - HEADER_SIZE;
+    if (len <= HEADER_SIZE || len > _mtu) {
+        ++_fragment_statistics.fragments_invalid;
+        return 0;
+    }
+    const uint8_t sequence = fragment[0] & SEQUENCE_MASK;
+    const bool last = (fragment[0] & LAST_FRAGMENT) != 0;
+    const uint8_t index = fragment[1]; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    const size_t data_len = len - HEADER_SIZE;
+    const size_t offset = index * chunk_size;
+    if ((!last && data_len != chunk_size) || offset + data_len > FRAME_SIZE_MAX) {
+        ++_fragment_statistics.fragments_invalid;
+        return 0;
+    }
+
+    slot_t* slot = find_slot(sequence);
+    if (slot == nullptr) {
+        if (is_recently_completed(sequence)) {
+            ++_fragment_statistics.fragments_duplicate;
+            return 0;
+        }
+        // start a new frame, in a free slot or by evicting the oldest incomplete frame
+        slot = &_slots[0];
+        for (auto& s : _slots) {
+            if (!s.in_use) {
+                slot = &s;
+                break;
+            }
+            if (s.age - slot->age > UINT32_MAX / 2) { // s is older than slot, allowing for wraparound
+                slot = &s;
+            }
+        }
+        if (slot->in_use) {
+            ++_fragment_statistics.frames_lost;
+        }
+        slot->in_use = true;
+        slot->sequence = sequence;
+        slot->received = {};
+        slot->fragment_count = 0;
+        slot->last_index = FRAGMENT_COUNT_MAX;
+        slot->frame_len = 0;
+        slot->age = _slot_age++;
+    }
+
+    const uint32_t bit = 1U << (index % 32U);
+    uint32_t& word = slot->received[index / 32U];
+    if (word & bit) {
+        ++_fragment_statistics.fragments_duplicate;
+        return 0;
+    }
+    // once the last fragment is known, fragments past it, or claiming to be a different last fragment, cannot belong to the frame
+    if (index > slot->last_index || (last && slot->last_index != FRAGMENT_COUNT_MAX)) {
+        ++_fragment_statistics.fragments_invalid;
+        return 0;
+    }
+    word |= bit;
+    ++slot->fragment_count;
+    std::copy_n(fragment + HEADER_SIZE, data_len, &slot->buf[offset]); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    if (last) {
+        slot->last_index = index;
+        slot->frame_len = offset + data_len;
+        // drop any fragments already received past the last one, so they are not counted towards completing the frame
+        for (size_t ii = index + 1U; ii < FRAGMENT_COUNT_MAX; ++ii) {
+            uint32_t& received = slot->received[ii / 32U];
+            const uint32_t received_bit = 1U << (ii % 32U);
+            if (received & received_bit) {
+                received &= ~received_bit;
+                --slot->fragment_count;
+                ++_fragment_statistics.fragments_invalid;
+            }
+        }
+    }
+    if (slot->fragment_count != slot->last_index + 1U) {
+        return 0;
+    }
+
+    // frame is complete
+    slot->in_use = false;
+    _recently_completed[_recently_completed_index] = sequence;
+    _recently_completed_index = (_recently_completed_index + 1) % _recently_completed.size();
+    ++_fragment_statistics.frames_reassembled;
+    return _msp_stream.put_buf(pg, &slot->buf[0], slot->frame_len, time_microseconds);
+}
@@ -0,0 +1,113 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "msp_serial.h"
+#include "msp_stream.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+
+struct msp_fragment_statistics_t {
+    uint32_t fragments_sent;
+    uint32_t fragments_received;
+    uint32_t fragments_duplicate;   // fragments of a frame already reassembled, or already received
+    uint32_t fragments_invalid;     // fragments that are too short, or beyond the end of the reassembly buffer
+    uint32_t frames_reassembled;
+    uint32_t frames_lost;           // incomplete frames evicted by newer frames
+};
+
+/*!
+MspSerial for packet transports with a small MTU, for example MSP tunnelled over a radio or telemetry link.
+
+Each encoded frame is split into fragments of at most mtu bytes, each sent as a single write to the serial port.
+A fragment is a two byte header followed by the next mtu - 2 bytes of the frame:
+    byte 0: bits 0-6 frame sequence number, bit 7 set on the last fragment of the frame
+    byte 1: fragment index within the frame
+so a frame may be at most 256 fragments long.
+
+Incoming fragments are reassembled by their frame sequence number and index, so fragments may be reordered and duplicated.
+Up to REASSEMBLY_SLOT_COUNT frames may be in reassembly at once: when a fragment of a further frame arrives, the oldest incomplete
+frame is treated as lost. Only complete frames are passed to MspStream::put_buf(), so the parser never sees a partial frame.
+
+The serial port must preserve packet boundaries: each write() sends one packet, and each read() returns at most one packet.
+Alternatively received packets may be passed directly to put_fragment().
+*/
+class MspSerialFragmented : public MspSerial {
+public:
+    static constexpr size_t HEADER_SIZE = 2;
+    static constexpr uint8_t LAST_FRAGMENT = 0x80;
+    static constexpr uint8_t SEQUENCE_MASK = 0x7F;
+#if defined(MSP_SERIAL_FRAGMENTED_MTU_MAX)
+    static constexpr size_t MTU_MAX = MSP_SERIAL_FRAGMENTED_MTU_MAX;
+#else
+    static constexpr size_t MTU_MAX = 64;
+#endif
+    // large enough for any frame that MspStream can receive: the largest header, the payload and two checksum bytes
+    static constexpr size_t FRAME_SIZE_MAX = sizeof(msp_stream_packet_with_header_t::hdr_buf) + MspStream::MSP_STREAM_INBUF_SIZE + 2;
+    static constexpr size_t REASSEMBLY_SLOT_COUNT = 2;
+    static constexpr size_t FRAGMENT_COUNT_MAX = 256;
+public:
+    MspSerialFragmented(MspStream& msp_stream, MspSerialPortBase& msp_serial_port, size_t mtu);
+
+    size_t send_frame(const uint8_t* header, size_t header_len, const uint8_t* data, size_t data_len, const uint8_t* crc, size_t crc_len) override;
+    size_t send_frame_part(const uint8_t* data, size_t len) override;
+    void send_frame_end() override;
+    size_t available_for_write() const override;
+    void process_input(msp_context_t& pg) override;
+
+    // returns the number of frames completed by the fragment
+    size_t put_fragment(msp_context_t& pg, const uint8_t* fragment, size_t len, uint32_t time_microseconds);
+    size_t get_mtu() const { return _mtu; }
+    const msp_fragment_statistics_t& get_fragment_statistics() const { return _fragment_statistics; }
+private:
+    struct slot_t {
+        std::array<uint8_t, FRAME_SIZE_MAX> buf;
+        std::array<uint32_t, FRAGMENT_COUNT_MAX / 32> received;     // bitmap of the fragments received
+        size_t frame_len;           // known once the last fragment has been received
+        uint32_t age;               // order in which the slots were started, to find the oldest
+        uint16_t fragment_count;    // number of distinct fragments received
+        uint16_t last_index;        // index of the last fragment, FRAGMENT_COUNT_MAX if not yet received
+        uint8_t sequence;
+        bool in_use;
+    };
+    void append_tx(const uint8_t* data, size_t len);
+    void write_fragment(bool last);
+    slot_t* find_slot(uint8_t sequence);
+    bool is_recently_completed(uint8_t sequence) const;
+private:
+    MspSerialPortBase& _port;
+    const size_t _mtu;
+    // transmit: the fragment being built, it is only written once it is known whether it is the last fragment of the frame
+    std::array<uint8_t, MTU_MAX> _tx_fragment {};
+    size_t _tx_fragment_len { HEADER_SIZE };
+    uint8_t _tx_sequence {};
+    uint8_t _tx_index {};
+    bool _tx_overflow {};
+    // receive
+    std::array<slot_t, REASSEMBLY_SLOT_COUNT> _slots {};
+    uint32_t _slot_age {};
+    std::array<uint8_t, 4> _recently_completed { 0xFF, 0xFF, 0xFF, 0xFF };
+    size_t _recently_completed_index {};
+    msp_fragment_statistics_t _fragment_statistics {};
+};
@@ -55,8 +55,24 @@ so that the MSP library does not need to depend on an actual serial port.
 */
 class MspSerialPortBase {
 public:
-    virtual bool is_data_available() const;
-    virtual uint8_t read_byte();
-    virtual size_t available_for_write() const;
-    virtual size_t write(const uint8_t* buf, size_t len);
+    virtual ~MspSerialPortBase() = default;
+    virtual bool is_data_available() const = 0;
+    virtual uint8_t read_byte() = 0;
+    virtual size_t available_for_write() const = 0;
+    virtual size_t write(const uint8_t* buf, size_t len) = 0;
+    // reads up to len bytes, override if the port can do better than reading a byte at a time
+    virtual size_t read(uint8_t* buf, size_t len) {
+        size_t count = 0;
+        while (count < len && is_data_available()) {
+            buf[count++] = read_byte(); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        }
+        return count;
+    }
+    // optional: blocks until at least len bytes can be written, typically on a notification from the UART transmit interrupt, see MspTxNotification
+    // returns false if this is not supported, or if the timeout expired first
+    virtual bool wait_for_write_space(size_t len, uint32_t timeout_us) {
+        (void)len;
+        (void)timeout_us;
+        return false;
+    }
 };
@@ -0,0 +1,61 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "msp_serial.h"
+#include "msp_stream.h"
+
+#include <concepts>
+
+
+/*!
+Requirements for a serial port used by MspSerialStatic. These are the functions of MspSerialPortBase, but the port need not derive from it.
+*/
+template <typename T>
+concept msp_serial_port_c = requires(T& port, const T& const_port, const uint8_t* data, size_t len) {
+    { const_port.is_data_available() } -> std::convertible_to<bool>;
+    { port.read_byte() } -> std::convertible_to<uint8_t>;
+    { const_port.available_for_write() } -> std::convertible_to<size_t>;
+    { port.write(data, len) } -> std::convertible_to<size_t>;
+};
+
+/*!
+MspSerial for a serial port whose type is known at compile time.
+
+The port functions are called directly rather than through MspSerialPortBase, so they can be inlined into the input and output loops.
+The port may be a class that does not derive from MspSerialPortBase, or a final class that does.
+If the port has a read(buf, len) function, that is used in preference to reading a byte at a time.
+*/
+template <msp_serial_port_c PORT>
+class MspSerialStatic : public MspSerial {
+public:
+    MspSerialStatic(MspStream& msp_stream, PORT& port) : MspSerial(msp_stream), _port(port) {}
+
+    size_t send_frame(const uint8_t* header, size_t header_len, const uint8_t* data, size_t data_len, const uint8_t* crc, size_t crc_len) final {
+        return send_frame_to(_port, header, header_len, data, data_len, crc, crc_len);
+    }
+    size_t send_frame_part(const uint8_t* data, size_t len) final { return send_frame_part_to(_port, data, len); }
+    size_t available_for_write() const final { return _port.available_for_write(); }
+    void process_input(msp_context_t& pg) final { process_input_from(pg, _port); }
+    void flush_tx() final { flush_tx_to(_port); }
+private:
+    PORT& _port;
+};
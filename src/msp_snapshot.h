@@ -0,0 +1,125 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+
+/*!
+Lock-free snapshot channel, for passing state from a higher priority task (eg the flight loop) to MSP handlers.
+
+The writer (a single task) calls publish() at its own rate and never blocks. Readers call read() or try_read(), which never block the writer
+and always return a consistent (untorn) snapshot.
+
+This is a double buffered seqlock: the writer alternates between two buffers, so a reader copying the most recently published value
+is only disturbed if the writer publishes twice during the copy. try_read() makes a single attempt, and so is wait-free.
+read() retries until it succeeds, which in practice is almost always at the first attempt.
+
+The value is held as an array of atomic words, so there is no data race (in the C++ memory model sense) when a read overlaps a publish.
+T must be trivially copyable.
+*/
+template <typename T>
+class MspSnapshot {
+public:
+    static_assert(std::is_trivially_copyable_v<T>, "MspSnapshot type must be trivially copyable");
+    static constexpr size_t WORD_COUNT = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+public:
+    MspSnapshot() = default;
+    explicit MspSnapshot(const T& value) { publish(value); }
+    // snapshot is not copyable or moveable
+    MspSnapshot(const MspSnapshot&) = delete;
+    MspSnapshot& operator=(const MspSnapshot&) = delete;
+    MspSnapshot(MspSnapshot&&) = delete;
+    MspSnapshot& operator=(MspSnapshot&&) = delete;
+public:
+    /*!
+    Publishes a new value. Must only be called from one task.
+    _sequence is odd while a publication is in progress, and (_sequence / 2) is the number of completed publications.
+    Publication n is written to buffer n % 2.
+    */
+    void publish(const T& value) {
+        std::array<uint32_t, WORD_COUNT> words {};
+        std::memcpy(&words[0], &value, sizeof(T));
+        const uint32_t sequence = begin_publish();
+        write_words(sequence, words);
+        end_publish(sequence);
+    }
+    /*!
+    Makes a single attempt to read the most recently published value, returns false if the attempt was disturbed by the writer.
+    */
+    bool try_read(T& value) const {
+        const uint32_t sequence = begin_read();
+        std::array<uint32_t, WORD_COUNT> words {};
+        read_words(sequence, words, 0, WORD_COUNT);
+        if (!end_read(sequence)) {
+            return false;
+        }
+        std::memcpy(&value, &words[0], sizeof(T));
+        return true;
+    }
+    T read() const {
+        T value; // NOLINT(cppcoreguidelines-pro-type-member-init,hicpp-member-init)
+        while (!try_read(value)) {}
+        return value;
+    }
+    // number of values published, can be used by readers to detect new data
+    uint32_t get_publication_count() const { return _sequence.load(std::memory_order_acquire) >> 1U; }
+public: // the steps of publish() and try_read(), public so that tests can interleave them deterministically
+    uint32_t begin_publish() {
+        const uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+        _sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return sequence;
+    }
+    void write_words(uint32_t sequence, const std::array<uint32_t, WORD_COUNT>& words) {
+        auto& buffer = _buffers[((sequence >> 1U) + 1) & 1U];
+        for (size_t ii = 0; ii < WORD_COUNT; ++ii) {
+            buffer[ii].store(words[ii], std::memory_order_relaxed);
+        }
+    }
+    void end_publish(uint32_t sequence) { _sequence.store(sequence + 2, std::memory_order_release); }
+    uint32_t begin_read() const { return _sequence.load(std::memory_order_acquire); }
+    // reads words [begin, end) of the most recently completed publication at sequence
+    void read_words(uint32_t sequence, std::array<uint32_t, WORD_COUNT>& words, size_t begin, size_t end) const {
+        const auto& buffer = _buffers[(sequence >> 1U) & 1U];
+        for (size_t ii = begin; ii < end; ++ii) {
+            words[ii] = buffer[ii].load(std::memory_order_relaxed);
+        }
+    }
+    /*!
+    Returns true if the words read since begin_read() are untorn.
+    The buffer that was read is not rewritten until the writer starts the publication after the next one.
+    If the sequence was odd, a publication was already in progress, so that publication after next starts at (sequence & ~1) + 3,
+    not at sequence + 3.
+    */
+    bool end_read(uint32_t sequence) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return _sequence.load(std::memory_order_relaxed) - (sequence & ~1U) <= 2;
+    }
+private:
+    std::atomic<uint32_t> _sequence {};
+    std::array<std::array<std::atomic<uint32_t>, WORD_COUNT>, 2> _buffers {};
+};
@@ -44,9 +44,24 @@
  * If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "msp_compressor.h"
+#include "msp_frame_queue.h"
+#include "msp_protocol.h"
+#include "msp_reliable_window.h"
 #include "msp_serial.h"
 #include "msp_stream.h"
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <utility>
+
+#include <time_microseconds.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 
 MspStream::MspStream(MspBase& msp_base) :
@@ -54,7 +69,47 @@ MspStream::MspStream(MspBase& msp_base) :
 {
 }
 
-uint8_t MspStream::checksum_xor(uint8_t checksum, const uint8_t* data, size_t len)
+namespace {
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+constexpr std::array<uint8_t, 256> crc8_table(uint8_t poly)
+{
+    std::array<uint8_t, 256> table {};
+    for (size_t ii = 0; ii < table.size(); ++ii) {
+        auto crc = static_cast<uint8_t>(ii);
+        for (int jj = 0; jj < 8; ++jj) {
+            crc = (crc & 0x80U) ? static_cast<uint8_t>((crc << 1U) ^ poly) : static_cast<uint8_t>(crc << 1U);
+        }
+        table[ii] = crc;
+    }
+    return table;
+}
+constexpr std::array<uint8_t, 256> CRC8_DVB_S2_TABLE = crc8_table(0xD5);
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+constexpr size_t CHECKSUM_ALIGNMENT = 16;
+#else
+constexpr size_t CHECKSUM_ALIGNMENT = sizeof(uint32_t);
+#endif
+// below this length the alignment and folding overhead outweighs the word-at-a-time gain
+constexpr size_t CHECKSUM_XOR_WORD_THRESHOLD = 16;
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+inline uint32_t load_u32_aligned(const uint8_t* data)
+{
+    uint32_t word {};
+#if defined(__GNUC__)
+    std::memcpy(&word, __builtin_assume_aligned(data, sizeof(uint32_t)), sizeof(uint32_t));
+#else
+    std::memcpy(&word, data, sizeof(uint32_t));
+#endif
+    return word;
+}
+} // anonymous namespace
+
+/*!
+Reference implementation of the MSP V1 XOR checksum, folds one byte per iteration.
+*/
+uint8_t MspStream::checksum_xor_bytewise(uint8_t checksum, const uint8_t* data, size_t len)
 {
     while (len-- > 0) {
         checksum ^= *data++; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
@@ -62,6 +117,63 @@ uint8_t MspStream::checksum_xor(uint8_t checksum, const uint8_t* data, size_t le
     return checksum;
 }
 
+/*!
+MSP V1 XOR checksum.
+
+Leading bytes are folded individually until data is aligned, the bulk is then folded a SIMD vector (SSE2/NEON) or
+a 32-bit word (Cortex-M) at a time, and the accumulator is reduced to a single byte.
+Since XOR is associative and commutative the result is identical to checksum_xor_bytewise().
+*/
+uint8_t MspStream::checksum_xor(uint8_t checksum, const uint8_t* data, size_t len) // NOLINT(readability-function-cognitive-complexity)
+{
+// NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic,cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    if (len < CHECKSUM_XOR_WORD_THRESHOLD) {
+        return checksum_xor_bytewise(checksum, data, len);
+    }
+    while ((reinterpret_cast<uintptr_t>(data) & (CHECKSUM_ALIGNMENT - 1)) != 0) {
+        checksum ^= *data++;
+        --len;
+    }
+
+    uint32_t acc = 0;
+#if defined(__SSE2__)
+    if (len >= 16) {
+        __m128i acc128 = _mm_setzero_si128();
+        while (len >= 16) {
+            acc128 = _mm_xor_si128(acc128, _mm_load_si128(reinterpret_cast<const __m128i*>(data)));
+            data += 16;
+            len -= 16;
+        }
+        acc128 = _mm_xor_si128(acc128, _mm_srli_si128(acc128, 8));
+        acc128 = _mm_xor_si128(acc128, _mm_srli_si128(acc128, 4));
+        acc = static_cast<uint32_t>(_mm_cvtsi128_si32(acc128));
+    }
+#elif defined(__ARM_NEON)
+    if (len >= 16) {
+        uint8x16_t acc128 = vdupq_n_u8(0);
+        while (len >= 16) {
+            acc128 = veorq_u8(acc128, vld1q_u8(data));
+            data += 16;
+            len -= 16;
+        }
+        const uint8x8_t acc64 = veor_u8(vget_low_u8(acc128), vget_high_u8(acc128));
+        const uint32x2_t acc32 = vreinterpret_u32_u8(acc64);
+        acc = vget_lane_u32(acc32, 0) ^ vget_lane_u32(acc32, 1);
+    }
+#endif
+    while (len >= sizeof(uint32_t)) {
+        acc ^= load_u32_aligned(data);
+        data += sizeof(uint32_t);
+        len -= sizeof(uint32_t);
+    }
+    acc ^= acc >> 16U;
+    acc ^= acc >> 8U;
+    checksum ^= static_cast<uint8_t>(acc);
+
+    return checksum_xor_bytewise(checksum, data, len);
+// NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic,cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+}
+
 uint8_t MspStream::crc8_calc(uint8_t crc, unsigned char a, uint8_t poly)
 {
 // NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
@@ -88,6 +200,160 @@ uint8_t MspStream::crc8_update(uint8_t crc, const void *data, uint32_t length, u
     return crc;
 }
 
+/*!
+Table driven CRC8 using the DVB-S2 polynomial (0xD5), as used by MSP V2.
+*/
+uint8_t MspStream::crc8_dvb_s2(uint8_t crc, unsigned char a)
+{
+    return CRC8_DVB_S2_TABLE[crc ^ a]; // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+}
+
+uint8_t MspStream::crc8_dvb_s2_update(uint8_t crc, const void *data, uint32_t length)
+{
+    const auto* p = static_cast<const uint8_t*>(data);
+    const uint8_t* pend = p + length; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+    for (; p != pend; p++) { // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        crc = CRC8_DVB_S2_TABLE[crc ^ *p]; // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+    }
+    return crc;
+}
+
+/*!
+Single pass over the data updating both the MSP V1 XOR checksum and the MSP V2 CRC8, as required for MSP V2 over V1 frames.
+*/
+void MspStream::checksum_xor_crc8_dvb_s2_update(uint8_t& checksum, uint8_t& crc, const void *data, uint32_t length)
+{
+    const auto* p = static_cast<const uint8_t*>(data);
+    const uint8_t* pend = p + length; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+    uint8_t xor_checksum = checksum;
+    uint8_t crc8 = crc;
+    for (; p != pend; p++) { // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        xor_checksum ^= *p;
+        crc8 = CRC8_DVB_S2_TABLE[crc8 ^ *p]; // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+    }
+    checksum = xor_checksum;
+    crc = crc8;
+}
+
+/*!
+Returns the index of the first possible frame start character ('M' for MSPv1 and MSPv2 over MSPv1, 'X' for MSPv2 native),
+or len if there is none.
+
+Used to skip over noise between frames without running every byte through the state machine.
+*/
+size_t MspStream::find_frame_start(const uint8_t* data, size_t len)
+{
+// NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic,cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    size_t ii = 0;
+#if defined(__SSE2__)
+    const __m128i m16 = _mm_set1_epi8('M');
+    const __m128i x16 = _mm_set1_epi8('X');
+    for (; ii + 16 <= len; ii += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + ii));
+        const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, m16), _mm_cmpeq_epi8(v, x16))));
+        if (mask != 0) {
+            return ii + static_cast<size_t>(__builtin_ctz(mask));
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t m16 = vdupq_n_u8('M');
+    const uint8x16_t x16 = vdupq_n_u8('X');
+    for (; ii + 16 <= len; ii += 16) {
+        const uint8x16_t v = vld1q_u8(data + ii);
+        if (vmaxvq_u8(vorrq_u8(vceqq_u8(v, m16), vceqq_u8(v, x16))) != 0) {
+            break; // located by the bytewise loop below
+        }
+    }
+#endif
+    // SWAR: a word contains byte b if (w ^ b*0x01010101) has a zero byte
+    constexpr uint32_t ONES = 0x01010101U;
+    constexpr uint32_t HIGHS = 0x80808080U;
+    for (; ii + sizeof(uint32_t) <= len; ii += sizeof(uint32_t)) {
+        uint32_t w {};
+        std::memcpy(&w, data + ii, sizeof(uint32_t));
+        const uint32_t wm = w ^ (ONES * 'M');
+        const uint32_t wx = w ^ (ONES * 'X');
+        if ((((wm - ONES) & ~wm) | ((wx - ONES) & ~wx)) & HIGHS) {
+            break;
+        }
+    }
+    for (; ii < len; ++ii) {
+        if (data[ii] == 'M' || data[ii] == 'X') {
+            return ii;
+        }
+    }
+    return len;
+// NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic,cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+}
+
+/*!
+Abandons the packet currently being received.
+
+The bytes of the abandoned packet that are held in _in_buf (and the character that caused the abort, if it is not in _in_buf)
+are rescanned by resynchronize(), so that a real frame that started inside a false or corrupted one is not lost.
+*/
+void MspStream::abort_packet(uint8_t c, bool c_in_buf)
+{
+    _packet_state = MSP_IDLE;
+    abort_payload_sink();
+    if (!_resynchronizing) {
+        _resync_len = _offset;
+        _resync_char = c;
+        _resync_char_pending = !c_in_buf;
+    }
+}
+
+/*!
+Starts skipping a packet that is too large to fit in _in_buf.
+The remaining len bytes (payload and checksum) are counted off without being buffered or checksummed.
+
+A packet that claims to be larger than the discard size limit is aborted instead: on a noisy link a false start
+with a large random length would otherwise cause many valid frames to be skipped.
+*/
+void MspStream::discard_packet(uint8_t c, uint32_t len)
+{
+    if (len > _discard_size_limit + 1U) {
+        abort_packet(c, true);
+        return;
+    }
+    _discard_remaining = len;
+    _packet_state = MSP_PAYLOAD_DISCARD;
+}
+
+/*!
+Called when the header of a packet has been received, to determine how its payload is to be handled.
+
+The payload of a command is streamed to a payload sink, if the command has one, otherwise it is assembled in _in_buf.
+Returns false if the payload is too large for _in_buf and there is no payload sink.
+*/
+bool MspStream::accept_payload(uint16_t cmd, uint16_t size)
+{
+    _payload_flushed = 0;
+    // payload sinks are not used with a frame queue, since they would be committed by the parser rather than the command executor
+    _payload_sink = (_packet_type == MSP_PACKET_COMMAND && !_frame_queue) ? _msp_base.get_payload_sink(static_cast<int16_t>(cmd), size) : nullptr;
+    return _payload_sink != nullptr || size <= MSP_STREAM_INBUF_SIZE;
+}
+
+/*!
+Writes the payload received so far to the payload sink, so that _in_buf can be reused.
+*/
+void MspStream::flush_payload()
+{
+    _payload_sink->write(&_in_buf[0], _offset);
+    _payload_flushed += _offset;
+    _offset = 0;
+}
+
+void MspStream::abort_payload_sink()
+{
+    if (_payload_sink) {
+        _payload_sink->abort();
+        _payload_sink = nullptr;
+    }
+}
+
 /*!
 State machine to build up MSP packet from individual incoming characters.
 */
@@ -99,25 +365,26 @@ void MspStream::process_received_packet_data(uint8_t c) // NOLINT(readability-fu
     case MSP_IDLE:
         [[fallthrough]];
     case MSP_HEADER_START:  // Waiting for 'M' (MSPv1 or MSPv2 over MSPv1) or 'X' (MSPv2 native)
+        abort_payload_sink(); // in case the packet state was reset externally while a payload was being streamed
         _offset = 0;
         _checksum1 = 0;
         _checksum2 = 0;
-        switch (c) {
-        case 'M':
+        if (V1_FRAMING_SUPPORTED && c == 'M') {
             _packet_state = MSP_HEADER_M;
             _msp_version = MSP_V1;
-            break;
-        case 'X':
+        } else if (V2_NATIVE_SUPPORTED && c == 'X') {
             _packet_state = MSP_HEADER_X;
             _msp_version = MSP_V2_NATIVE;
-            break;
-        default:
+        } else {
             _packet_state = MSP_IDLE;
-            break;
         }
         break;
 
     case MSP_HEADER_M:      // Waiting for '<' or '>'
+        if constexpr (!V1_FRAMING_SUPPORTED) {
+            _packet_state = MSP_IDLE;
+            break;
+        }
         _packet_state = MSP_HEADER_V1;
         switch (c) {
         case '<':
@@ -127,12 +394,16 @@ void MspStream::process_received_packet_data(uint8_t c) // NOLINT(readability-fu
             _packet_type = MSP_PACKET_REPLY;
             break;
         default:
-            _packet_state = MSP_IDLE;
+            abort_packet(c, false);
             break;
         }
         break;
 
     case MSP_HEADER_X:
+        if constexpr (!V2_NATIVE_SUPPORTED) {
+            _packet_state = MSP_IDLE;
+            break;
+        }
         _packet_state = MSP_HEADER_V2_NATIVE;
         switch (c) {
         case '<':
@@ -142,118 +413,174 @@ void MspStream::process_received_packet_data(uint8_t c) // NOLINT(readability-fu
             _packet_type = MSP_PACKET_REPLY;
             break;
         default:
-            _packet_state = MSP_IDLE;
+            abort_packet(c, false);
             break;
         }
         break;
 
     case MSP_HEADER_V1:     // Now receive v1 header (size/cmd), this is already checksummable
+        if constexpr (!V1_FRAMING_SUPPORTED) {
+            _packet_state = MSP_IDLE;
+            break;
+        }
         _in_buf[_offset++] = c;
         _checksum1 ^= c;
         if (_offset == sizeof(msp_stream_header_v1_t)) {
             const auto* hdr = reinterpret_cast<msp_stream_header_v1_t*>(&_in_buf[0]); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-init-variables)
-            // Check incoming buffer size limit
-            if (hdr->size > MSP_STREAM_INBUF_SIZE) {
-                _packet_state = MSP_IDLE;
-            }
-            else if (hdr->cmd == MspBase::V2_FRAME_ID) {
+            if (hdr->cmd == MspBase::V2_FRAME_ID) {
                 // MSPv1 payload must be big enough to hold V2 header + extra checksum
-                if (hdr->size >= sizeof(msp_stream_header_v2_t) + 1) {
+                // the size of the V2 payload is checked when the V2 header has been received
+                if (V2_OVER_V1_SUPPORTED && hdr->size >= sizeof(msp_stream_header_v2_t) + 1) {
                     _msp_version = MSP_V2_OVER_V1;
                     _packet_state = MSP_HEADER_V2_OVER_V1;
                 } else {
-                    _packet_state = MSP_IDLE;
+                    abort_packet(c, true);
                 }
-            } else {
+            } else if (!is_version_supported(MSP_V1)) {
+                abort_packet(c, true);
+            } else if (accept_payload(hdr->cmd, hdr->size)) {
                 _data_size = hdr->size;
                 _cmd_msp = hdr->cmd;
                 _cmd_flags = 0;
                 _offset = 0;                // re-use buffer
                 _packet_state = _data_size > 0 ? MSP_PAYLOAD_V1 : MSP_CHECKSUM_V1;    // If no payload - jump to checksum byte
+            } else {
+                // Incoming buffer size limit exceeded
+                discard_packet(c, hdr->size + 1U); // payload + checksum
             }
         }
         break;
 
     case MSP_PAYLOAD_V1:
+        if constexpr (!V1_FRAMING_SUPPORTED) {
+            _packet_state = MSP_IDLE;
+            break;
+        }
         _in_buf[_offset++] = c;
         _checksum1 ^= c;
-        if (_offset == _data_size) {
+        if (_payload_flushed + _offset == _data_size) {
             _packet_state = MSP_CHECKSUM_V1;
+        } else if (_offset == _in_buf.size()) {
+            flush_payload(); // can only happen if there is a payload sink
         }
         break;
 
     case MSP_CHECKSUM_V1:
+        if constexpr (!V1_FRAMING_SUPPORTED) {
+            _packet_state = MSP_IDLE;
+            break;
+        }
         if (_checksum1 == c) {
             _packet_state = MSP_COMMAND_RECEIVED;
         } else {
-            _packet_state = MSP_IDLE;
+            abort_packet(c, false);
         }
         break;
 
     case MSP_HEADER_V2_OVER_V1:     // V2 header is part of V1 payload - we need to calculate both checksums now
+        if constexpr (!V2_OVER_V1_SUPPORTED) {
+            _packet_state = MSP_IDLE;
+            break;
+        }
         _in_buf[_offset++] = c;
         _checksum1 ^= c;
         _checksum2 = crc8_dvb_s2(_checksum2, c);
         if (_offset == (sizeof(msp_stream_header_v2_t) + sizeof(msp_stream_header_v1_t))) {
             const msp_stream_header_v2_t* hdrv2 = reinterpret_cast<msp_stream_header_v2_t*>(&_in_buf[sizeof(msp_stream_header_v1_t)]); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-init-variables)
-            if (hdrv2->size > MSP_STREAM_INBUF_SIZE) {
-                _packet_state = MSP_IDLE;
-            } else {
+            if (accept_payload(hdrv2->cmd, hdrv2->size)) {
                 _data_size = hdrv2->size;
                 _cmd_msp = hdrv2->cmd;
                 _cmd_flags = hdrv2->flags;
                 _offset = 0;                // re-use buffer
                 _packet_state = _data_size > 0 ? MSP_PAYLOAD_V2_OVER_V1 : MSP_CHECKSUM_V2_OVER_V1;
+            } else {
+                discard_packet(c, hdrv2->size + 2U); // payload + V2 checksum + V1 checksum
             }
         }
         break;
 
     case MSP_PAYLOAD_V2_OVER_V1:
+        if constexpr (!V2_OVER_V1_SUPPORTED) {
+            _packet_state = MSP_IDLE;
+            break;
+        }
         _checksum2 = crc8_dvb_s2(_checksum2, c);
         _checksum1 ^= c;
         _in_buf[_offset++] = c;
 
-        if (_offset == _data_size) {
+        if (_payload_flushed + _offset == _data_size) {
             _packet_state = MSP_CHECKSUM_V2_OVER_V1;
+        } else if (_offset == _in_buf.size()) {
+            flush_payload();
         }
         break;
 
     case MSP_CHECKSUM_V2_OVER_V1:
+        if constexpr (!V2_OVER_V1_SUPPORTED) {
+            _packet_state = MSP_IDLE;
+            break;
+        }
         _checksum1 ^= c;
         if (_checksum2 == c) {
             _packet_state = MSP_CHECKSUM_V1; // Checksum 2 correct - verify v1 checksum
         } else {
-            _packet_state = MSP_IDLE;
+            abort_packet(c, false);
         }
         break;
 
     case MSP_HEADER_V2_NATIVE:
+        if constexpr (!V2_NATIVE_SUPPORTED) {
+            _packet_state = MSP_IDLE;
+            break;
+        }
         _in_buf[_offset++] = c;
         _checksum2 = crc8_dvb_s2(_checksum2, c);
         if (_offset == sizeof(msp_stream_header_v2_t)) {
             const msp_stream_header_v2_t* hdrv2 = reinterpret_cast<msp_stream_header_v2_t*>(&_in_buf[0]); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-init-variables)
-            _data_size = hdrv2->size;
-            _cmd_msp = hdrv2->cmd;
-            _cmd_flags = hdrv2->flags;
-            _offset = 0;                // re-use buffer
-            _packet_state = _data_size > 0 ? MSP_PAYLOAD_V2_NATIVE : MSP_CHECKSUM_V2_NATIVE;
+            if (accept_payload(hdrv2->cmd, hdrv2->size)) {
+                _data_size = hdrv2->size;
+                _cmd_msp = hdrv2->cmd;
+                _cmd_flags = hdrv2->flags;
+                _offset = 0;                // re-use buffer
+                _packet_state = _data_size > 0 ? MSP_PAYLOAD_V2_NATIVE : MSP_CHECKSUM_V2_NATIVE;
+            } else {
+                // Incoming buffer size limit exceeded
+                discard_packet(c, hdrv2->size + 1U); // payload + checksum
+            }
         }
         break;
 
     case MSP_PAYLOAD_V2_NATIVE:
+        if constexpr (!V2_NATIVE_SUPPORTED) {
+            _packet_state = MSP_IDLE;
+            break;
+        }
         _checksum2 = crc8_dvb_s2(_checksum2, c);
         _in_buf[_offset++] = c;
 
-        if (_offset == _data_size) {
+        if (_payload_flushed + _offset == _data_size) {
             _packet_state = MSP_CHECKSUM_V2_NATIVE;
+        } else if (_offset == _in_buf.size()) {
+            flush_payload();
         }
         break;
 
     case MSP_CHECKSUM_V2_NATIVE:
+        if constexpr (!V2_NATIVE_SUPPORTED) {
+            _packet_state = MSP_IDLE;
+            break;
+        }
         if (_checksum2 == c) {
             _packet_state = MSP_COMMAND_RECEIVED;
         } else {
+            abort_packet(c, false);
+        }
+        break;
+
+    case MSP_PAYLOAD_DISCARD:
+        if (--_discard_remaining == 0) {
             _packet_state = MSP_IDLE;
+            ++_discarded_frame_count;
         }
         break;
     }
@@ -310,18 +637,106 @@ checksum - XOR of the size, type, and payload bytes.
 The checksum of a request (ie a message with no payload) equals the type.
 */
 msp_stream_packet_with_header_t MspStream::serial_encode(const msp_const_packet_t& packet, msp_version_e msp_version)
+{
+    msp_version = encoded_version(msp_version);
+    msp_stream_packet_with_header_t ret = encode_header(packet.cmd, packet.result, packet.flags, packet.payload.bytes_remaining(), msp_version);
+    ret.data_ptr = packet.payload.ptr();
+
+    update_checksums(ret, msp_version, ret.data_ptr, ret.data_len);
+    encode_checksums(ret, msp_version);
+
+    // Send the frame
+    if (_msp_serial) {
+        _msp_serial->get_link_statistics().record_frame(MspLinkStatistics::TX, msp_version, ret.data_len, ret.hdr_len + ret.crc_len);
+        _msp_serial->send_frame(&ret.hdr_buf[0], ret.hdr_len, ret.data_ptr, ret.data_len, &ret.crc_buf[0], ret.crc_len);
+    }
+    return ret;
+}
+
+/*!
+Returns the number of bytes of framing (header and checksums) of a frame with a payload of payload_len bytes.
+*/
+size_t MspStream::get_framing_overhead(msp_version_e msp_version, size_t payload_len)
+{
+    enum { V1_OVERHEAD = 6, V2_OVER_V1_OVERHEAD = 12, V2_NATIVE_OVERHEAD = 9, JUMBO_OVERHEAD = 2 };
+
+    switch (msp_version) {
+    case MSP_V1:
+        return payload_len >= JUMBO_FRAME_SIZE_LIMIT ? V1_OVERHEAD + JUMBO_OVERHEAD : V1_OVERHEAD;
+    case MSP_V2_OVER_V1:
+        return payload_len + sizeof(msp_stream_header_v2_t) + 1 >= JUMBO_FRAME_SIZE_LIMIT ? V2_OVER_V1_OVERHEAD + JUMBO_OVERHEAD : V2_OVER_V1_OVERHEAD;
+    default:
+        return V2_NATIVE_OVERHEAD;
+    }
+}
+
+/*!
+Selects the MSP version of a reply to (or push following) a command received in msp_version.
+
+With MSP_REPLY_FRAMING_CHEAPEST the reply uses the framing with the least overhead of those the client accepts:
+ * MSP V1 framing is taken to be accepted by a client that has sent '$M' frames, for commands that fit in V1 (command < 256, no flags),
+   and, for payloads of 255 bytes or more, only if the client accepts jumbo frames (or the command was itself V1).
+ * MSP V2 native framing is accepted by a client that has sent a V2 native frame.
+So, for example, a client that sends V2 over V1 commands gets V1 replies (6 bytes of overhead rather than 12) for commands below 256.
+*/
+msp_version_e MspStream::select_reply_version(msp_version_e msp_version, int16_t cmd, uint8_t flags, size_t payload_len) const
+{
+    if (_reply_framing == MSP_REPLY_FRAMING_SAME) {
+        return msp_version;
+    }
+    const uint8_t client_capabilities = get_client_capabilities();
+    msp_version_e ret = msp_version;
+    size_t overhead = get_framing_overhead(msp_version, payload_len);
+
+    const bool v1_accepted = (client_capabilities & (CLIENT_CAPABILITY_V1 | CLIENT_CAPABILITY_V2_OVER_V1))
+        && cmd >= 0 && cmd <= UINT8_MAX && flags == 0
+        && (payload_len < JUMBO_FRAME_SIZE_LIMIT || (client_capabilities & CLIENT_CAPABILITY_JUMBO) || msp_version == MSP_V1);
+    if (is_version_supported(MSP_V1) && v1_accepted && get_framing_overhead(MSP_V1, payload_len) < overhead) {
+        ret = MSP_V1;
+        overhead = get_framing_overhead(MSP_V1, payload_len);
+    }
+    if (V2_NATIVE_SUPPORTED && (client_capabilities & CLIENT_CAPABILITY_V2_NATIVE) && get_framing_overhead(MSP_V2_NATIVE, payload_len) < overhead) {
+        ret = MSP_V2_NATIVE;
+    }
+    return ret;
+}
+
+/*!
+If only one MSP version is supported, returns that version, so that the branches on msp_version in the encoding functions are resolved at compile time.
+*/
+constexpr msp_version_e MspStream::encoded_version(msp_version_e msp_version)
+{
+    if constexpr (SUPPORTED_VERSIONS == MSP_VERSION_MASK_V1) {
+        return MSP_V1;
+    } else if constexpr (SUPPORTED_VERSIONS == MSP_VERSION_MASK_V2_OVER_V1) {
+        return MSP_V2_OVER_V1;
+    } else if constexpr (SUPPORTED_VERSIONS == MSP_VERSION_MASK_V2_NATIVE) {
+        return MSP_V2_NATIVE;
+    } else {
+        return msp_version;
+    }
+}
+
+/*!
+Fills in the header of a stream packet and calculates the header part of its checksums.
+
+For MSP V1 and MSP V2 over V1, ret.checksum holds the running XOR checksum and ret.crc_buf[0] holds the running MSP V2 CRC.
+For MSP V2 native, ret.checksum holds the running CRC.
+*/
+msp_stream_packet_with_header_t MspStream::encode_header(int16_t cmd, int16_t result, uint8_t flags, size_t data_len, msp_version_e msp_version)
 {
     static constexpr std::array<uint8_t, MSP_VERSION_COUNT> mspMagic = { 'M', 'M', 'X' };
+    msp_version = encoded_version(msp_version);
 
     msp_stream_packet_with_header_t ret {
         .hdr_buf = {
             '$',
             mspMagic[msp_version],
-            packet.result == MSP_RESULT_ERROR ? static_cast<uint8_t>('!') : static_cast<uint8_t>('>')
+            result == MSP_RESULT_ERROR ? static_cast<uint8_t>('!') : static_cast<uint8_t>('>')
         },
         .crc_buf = { 0, 0 },
-        .data_ptr = packet.payload.ptr(),
-        .data_len = static_cast<uint16_t>(packet.payload.bytes_remaining()),
+        .data_ptr = nullptr,
+        .data_len = static_cast<uint16_t>(data_len),
 
         .hdr_len = MSP_HEADER_LENGTH,
         .crc_len = 0,
@@ -333,7 +748,7 @@ msp_stream_packet_with_header_t MspStream::serial_encode(const msp_const_packet_
     if (msp_version == MSP_V1) {
         auto hdr_v1 = reinterpret_cast<msp_stream_header_v1_t*>(&ret.hdr_buf[ret.hdr_len]); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
         ret.hdr_len += sizeof(msp_stream_header_v1_t);
-        hdr_v1->cmd = static_cast<uint8_t>(packet.cmd);
+        hdr_v1->cmd = static_cast<uint8_t>(cmd);
 
         // Add JUMBO-frame header if necessary
         if (ret.data_len >= JUMBO_FRAME_SIZE_LIMIT) {
@@ -341,15 +756,13 @@ msp_stream_packet_with_header_t MspStream::serial_encode(const msp_const_packet_
             ret.hdr_len += sizeof(msp_stream_header_jumbo_t);
 
             hdr_v1->size = JUMBO_FRAME_SIZE_LIMIT;
-            hdrJUMBO->size = static_cast<uint8_t>(ret.data_len);
+            hdrJUMBO->size = ret.data_len;
         } else {
             hdr_v1->size = static_cast<uint8_t>(ret.data_len);
         }
 
         // Pre-calculate CRC
         ret.checksum = checksum_xor(0, &ret.hdr_buf[V1_CHECKSUM_STARTPOS], ret.hdr_len - V1_CHECKSUM_STARTPOS); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-        ret.checksum = checksum_xor(ret.checksum, packet.payload.ptr(), ret.data_len);
-        ret.crc_buf[ret.crc_len++] = ret.checksum;
     } else if (msp_version == MSP_V2_OVER_V1) {
         auto hdr_v1 = reinterpret_cast<msp_stream_header_v1_t*>(&ret.hdr_buf[ret.hdr_len]); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
 
@@ -373,39 +786,101 @@ msp_stream_packet_with_header_t MspStream::serial_encode(const msp_const_packet_
         }
 
         // Fill V2 header
-        hdr_v2->flags = packet.flags;
-        hdr_v2->cmd = static_cast<uint16_t>(packet.cmd);
+        hdr_v2->flags = flags;
+        hdr_v2->cmd = static_cast<uint16_t>(cmd);
         hdr_v2->size = ret.data_len;
 
         // V2 CRC: only V2 header + data payload
-        ret.checksum = crc8_dvb_s2_update(0, reinterpret_cast<uint8_t*>(hdr_v2), sizeof(msp_stream_header_v2_t)); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
-        ret.checksum = crc8_dvb_s2_update(ret.checksum, packet.payload.ptr(), ret.data_len);
-        ret.crc_buf[ret.crc_len++] = ret.checksum;
-
         // V1 CRC: All headers + data payload + V2 CRC byte
+        ret.crc_buf[0] = crc8_dvb_s2_update(0, reinterpret_cast<uint8_t*>(hdr_v2), sizeof(msp_stream_header_v2_t)); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
         ret.checksum = checksum_xor(0, &ret.hdr_buf[V1_CHECKSUM_STARTPOS], ret.hdr_len - V1_CHECKSUM_STARTPOS); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-        ret.checksum = checksum_xor(ret.checksum, packet.payload.ptr(), ret.data_len);
-        ret.checksum = checksum_xor(ret.checksum, &ret.crc_buf[0], ret.crc_len);
-        ret.crc_buf[ret.crc_len++] = ret.checksum; // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
     } else if (msp_version == MSP_V2_NATIVE) {
         auto hdr_v2 = reinterpret_cast<msp_stream_header_v2_t*>(&ret.hdr_buf[ret.hdr_len]); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
         ret.hdr_len += sizeof(msp_stream_header_v2_t);
 
-        hdr_v2->flags = packet.flags;
-        hdr_v2->cmd = static_cast<uint16_t>(packet.cmd);
+        hdr_v2->flags = flags;
+        hdr_v2->cmd = static_cast<uint16_t>(cmd);
         hdr_v2->size = ret.data_len;
 
         ret.checksum = crc8_dvb_s2_update(0, reinterpret_cast<uint8_t*>(hdr_v2), sizeof(msp_stream_header_v2_t)); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
-        ret.checksum = crc8_dvb_s2_update(ret.checksum, packet.payload.ptr(), ret.data_len);
-        ret.crc_buf[ret.crc_len++] = ret.checksum;
     } else {
         // Shouldn't get here
         assert(false);
     }
+    return ret;
+}
+
+/*!
+Updates the running checksums of a stream packet with (part of) its payload.
+*/
+void MspStream::update_checksums(msp_stream_packet_with_header_t& pwh, msp_version_e msp_version, const uint8_t* data, size_t len)
+{
+    msp_version = encoded_version(msp_version);
+    if (msp_version == MSP_V1) {
+        pwh.checksum = checksum_xor(pwh.checksum, data, len);
+    } else if (msp_version == MSP_V2_OVER_V1) {
+        // both checksums are calculated over the data payload in a single pass
+        checksum_xor_crc8_dvb_s2_update(pwh.checksum, pwh.crc_buf[0], data, static_cast<uint32_t>(len));
+    } else {
+        pwh.checksum = crc8_dvb_s2_update(pwh.checksum, data, static_cast<uint32_t>(len));
+    }
+}
+
+/*!
+Finalizes the checksums of a stream packet into its crc_buf.
+*/
+void MspStream::encode_checksums(msp_stream_packet_with_header_t& pwh, msp_version_e msp_version)
+{
+    msp_version = encoded_version(msp_version);
+    if (msp_version == MSP_V2_OVER_V1) {
+        ++pwh.crc_len; // V2 CRC is already in crc_buf[0]
+        pwh.checksum ^= pwh.crc_buf[0];
+    }
+    pwh.crc_buf[pwh.crc_len++] = pwh.checksum; // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+}
+
+/*!
+Encodes and sends a reply whose payload is pulled from a generator, rather than being held in _out_buf.
+
+The header is written using the generator's declared payload length, the payload is then pulled in chunks sized to the
+space available in the serial port's transmit buffer (using _out_buf as the chunk buffer) with the checksums being
+updated incrementally, and finally the checksums are written.
+If the generator supplies fewer bytes than it declared, the payload is padded with zeros so the frame remains well formed.
+*/
+msp_stream_packet_with_header_t MspStream::serial_encode_generated(int16_t cmd, MspPayloadGenerator& generator, msp_version_e msp_version)
+{
+    static constexpr size_t CHUNK_SIZE_MIN = 16;
+
+    const size_t declared_len = std::min(generator.get_payload_length(), static_cast<size_t>(UINT16_MAX));
+    msp_stream_packet_with_header_t ret = encode_header(cmd, MSP_RESULT_ACK, 0, declared_len, msp_version);
 
-    // Send the frame
     if (_msp_serial) {
-        _msp_serial->send_frame(&ret.hdr_buf[0], ret.hdr_len, ret.data_ptr, ret.data_len, &ret.crc_buf[0], ret.crc_len);
+        _msp_serial->send_frame_part(&ret.hdr_buf[0], ret.hdr_len);
+    }
+
+    size_t remaining = ret.data_len;
+    while (remaining > 0) {
+        const size_t available = _msp_serial ? _msp_serial->available_for_write() : _out_buf.size();
+        const size_t chunk_len = std::min(std::clamp(available, CHUNK_SIZE_MIN, _out_buf.size()), remaining);
+        size_t len = generator.read(&_out_buf[0], chunk_len);
+        if (len == 0) {
+            // generator has run dry, so pad the payload
+            std::fill_n(_out_buf.begin(), chunk_len, 0);
+            len = chunk_len;
+        }
+        len = std::min(len, chunk_len);
+        update_checksums(ret, msp_version, &_out_buf[0], len);
+        if (_msp_serial) {
+            _msp_serial->send_frame_part(&_out_buf[0], len);
+        }
+        remaining -= len;
+    }
+
+    encode_checksums(ret, msp_version);
+    if (_msp_serial) {
+        _msp_serial->send_frame_part(&ret.crc_buf[0], ret.crc_len);
+        _msp_serial->send_frame_end();
+        _msp_serial->get_link_statistics().record_frame(MspLinkStatistics::TX, msp_version, ret.data_len, ret.hdr_len + ret.crc_len);
     }
     return ret;
 }
@@ -422,7 +897,7 @@ msp_stream_packet_with_header_t MspStream::serial_encode_msp_v1(uint8_t command,
 
     packet.payload.switch_to_reader(); // change streambuf direction
     set_packet_state(MSP_IDLE);
-    return serial_encode(packet, _msp_version);
+    return serial_encode(packet, select_reply_version(_msp_version, command, 0, len));
 }
 
 /*!
@@ -462,19 +937,453 @@ msp_const_packet_t MspStream::process_in_buf(msp_context_t& pg)
 }
 
 /*!
-Called when the state machine has assembled a packet into _in_buf.
-
-pwh is optional parameter for use by test code.
+Encodes and sends a reply.
 */
-void MspStream::process_received_command(msp_context_t& pg, msp_stream_packet_with_header_t* pwh)
+void MspStream::encode_reply(msp_packet_t& reply, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh)
 {
-    const msp_const_packet_t command = {
-        .payload = StreamBufReader(&_in_buf[0], _data_size),
-        .cmd = static_cast<int16_t>(_cmd_msp),
-        .result = MSP_RESULT_NO_REPLY,
-        .flags = _cmd_flags,
-        .direction = MspBase::DIRECTION_REQUEST
+    reply.payload.switch_to_reader(); // change streambuf direction
+    StreamBufReader payload(reply.payload);
+    if (_compress_reply) {
+        const size_t compressed_len = _compressor->compress(payload.ptr(), payload.bytes_remaining());
+        if (compressed_len > 0) {
+            payload = StreamBufReader(_compressor->get_buf(), compressed_len);
+            reply.flags |= MspCompressor::FLAG_COMPRESSED;
+        }
+    }
+    reply.flags |= _reliable_flags;
+    const msp_const_packet_t reply_const = {
+        .payload = payload,
+        .cmd = reply.cmd,
+        .result = reply.result,
+        .flags = reply.flags,
+        .direction = reply.direction
     };
+    msp_version = select_reply_version(msp_version, reply.cmd, reply.flags, reply_const.payload.bytes_remaining());
+    if (_reliable_flags == 0) {
+        if (pwh) {
+            *pwh = serial_encode(reply_const, msp_version);
+        } else {
+            serial_encode(reply_const, msp_version);
+        }
+        return;
+    }
+    // reply to a reliable request, so is retained for retransmission
+    const msp_stream_packet_with_header_t reliable_pwh = serial_encode(reply_const, msp_version);
+    _reliable_window->retain(MspReliableWindow::get_sequence(_reliable_flags),
+        &reliable_pwh.hdr_buf[0], reliable_pwh.hdr_len, reliable_pwh.data_ptr, reliable_pwh.data_len, &reliable_pwh.crc_buf[0], reliable_pwh.crc_len);
+    if (pwh) {
+        *pwh = reliable_pwh;
+    }
+}
+
+/*!
+Starts a coroutine handler for the command, if it has one. Returns false if the command does not have a coroutine handler,
+in which case the command is processed synchronously.
+
+If the command has a coroutine handler but all the coroutine slots, or all the coroutine frames, are in use it is refused with an error reply,
+rather than being processed synchronously, which would block the MSP task.
+
+If the coroutine completes without suspending its reply is sent immediately, otherwise it is sent by resume_coroutines()
+when the coroutine completes.
+*/
+bool MspStream::start_coroutine(msp_context_t& pg, const msp_const_packet_t& command, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh)
+{
+    for (auto& slot : _coroutine_slots) {
+        if (!slot.coroutine.is_empty()) {
+            continue;
+        }
+        slot.reply = StreamBufWriter(&slot.reply_buf[0], slot.reply_buf.size());
+        StreamBufReader src(command.payload);
+        MspCoroutine coroutine = _msp_base.process_command_coroutine(pg, command.cmd, slot.reply, src);
+        if (coroutine.is_empty()) {
+            if (!coroutine.allocation_failed()) {
+                return false;
+            }
+            // command has a coroutine handler, but no frame could be allocated for it
+            encode_busy_reply(command.cmd, msp_version, pwh);
+            return true;
+        }
+        slot.cmd = command.cmd;
+        slot.msp_version = msp_version;
+        slot.coroutine = std::move(coroutine);
+        if (slot.coroutine.is_done()) {
+            // completed without suspending
+            finish_coroutine(pg, slot, pwh);
+        }
+        return true;
+    }
+    if (!_msp_base.is_coroutine_command(command.cmd)) {
+        return false;
+    }
+    encode_busy_reply(command.cmd, msp_version, pwh);
+    return true;
+}
+
+/*!
+Refuses a command whose coroutine handler could not be started.
+*/
+void MspStream::encode_busy_reply(int16_t cmd_msp, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh)
+{
+    msp_packet_t reply = {
+        .payload = StreamBufWriter(&_out_buf[0], _out_buf.size()),
+        .cmd = cmd_msp,
+        .result = MSP_RESULT_ERROR,
+        .flags = 0,
+        .direction = MspBase::DIRECTION_REPLY
+    };
+    encode_reply(reply, msp_version, pwh);
+}
+
+/*!
+Resumes any coroutine handlers that are ready to continue, and sends the replies of those that have completed.
+
+Called from MspSerial::process_output(), which is called from MspTask::loop().
+*/
+void MspStream::resume_coroutines(msp_context_t& pg)
+{
+    for (auto& slot : _coroutine_slots) {
+        if (slot.coroutine.is_empty()) {
+            continue;
+        }
+        slot.coroutine.resume();
+        if (slot.coroutine.is_done()) {
+            finish_coroutine(pg, slot, nullptr);
+        }
+    }
+}
+
+/*!
+Called from any task to complete a pending reply.
+
+The payload is copied into the reply's buffer before the reply is marked as complete, so it is safe to call this from
+a different task (or core) to the one running MspTask.
+*/
+bool MspPendingReply::complete(msp_result_e result, const uint8_t* data, size_t len)
+{
+    uint8_t expected = PENDING;
+    if (!_state.compare_exchange_strong(expected, COMPLETING, std::memory_order_acquire)) {
+        return false;
+    }
+    _result = static_cast<int16_t>(result);
+    _len = static_cast<uint16_t>(std::min(len, _buf.size()));
+    if (_len > 0) {
+        std::memcpy(&_buf[0], data, _len);
+    }
+    _state.store(COMPLETE, std::memory_order_release);
+    return true;
+}
+
+/*!
+Called when a command handler returns MSP_RESULT_PENDING. Reserves a pending reply and passes it to the handler's
+MspBase::set_pending_reply(), so the reply can be completed later. If there are no free pending replies an error reply is sent.
+*/
+void MspStream::defer_reply(msp_context_t& pg, int16_t cmd, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh)
+{
+    for (auto& pending_reply : _pending_replies) {
+        // pending replies are only reserved and freed by the MSP task, so this does not need to be atomic
+        if (pending_reply._state.load(std::memory_order_relaxed) == MspPendingReply::FREE) {
+            pending_reply._cmd = cmd;
+            pending_reply._msp_version = msp_version;
+            pending_reply._deferred_time_microseconds = time_us();
+            pending_reply._state.store(MspPendingReply::PENDING, std::memory_order_relaxed);
+            _msp_base.set_pending_reply(pg, cmd, pending_reply);
+            return;
+        }
+    }
+    msp_packet_t reply = {
+        .payload = StreamBufWriter(&_out_buf[0], _out_buf.size()),
+        .cmd = cmd,
+        .result = MSP_RESULT_ERROR,
+        .flags = 0,
+        .direction = MspBase::DIRECTION_REPLY
+    };
+    encode_reply(reply, msp_version, pwh);
+}
+
+/*!
+Completes, with an error, any pending replies that have not been completed within PENDING_REPLY_TIMEOUT_US,
+and tells the handler that was to complete them that they have expired.
+
+Called from MspSerial::process_output(), before send_completed_replies() sends the error replies.
+*/
+void MspStream::expire_pending_replies(msp_context_t& pg, uint32_t time_microseconds)
+{
+    for (auto& pending_reply : _pending_replies) {
+        if (pending_reply._state.load(std::memory_order_acquire) != MspPendingReply::PENDING
+            || time_microseconds - pending_reply._deferred_time_microseconds < PENDING_REPLY_TIMEOUT_US) {
+            continue;
+        }
+        // fails if the reply is being completed by another task, in which case it has not expired
+        uint8_t expected = MspPendingReply::PENDING;
+        if (!pending_reply._state.compare_exchange_strong(expected, MspPendingReply::COMPLETING, std::memory_order_acquire)) {
+            continue;
+        }
+        _msp_base.expire_pending_reply(pg, pending_reply._cmd, pending_reply);
+        pending_reply._result = MSP_RESULT_ERROR;
+        pending_reply._len = 0;
+        pending_reply._state.store(MspPendingReply::COMPLETE, std::memory_order_release);
+    }
+}
+
+/*!
+Sends any pending replies that have been completed.
+
+Called from MspSerial::process_output(), which is called from MspTask::loop().
+*/
+void MspStream::send_completed_replies()
+{
+    for (auto& pending_reply : _pending_replies) {
+        if (pending_reply._state.load(std::memory_order_acquire) != MspPendingReply::COMPLETE) {
+            continue;
+        }
+        if (pending_reply._result != MSP_RESULT_NO_REPLY) {
+            const msp_const_packet_t reply = {
+                .payload = StreamBufReader(&pending_reply._buf[0], pending_reply._len),
+                .cmd = pending_reply._cmd,
+                .result = pending_reply._result,
+                .flags = 0,
+                .direction = MspBase::DIRECTION_REPLY
+            };
+            serial_encode(reply, select_reply_version(pending_reply._msp_version, reply.cmd, 0, pending_reply._len));
+        }
+        pending_reply._state.store(MspPendingReply::FREE, std::memory_order_release);
+    }
+}
+
+size_t MspStream::get_pending_reply_count() const
+{
+    size_t count = 0;
+    for (const auto& pending_reply : _pending_replies) {
+        if (pending_reply._state.load(std::memory_order_relaxed) != MspPendingReply::FREE) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+/*!
+Sends the reply of a completed coroutine handler and frees its slot.
+*/
+void MspStream::finish_coroutine(msp_context_t& pg, coroutine_slot_t& slot, msp_stream_packet_with_header_t* pwh)
+{
+    msp_packet_t reply = {
+        .payload = slot.reply,
+        .cmd = slot.cmd,
+        .result = static_cast<int16_t>(slot.coroutine.get_result()),
+        .flags = 0,
+        .direction = MspBase::DIRECTION_REPLY
+    };
+    slot.coroutine.destroy(); // free the slot, and its frame, before sending the reply
+    if (reply.result == MSP_RESULT_PENDING) {
+        defer_reply(pg, slot.cmd, slot.msp_version, pwh);
+    } else if (reply.result != MSP_RESULT_NO_REPLY) {
+        encode_reply(reply, slot.msp_version, pwh);
+    }
+}
+
+size_t MspStream::get_active_coroutine_count() const
+{
+    size_t count = 0;
+    for (const auto& slot : _coroutine_slots) {
+        if (!slot.coroutine.is_empty()) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+/*!
+RC fast path: decodes the MSP_SET_RAW_RC channel values directly from _in_buf and publishes them, bypassing command dispatch.
+Returns false if the payload is malformed, in which case the command is dispatched as normal.
+*/
+bool MspStream::publish_rc_channels(msp_stream_packet_with_header_t* pwh)
+{
+    const size_t channel_count = _data_size / 2;
+    if ((_data_size & 1U) != 0 || channel_count > msp_rc_channels_t::MAX_CHANNEL_COUNT) {
+        return false;
+    }
+    msp_rc_channels_t rc_channels {};
+    for (size_t ii = 0; ii < channel_count; ++ii) {
+        rc_channels.channels[ii] = static_cast<uint16_t>(_in_buf[2*ii] | (_in_buf[2*ii + 1] << 8U));
+    }
+    rc_channels.channel_count = static_cast<uint8_t>(channel_count);
+    rc_channels.arrival_time_microseconds = _timestamped ? _last_char_time_microseconds : 0;
+    _rc_channels->publish(rc_channels);
+
+    if (_suppress_rc_ack) {
+        return true;
+    }
+    if (_frame_queue) {
+        // replies are sent by the task executing the queued frames, so the ACK is left for it to send
+        _rc_ack_msp_version.store(_msp_version, std::memory_order_relaxed);
+        _rc_acks_requested.store(_rc_acks_requested.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        return true;
+    }
+    encode_rc_ack(_msp_version, pwh);
+    return true;
+}
+
+void MspStream::encode_rc_ack(msp_version_e msp_version, msp_stream_packet_with_header_t* pwh)
+{
+    msp_packet_t reply = {
+        .payload = StreamBufWriter(&_out_buf[0], _out_buf.size()),
+        .cmd = MSP_SET_RAW_RC,
+        .result = MSP_RESULT_ACK,
+        .flags = 0,
+        .direction = MspBase::DIRECTION_REPLY
+    };
+    encode_reply(reply, msp_version, pwh);
+}
+
+/*!
+Called when the state machine has assembled a packet into _in_buf.
+
+If there is a frame queue the command is queued, to be executed by process_queued_frames(), otherwise it is executed immediately.
+
+pwh is optional parameter for use by test code.
+*/
+void MspStream::process_received_command(msp_context_t& pg, msp_stream_packet_with_header_t* pwh)
+{
+    // payloads too large for _in_buf are streamed to a payload sink, which is committed now the checksum has been verified
+    if (_payload_sink) {
+        MspPayloadSink* payload_sink = _payload_sink;
+        _payload_sink = nullptr;
+        if (_offset > 0) {
+            payload_sink->write(&_in_buf[0], _offset);
+        }
+        msp_packet_t reply = {
+            .payload = StreamBufWriter(&_out_buf[0], _out_buf.size()),
+            .cmd = static_cast<int16_t>(_cmd_msp),
+            .result = MSP_RESULT_NO_REPLY,
+            .flags = 0,
+            .direction = MspBase::DIRECTION_REPLY
+        };
+        reply.result = payload_sink->commit(pg, reply.payload);
+        if (reply.result != MSP_RESULT_NO_REPLY) {
+            encode_reply(reply, _msp_version, pwh);
+        }
+        return;
+    }
+
+    if (_rc_channels && _cmd_msp == MSP_SET_RAW_RC && publish_rc_channels(pwh)) {
+        return;
+    }
+
+    if (_frame_queue) {
+        MspFrameQueue* frame_queue = (_high_priority_frame_queue && _msp_base.get_command_priority(static_cast<int16_t>(_cmd_msp)) == MSP_PRIORITY_HIGH)
+            ? _high_priority_frame_queue : _frame_queue;
+        MspFrameQueue::frame_t* frame = frame_queue->acquire();
+        if (frame) {
+            frame->msp_version = _msp_version;
+            frame->cmd = static_cast<int16_t>(_cmd_msp);
+            frame->flags = _cmd_flags;
+            frame->size = _data_size;
+            std::memcpy(&frame->payload[0], &_in_buf[0], _data_size);
+            frame_queue->push();
+        }
+        return;
+    }
+
+    const msp_const_packet_t command = {
+        .payload = StreamBufReader(&_in_buf[0], _data_size),
+        .cmd = static_cast<int16_t>(_cmd_msp),
+        .result = MSP_RESULT_NO_REPLY,
+        .flags = _cmd_flags,
+        .direction = MspBase::DIRECTION_REQUEST
+    };
+    execute_command(pg, command, _msp_version, pwh);
+}
+
+static_assert(MSP2_LIBRARY_COMMAND_RANGE_END <= 0x7FFF, "library commands must be representable as int16_t command ids");
+
+/*!
+Executes a command in the library's range, MSP2_LIBRARY_COMMAND_RANGE_BEGIN to MSP2_LIBRARY_COMMAND_RANGE_END.
+These report the state of the library (eg the link statistics, which belong to the MspSerial), so are answered here rather than by MspBase.
+Returns false if the command is not known to the library, in which case it is passed to MspBase.
+*/
+bool MspStream::execute_library_command(const msp_const_packet_t& command, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh)
+{
+    if (command.cmd != MSP2_LINK_STATISTICS || !_msp_serial) {
+        return false;
+    }
+    msp_packet_t reply = {
+        .payload = StreamBufWriter(&_out_buf[0], _out_buf.size()),
+        .cmd = command.cmd,
+        .result = MSP_RESULT_ACK,
+        .flags = 0,
+        .direction = MspBase::DIRECTION_REPLY
+    };
+    _msp_serial->get_link_statistics().write_payload(reply.payload);
+    encode_reply(reply, msp_version, pwh);
+    return true;
+}
+
+#if !defined(NDEBUG)
+/*!
+Debug builds check that the optional handlers that are skipped because their flag is not set are the MspBase defaults,
+since an overriding handler whose flag was not passed to the MspBase constructor would otherwise be silently ignored.
+*/
+void MspStream::check_handler_flags(msp_context_t& pg, const msp_const_packet_t& command, uint8_t handler_flags)
+{
+    if ((handler_flags & MspBase::HANDLES_COROUTINE_COMMANDS) == 0) {
+        StreamBufWriter dst(&_out_buf[0], _out_buf.size());
+        StreamBufReader src(command.payload);
+        const MspCoroutine coroutine = _msp_base.process_command_coroutine(pg, command.cmd, dst, src);
+        assert(coroutine.is_empty() && !coroutine.allocation_failed() && !_msp_base.is_coroutine_command(command.cmd)
+            && "coroutine handler without MspBase::HANDLES_COROUTINE_COMMANDS");
+    }
+    if ((handler_flags & MspBase::HANDLES_STREAM_COMMANDS) == 0) {
+        StreamBufReader src(command.payload);
+        assert(_msp_base.process_stream_command(pg, command.cmd, src) == nullptr
+            && "stream command handler without MspBase::HANDLES_STREAM_COMMANDS");
+    }
+}
+#endif
+
+/*!
+Executes a command and sends its reply.
+*/
+void MspStream::execute_command(msp_context_t& pg, const msp_const_packet_t& command, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh)
+{
+    if (_reliable_window && MspReliableWindow::is_reliable(command.flags)) {
+        execute_reliable_command(pg, command, msp_version, pwh);
+        return;
+    }
+    if (_compressor && MspCompressor::is_compressed(command.flags)) {
+        execute_compressed_command(pg, command, msp_version, pwh);
+        return;
+    }
+
+    if (command.cmd >= MSP2_LIBRARY_COMMAND_RANGE_BEGIN && command.cmd <= MSP2_LIBRARY_COMMAND_RANGE_END
+        && execute_library_command(command, msp_version, pwh)) {
+        return;
+    }
+
+    // the optional handlers are only called if _msp_base has them, saving two virtual calls per frame if it does not
+    const uint8_t handler_flags = _msp_base.get_handler_flags();
+#if !defined(NDEBUG)
+    check_handler_flags(pg, command, handler_flags);
+#endif
+
+    // commands that wait on slow operations are processed by coroutines
+    if ((handler_flags & MspBase::HANDLES_COROUTINE_COMMANDS) && start_coroutine(pg, command, msp_version, pwh)) {
+        return;
+    }
+
+    // replies too large for _out_buf are streamed from a payload generator
+    if (handler_flags & MspBase::HANDLES_STREAM_COMMANDS) {
+        StreamBufReader src(command.payload);
+        MspPayloadGenerator* generator = _msp_base.process_stream_command(pg, command.cmd, src);
+        if (generator) {
+            msp_version = select_reply_version(msp_version, command.cmd, 0, generator->get_payload_length());
+            if (pwh) {
+                *pwh = serial_encode_generated(command.cmd, *generator, msp_version);
+            } else {
+                serial_encode_generated(command.cmd, *generator, msp_version);
+            }
+            return;
+        }
+    }
 
     msp_packet_t reply = {
         .payload = StreamBufWriter(&_out_buf[0], _out_buf.size()),
@@ -487,32 +1396,179 @@ void MspStream::process_received_command(msp_context_t& pg, msp_stream_packet_wi
     //!!const msp_result_e status = _msp_base.*mspProcessCommandFn(command, reply, _descriptor, &mspPostProcessFn);
     //(void)mspProcessCommandFn;
     const msp_result_e status = _msp_base.process_command(pg, command, reply);
+    if (status == MSP_RESULT_PENDING) {
+        defer_reply(pg, command.cmd, msp_version, pwh);
+    } else if (status != MSP_RESULT_NO_REPLY) {
+        encode_reply(reply, msp_version, pwh);
+    }
+}
 
-    msp_const_packet_t replyConst = {
-        .payload = StreamBufReader(reply.payload),
-        .cmd = reply.cmd,
-        .result = reply.result,
-        .flags = reply.flags,
-        .direction = reply.direction
+/*!
+Resends a reply retained by the reliable window. It is already encoded, so it is counted by the link statistics as a retransmission,
+rather than as a new frame.
+*/
+void MspStream::retransmit_frame(const uint8_t* frame, size_t len)
+{
+    if (_msp_serial) {
+        _msp_serial->get_link_statistics().record_retransmitted_frame();
+        _msp_serial->send_frame(frame, len, nullptr, 0, nullptr, 0);
+    }
+}
+
+/*!
+Handles a request with MspReliableWindow::FLAG_RELIABLE set.
+
+An acknowledgement releases the replies it acknowledges and causes any missed replies to be retransmitted.
+A repeated request is answered by retransmitting the retained reply, or with an empty ACK if its reply was not retained,
+without executing the command again.
+Otherwise the command is executed, with the reliability flags stripped, and its reply is sent with the request's flags and retained.
+Replies that are deferred (to a coroutine or by MSP_RESULT_PENDING) or streamed are sent without the reliability flags.
+Retransmission requires an MspSerial.
+*/
+void MspStream::execute_reliable_command(msp_context_t& pg, const msp_const_packet_t& command, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh)
+{
+    if (MspReliableWindow::is_ack(command.flags)) {
+        StreamBufReader src(command.payload);
+        const uint16_t acknowledged = src.bytes_remaining() >= sizeof(uint16_t) ? src.read_u16() : 0;
+        std::array<const MspReliableWindow::frame_t*, MspReliableWindow::SLOT_COUNT> retransmit {};
+        const size_t count = _reliable_window->on_ack(acknowledged, retransmit);
+        for (size_t ii = 0; ii < count; ++ii) {
+            retransmit_frame(&retransmit[ii]->buf[0], retransmit[ii]->len);
+        }
+        return;
+    }
+
+    const uint8_t sequence = MspReliableWindow::get_sequence(command.flags);
+    bool duplicate = false;
+    const MspReliableWindow::frame_t* retained = _reliable_window->on_request(sequence, duplicate);
+    if (retained) {
+        retransmit_frame(&retained->buf[0], retained->len);
+        return;
+    }
+    _reliable_flags = MspReliableWindow::make_flags(sequence);
+    if (duplicate) {
+        // already executed, but the reply was not retained, so acknowledge without executing the command again
+        msp_packet_t reply = {
+            .payload = StreamBufWriter(&_out_buf[0], _out_buf.size()),
+            .cmd = command.cmd,
+            .result = MSP_RESULT_ACK,
+            .flags = 0,
+            .direction = MspBase::DIRECTION_REPLY
+        };
+        encode_reply(reply, msp_version, pwh);
+        _reliable_flags = 0;
+        return;
+    }
+
+    const msp_const_packet_t stripped_command = {
+        .payload = command.payload,
+        .cmd = command.cmd,
+        .result = command.result,
+        .flags = MspReliableWindow::strip_flags(command.flags),
+        .direction = command.direction
     };
-    if (status != MSP_RESULT_NO_REPLY) {
-        replyConst.payload.switch_to_reader(); // change streambuf direction
-        if (pwh) {
-            *pwh = serial_encode(replyConst, _msp_version);
-        } else {
-            serial_encode(replyConst, _msp_version);
+    execute_command(pg, stripped_command, msp_version, pwh);
+    _reliable_flags = 0;
+}
+
+/*!
+Handles a request with MspCompressor::FLAG_COMPRESSED set, that is from a client that accepts compressed replies.
+
+The command is executed with the compression flag stripped, and its reply is compressed if that makes it smaller.
+Replies that are deferred (to a coroutine or by MSP_RESULT_PENDING) or streamed are sent uncompressed.
+*/
+void MspStream::execute_compressed_command(msp_context_t& pg, const msp_const_packet_t& command, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh)
+{
+    const msp_const_packet_t stripped_command = {
+        .payload = command.payload,
+        .cmd = command.cmd,
+        .result = command.result,
+        .flags = MspCompressor::strip_flags(command.flags),
+        .direction = command.direction
+    };
+    _compress_reply = true;
+    execute_command(pg, stripped_command, msp_version, pwh);
+    _compress_reply = false;
+}
+
+/*!
+Executes the commands in the frame queues. This is the consumer side of the frame queues, so must only be called from one task.
+Any RC ACKs deferred by publish_rc_channels() are sent first.
+
+High priority commands are executed first, and the high priority queue is checked again after each normal priority command,
+so high priority commands are delayed by at most one normal priority command.
+
+Called from MspSerial::process_output(), which may be called from a different task (or core) to MspSerial::process_input().
+*/
+void MspStream::process_queued_frames(msp_context_t& pg)
+{
+    if (!_frame_queue) {
+        return;
+    }
+    // RC ACKs deferred by publish_rc_channels()
+    const uint32_t rc_acks_requested = _rc_acks_requested.load(std::memory_order_acquire);
+    for (uint32_t rc_acks_sent = _rc_acks_sent.load(std::memory_order_relaxed); rc_acks_sent != rc_acks_requested; ++rc_acks_sent) {
+        encode_rc_ack(_rc_ack_msp_version.load(std::memory_order_relaxed), nullptr);
+        _rc_acks_sent.store(rc_acks_sent + 1, std::memory_order_relaxed);
+    }
+    while (true) {
+        if (_high_priority_frame_queue && execute_queued_frame(pg, *_high_priority_frame_queue)) {
+            continue;
         }
+        if (!execute_queued_frame(pg, *_frame_queue)) {
+            break;
+        }
+    }
+}
 
+/*!
+Executes the oldest command in frame_queue, returns false if the queue is empty.
+*/
+bool MspStream::execute_queued_frame(msp_context_t& pg, MspFrameQueue& frame_queue)
+{
+    const MspFrameQueue::frame_t* frame = frame_queue.front();
+    if (!frame) {
+        return false;
     }
+    const msp_const_packet_t command = {
+        .payload = StreamBufReader(&frame->payload[0], frame->size),
+        .cmd = frame->cmd,
+        .result = MSP_RESULT_NO_REPLY,
+        .flags = frame->flags,
+        .direction = MspBase::DIRECTION_REQUEST
+    };
+    execute_command(pg, command, frame->msp_version, nullptr);
+    frame_queue.pop();
+    return true;
 }
 
+/*!
+Passes a received reply to MspBase::process_reply(), decompressing it first if it is compressed.
+Compressed replies that cannot be decompressed are dropped, and counted in the compressor statistics.
+*/
 void MspStream::process_received_reply(msp_context_t& pg)
 {
+    if (_compressor && MspCompressor::is_compressed(_cmd_flags)) {
+        const size_t len = _compressor->decompress(&_in_buf[0], _data_size);
+        if (len == MspCompressor::DECOMPRESS_ERROR) {
+            return;
+        }
+        const msp_packet_t reply = {
+            .payload = StreamBufWriter(_compressor->get_buf(), len),
+            .cmd = static_cast<int16_t>(_cmd_msp),
+            .result = 0,
+            .flags = MspCompressor::strip_flags(_cmd_flags),
+            .direction = 0
+        };
+        _msp_base.process_reply(pg, reply);
+        return;
+    }
+
     const msp_packet_t reply = {
         .payload = StreamBufWriter(&_in_buf[0], _data_size),
         .cmd = static_cast<int16_t>(_cmd_msp),
         .result = 0,
-        .flags = 0,
+        .flags = _cmd_flags,
         .direction = 0
     };
 
@@ -522,18 +1578,19 @@ void MspStream::process_received_reply(msp_context_t& pg)
 }
 
 /*!
-pwh is optional return value for use by test code.
+Processes a received packet, if the state machine has completed one.
 */
-bool MspStream::put_char(msp_context_t& pg, uint8_t c, msp_stream_packet_with_header_t* pwh)
+bool MspStream::process_packet_state(msp_context_t& pg, msp_stream_packet_with_header_t* pwh)
 {
     bool ret = false;
 
-    // Run state machine on incoming character
-    process_received_packet_data(c);
-
     if (_packet_state == MSP_COMMAND_RECEIVED) {
         ret = true;
+        if (_msp_serial) {
+            _msp_serial->get_link_statistics().record_frame(MspLinkStatistics::RX, _msp_version, _data_size, get_framing_overhead(_msp_version, _data_size));
+        }
         if (_packet_type == MSP_PACKET_COMMAND) {
+            add_client_capabilities(static_cast<uint8_t>(1U << _msp_version));
             process_received_command(pg, pwh); // eventually calls processWriteCommand or processReadCommand
         } else if (_packet_type == MSP_PACKET_REPLY) {
             process_received_reply(pg); // by default does nothing
@@ -547,3 +1604,161 @@ bool MspStream::put_char(msp_context_t& pg, uint8_t c, msp_stream_packet_with_he
     }
     return ret;
 }
+
+/*!
+Rewinds after an aborted packet: rescans the bytes of the aborted packet for the start of another frame.
+
+The rescan is done in place, this is safe since the state machine only writes to _in_buf at indices below the one being read.
+Only one level of rewind is performed: packets aborted during the rescan are not themselves rescanned.
+*/
+bool MspStream::resynchronize(msp_context_t& pg, msp_stream_packet_with_header_t* pwh)
+{
+    bool ret = false;
+    const size_t len = _resync_len;
+    const bool resync_char_pending = _resync_char_pending;
+    const uint8_t resync_char = _resync_char;
+
+    _resync_len = 0;
+    _resync_char_pending = false;
+    _resynchronizing = true;
+
+    size_t ii = 0;
+    while (ii < len) {
+        if (_packet_state == MSP_IDLE) {
+            ii += find_frame_start(&_in_buf[ii], len - ii);
+            if (ii == len) {
+                break;
+            }
+        }
+        process_received_packet_data(_in_buf[ii]);
+        ret |= process_packet_state(pg, pwh);
+        ++ii;
+    }
+    if (resync_char_pending) {
+        process_received_packet_data(resync_char);
+        ret |= process_packet_state(pg, pwh);
+    }
+
+    _resynchronizing = false;
+    return ret;
+}
+
+/*!
+pwh is optional return value for use by test code.
+*/
+bool MspStream::put_char(msp_context_t& pg, uint8_t c, msp_stream_packet_with_header_t* pwh)
+{
+    // Run state machine on incoming character
+    process_received_packet_data(c);
+
+    bool ret = process_packet_state(pg, pwh);
+    if (_resync_len > 0 || _resync_char_pending) {
+        ret |= resynchronize(pg, pwh);
+    }
+    return ret;
+}
+
+/*!
+Abandons a partially received frame if more than the frame timeout has elapsed since the previous character was received.
+This stops a truncated frame from swallowing the start of the next valid frame.
+*/
+void MspStream::check_frame_timeout(uint32_t time_microseconds)
+{
+    if (_frame_timeout_microseconds != 0 && _packet_state != MSP_IDLE && time_microseconds - _last_char_time_microseconds > _frame_timeout_microseconds) {
+        _packet_state = MSP_IDLE;
+        _stream_state = STREAM_IDLE;
+        abort_payload_sink();
+        ++_expired_frame_count;
+    }
+    _last_char_time_microseconds = time_microseconds;
+}
+
+bool MspStream::put_char(msp_context_t& pg, uint8_t c, msp_stream_packet_with_header_t* pwh, uint32_t time_microseconds)
+{
+    check_frame_timeout(time_microseconds);
+    _timestamped = true;
+    const bool ret = put_char(pg, c, pwh);
+    _timestamped = false;
+    return ret;
+}
+
+/*!
+Copies payload bytes into _in_buf in bulk, updating the checksums with the block checksum functions.
+
+The final byte of the payload is left for the state machine, so that it makes the transition to the checksum state.
+Returns the number of bytes consumed.
+*/
+size_t MspStream::put_payload(const uint8_t* data, size_t len)
+{
+    const size_t payload_remaining = static_cast<size_t>(_data_size) - _payload_flushed - _offset;
+    len = std::min({ len, payload_remaining - 1, _in_buf.size() - _offset });
+    if (len == 0) {
+        return 0;
+    }
+    std::memcpy(&_in_buf[_offset], data, len);
+    if (is_version_supported(MSP_V1) && _packet_state == MSP_PAYLOAD_V1) {
+        _checksum1 = checksum_xor(_checksum1, data, len);
+    } else if (V2_OVER_V1_SUPPORTED && _packet_state == MSP_PAYLOAD_V2_OVER_V1) {
+        checksum_xor_crc8_dvb_s2_update(_checksum1, _checksum2, data, static_cast<uint32_t>(len));
+    } else {
+        _checksum2 = crc8_dvb_s2_update(_checksum2, data, static_cast<uint32_t>(len));
+    }
+    _offset = static_cast<uint16_t>(_offset + len);
+    if (_offset == _in_buf.size()) {
+        flush_payload(); // can only happen if there is a payload sink
+    }
+    return len;
+}
+
+/*!
+Bulk version of put_char.
+
+When the state machine is idle, noise is skipped with find_frame_start() rather than being fed through the state machine a byte at a time.
+Similarly the payload of a discarded packet is skipped at constant cost, and payloads are copied and checksummed in blocks.
+
+Returns the number of packets received.
+*/
+size_t MspStream::put_buf(msp_context_t& pg, const uint8_t* data, size_t len)
+{
+    size_t packet_count = 0;
+
+    size_t ii = 0;
+    while (ii < len) {
+        if (_packet_state == MSP_IDLE) {
+            ii += find_frame_start(data + ii, len - ii); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+            if (ii == len) {
+                break;
+            }
+        } else if (_packet_state == MSP_PAYLOAD_DISCARD) {
+            // skip all but the last byte to be discarded, which is handled by the state machine
+            const size_t skip = std::min(len - ii, static_cast<size_t>(_discard_remaining - 1));
+            _discard_remaining -= static_cast<uint32_t>(skip);
+            ii += skip;
+            if (ii == len) {
+                break;
+            }
+        } else if (_packet_state == MSP_PAYLOAD_V1 || _packet_state == MSP_PAYLOAD_V2_OVER_V1 || _packet_state == MSP_PAYLOAD_V2_NATIVE) {
+            ii += put_payload(data + ii, len - ii); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+            if (ii == len) {
+                break;
+            }
+        }
+        if (put_char(pg, data[ii], nullptr)) { // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+            ++packet_count;
+        }
+        ++ii;
+    }
+    return packet_count;
+}
+
+/*!
+All characters in data are taken to have arrived at time_microseconds.
+*/
+size_t MspStream::put_buf(msp_context_t& pg, const uint8_t* data, size_t len, uint32_t time_microseconds)
+{
+    check_frame_timeout(time_microseconds);
+    _timestamped = true;
+    const size_t packet_count = put_buf(pg, data, len);
+    _timestamped = false;
+    return packet_count;
+}
@@ -47,8 +47,14 @@
 #pragma once
 
 #include "msp_base.h"
+#include "msp_coroutine.h"
+#include "msp_snapshot.h"
 #include <array>
+#include <atomic>
 
+class MspCompressor;
+class MspFrameQueue;
+class MspReliableWindow;
 class MspSerial;
 struct msp_context_t;
 
@@ -77,6 +83,8 @@ enum msp_packet_state_e {
     MSP_PAYLOAD_V2_NATIVE,
     MSP_CHECKSUM_V2_NATIVE,
 
+    MSP_PAYLOAD_DISCARD,    // skipping a frame too large to buffer
+
     MSP_COMMAND_RECEIVED
 };
 
@@ -85,6 +93,11 @@ enum msp_packet_type_e {
     MSP_PACKET_REPLY
 };
 
+enum msp_reply_framing_e {
+    MSP_REPLY_FRAMING_SAME,     // replies use the framing of the command
+    MSP_REPLY_FRAMING_CHEAPEST  // replies use the framing with the least overhead that the client accepts
+};
+
 enum msp_pending_system_request_e {
     MSP_PENDING_NONE,
     MSP_PENDING_BOOTLOADER_ROM,
@@ -117,6 +130,64 @@ struct msp_stream_packet_with_header_t {
     uint8_t checksum;
 };
 
+/*!
+A command being processed by a coroutine handler, the reply is held in reply_buf until the coroutine completes.
+*/
+template <size_t N>
+struct msp_coroutine_slot_t {
+    MspCoroutine coroutine;
+    std::array<uint8_t, N> reply_buf;
+    StreamBufWriter reply { &reply_buf[0], N };
+    int16_t cmd;
+    msp_version_e msp_version;
+};
+
+/*!
+Completion token for a reply that a command handler has deferred by returning MSP_RESULT_PENDING.
+
+The reply is completed by calling complete(), which may be done from another task (for example the flight loop)
+while MspStream continues to process other commands. The completed reply is sent from MspTask::loop().
+*/
+class MspPendingReply {
+public:
+#if defined(MSP_STREAM_PENDING_REPLY_BUFFER_SIZE)
+    static constexpr size_t BUFFER_SIZE = MSP_STREAM_PENDING_REPLY_BUFFER_SIZE;
+#else
+    static constexpr size_t BUFFER_SIZE = 64;
+#endif
+    enum state_e : uint8_t { FREE, PENDING, COMPLETING, COMPLETE };
+public:
+    // payloads longer than BUFFER_SIZE are truncated, returns false if the reply is not pending (eg it has already been completed)
+    bool complete(msp_result_e result, const uint8_t* data, size_t len);
+    // abandons the reply, the client is sent an error reply, returns false if the reply is not pending
+    bool cancel() { return complete(MSP_RESULT_ERROR, nullptr, 0); }
+    int16_t get_cmd() const { return _cmd; }
+    bool is_pending() const { return _state.load(std::memory_order_acquire) == PENDING; }
+private:
+    friend class MspStream;
+    std::atomic<uint8_t> _state { FREE };
+    int16_t _cmd {};
+    int16_t _result {};
+    msp_version_e _msp_version {};
+    uint16_t _len {};
+    uint32_t _deferred_time_microseconds {};
+    std::array<uint8_t, BUFFER_SIZE> _buf {};
+};
+
+/*!
+RC channel values received in an MSP_SET_RAW_RC command, published by the MspStream RC fast path.
+*/
+struct msp_rc_channels_t {
+#if defined(MSP_STREAM_RC_CHANNEL_COUNT)
+    static constexpr size_t MAX_CHANNEL_COUNT = MSP_STREAM_RC_CHANNEL_COUNT;
+#else
+    static constexpr size_t MAX_CHANNEL_COUNT = 18;
+#endif
+    std::array<uint16_t, MAX_CHANNEL_COUNT> channels;
+    uint8_t channel_count;
+    uint32_t arrival_time_microseconds; // time the last character of the frame was received, as passed to the timestamped put_char/put_buf, zero if the frame was not timestamped
+};
+
 class MspStream {
 public:
     static constexpr size_t JUMBO_FRAME_SIZE_LIMIT = 255;
@@ -126,7 +197,8 @@ public:
     static constexpr size_t MSP_HEADER_LENGTH = 3;
     static constexpr size_t MSP_STREAM_INBUF_SIZE = 192;
     static constexpr size_t MSP_STREAM_OUTBUF_SIZE_MIN = 512; // As of 2021/08/10 MSP_BOXNAMES generates a 307 byte response for page 1. There has been overflow issues with 320 byte buffer.
-#ifdef USE_FLASHFS
+// with streamed replies MSP_DATAFLASH_READ does not need a dataflash sized output buffer
+#if defined(USE_FLASHFS) && !defined(LIBRARY_MULTI_WII_SERIAL_PROTOCOL_USE_STREAMED_DATAFLASH_READ)
     static constexpr size_t MSP_STREAM_DATAFLASH_BUFFER_SIZE = 4096;
     static constexpr size_t MSP_STREAM_DATAFLASH_INFO_SIZE = 16;
     static constexpr size_t MSP_STREAM_OUTBUF_SIZE = MSP_STREAM_DATAFLASH_BUFFER_SIZE + MSP_STREAM_DATAFLASH_INFO_SIZE;
@@ -135,10 +207,81 @@ public:
 #endif
 
     static constexpr size_t MSP_MAX_HEADER_SIZE = 9;
+    // Frames too large for _in_buf are skipped, unless they claim to be larger than this, in which case the header is assumed to be noise.
+    static constexpr uint16_t MSP_STREAM_DISCARD_SIZE_LIMIT = 1024;
+#if defined(MSP_STREAM_COROUTINE_SLOT_COUNT)
+    static constexpr size_t COROUTINE_SLOT_COUNT = MSP_STREAM_COROUTINE_SLOT_COUNT;
+#else
+    static constexpr size_t COROUTINE_SLOT_COUNT = 2;
+#endif
+#if defined(MSP_STREAM_COROUTINE_REPLY_BUFFER_SIZE)
+    static constexpr size_t COROUTINE_REPLY_BUFFER_SIZE = MSP_STREAM_COROUTINE_REPLY_BUFFER_SIZE;
+#else
+    static constexpr size_t COROUTINE_REPLY_BUFFER_SIZE = 128;
+#endif
+#if defined(MSP_STREAM_PENDING_REPLY_COUNT)
+    static constexpr size_t PENDING_REPLY_COUNT = MSP_STREAM_PENDING_REPLY_COUNT;
+#else
+    static constexpr size_t PENDING_REPLY_COUNT = 2;
+#endif
+    // pending replies not completed within this time are expired, so a lost completion token does not hold its slot forever
+#if defined(MSP_STREAM_PENDING_REPLY_TIMEOUT_US)
+    static constexpr uint32_t PENDING_REPLY_TIMEOUT_US = MSP_STREAM_PENDING_REPLY_TIMEOUT_US;
+#else
+    static constexpr uint32_t PENDING_REPLY_TIMEOUT_US = 1000000;
+#endif
+    using coroutine_slot_t = msp_coroutine_slot_t<COROUTINE_REPLY_BUFFER_SIZE>;
+    // MSP versions that are parsed and encoded, frames of other versions are ignored
+    // define MSP_STREAM_SUPPORTED_VERSIONS (eg as MSP_VERSION_MASK_V2_NATIVE) to remove the states and checksum paths of unused versions
+#if defined(MSP_STREAM_SUPPORTED_VERSIONS)
+    static constexpr unsigned SUPPORTED_VERSIONS = MSP_STREAM_SUPPORTED_VERSIONS;
+#else
+    static constexpr unsigned SUPPORTED_VERSIONS = MSP_VERSION_MASK_ALL;
+#endif
+    static_assert(SUPPORTED_VERSIONS != 0 && (SUPPORTED_VERSIONS & ~static_cast<unsigned>(MSP_VERSION_MASK_ALL)) == 0, "invalid MSP_STREAM_SUPPORTED_VERSIONS");
+    static constexpr bool is_version_supported(msp_version_e msp_version) { return (SUPPORTED_VERSIONS & (1U << msp_version)) != 0; }
+    // client capabilities, the version bits are set as valid commands of each version are received
+    static constexpr uint8_t CLIENT_CAPABILITY_V1 = 1U << MSP_V1;
+    static constexpr uint8_t CLIENT_CAPABILITY_V2_OVER_V1 = 1U << MSP_V2_OVER_V1;
+    static constexpr uint8_t CLIENT_CAPABILITY_V2_NATIVE = 1U << MSP_V2_NATIVE;
+    static constexpr uint8_t CLIENT_CAPABILITY_JUMBO = 0x08; // client accepts MSP V1 jumbo frames, must be set by the application
 public:
     //MspStream(MspBase& msp_base, MspSerial* msp_serial);
     explicit MspStream(MspBase& msp_base);
     void set_msp_serial(MspSerial* msp_serial) { _msp_serial = msp_serial; }
+    // with a frame queue, received commands are queued and executed by process_queued_frames() rather than being executed immediately
+    // if there is a high priority frame queue, high priority commands are queued on it and executed ahead of the other queued commands
+    void set_frame_queue(MspFrameQueue* frame_queue, MspFrameQueue* high_priority_frame_queue = nullptr) {
+        _frame_queue = frame_queue;
+        _high_priority_frame_queue = frame_queue ? high_priority_frame_queue : nullptr;
+    }
+    // with a frame queue all replies are sent by process_queued_frames(), so from the task that calls MspSerial::process_output()
+    bool has_frame_queue() const { return _frame_queue != nullptr; }
+
+    // with an RC channels snapshot, MSP_SET_RAW_RC is decoded by the parser and published to the snapshot rather than being dispatched to MspBase
+    // the ACK may be suppressed, since an RC source sending at a fixed rate does not need it
+    // with a frame queue, the ACK is sent by process_queued_frames(), rather than by the parser
+    void set_rc_channels_snapshot(MspSnapshot<msp_rc_channels_t>* rc_channels, bool suppress_rc_ack = false) {
+        _rc_channels = rc_channels;
+        _suppress_rc_ack = suppress_rc_ack;
+    }
+
+    // with a reliable window, replies to requests with MspReliableWindow::FLAG_RELIABLE set are retained until acknowledged,
+    // and retransmitted when the request is repeated or a later reply is acknowledged, see MspReliableWindow
+    void set_reliable_window(MspReliableWindow* reliable_window) { _reliable_window = reliable_window; }
+
+    // with a compressor, replies to requests with MspCompressor::FLAG_COMPRESSED set are compressed when that makes them smaller,
+    // and received replies with MspCompressor::FLAG_COMPRESSED set are decompressed before being passed to MspBase::process_reply()
+    void set_compressor(MspCompressor* compressor) { _compressor = compressor; }
+
+    // with MSP_REPLY_FRAMING_CHEAPEST, replies and pushed frames use the framing with the least overhead that the client has shown it accepts
+    void set_reply_framing(msp_reply_framing_e reply_framing) { _reply_framing = reply_framing; }
+    uint8_t get_client_capabilities() const { return _client_capabilities.load(std::memory_order_relaxed); }
+    void add_client_capabilities(uint8_t client_capabilities) { _client_capabilities.fetch_or(client_capabilities, std::memory_order_relaxed); }
+    // call when a new client connects
+    void reset_session() { _client_capabilities.store(0, std::memory_order_relaxed); }
+    msp_version_e select_reply_version(msp_version_e msp_version, int16_t cmd, uint8_t flags, size_t payload_len) const;
+    static size_t get_framing_overhead(msp_version_e msp_version, size_t payload_len);
 
     void set_stream_state(msp_stream_state_e streamState) { _stream_state = streamState; }
 
@@ -151,10 +294,28 @@ public:
     void process_received_command(msp_context_t& pg, msp_stream_packet_with_header_t* pwh);
     void process_received_reply(msp_context_t& pg);
     void process_pending_request(msp_context_t& pg);
+    void process_queued_frames(msp_context_t& pg);
+    void resume_coroutines(msp_context_t& pg);
+    size_t get_active_coroutine_count() const;
+    void expire_pending_replies(msp_context_t& pg, uint32_t time_microseconds);
+    void send_completed_replies();
+    size_t get_pending_reply_count() const;
     msp_stream_packet_with_header_t serial_encode(const msp_const_packet_t& packet, msp_version_e msp_version);
     msp_stream_packet_with_header_t serial_encode_msp_v1(uint8_t command, const uint8_t* buf, uint8_t len);
+    msp_stream_packet_with_header_t serial_encode_generated(int16_t cmd, MspPayloadGenerator& generator, msp_version_e msp_version);
     //bool put_char(uint8_t c, MspBase::process_commandFnPtr process_commandFn, MspBase::process_replyFnPtr process_replyFn, packet_with_header_t& pwh);
     bool put_char(msp_context_t& pg, uint8_t c, msp_stream_packet_with_header_t* pwh);
+    size_t put_buf(msp_context_t& pg, const uint8_t* data, size_t len);
+    // timestamped versions, partially received frames are abandoned if the gap between characters exceeds the frame timeout
+    // characters are timestamped when they are read, so the frame timeout must be longer than the interval at which input is polled
+    bool put_char(msp_context_t& pg, uint8_t c, msp_stream_packet_with_header_t* pwh, uint32_t time_microseconds);
+    size_t put_buf(msp_context_t& pg, const uint8_t* data, size_t len, uint32_t time_microseconds);
+
+    void set_frame_timeout_microseconds(uint32_t frame_timeout_microseconds) { _frame_timeout_microseconds = frame_timeout_microseconds; }
+    uint32_t get_frame_timeout_microseconds() const { return _frame_timeout_microseconds; }
+    uint32_t get_expired_frame_count() const { return _expired_frame_count; }
+    uint32_t get_discarded_frame_count() const { return _discarded_frame_count; }
+    void set_discard_size_limit(uint16_t discard_size_limit) { _discard_size_limit = discard_size_limit; }
 
 public: // for testing
     msp_const_packet_t process_in_buf(msp_context_t& pg);
@@ -164,14 +325,65 @@ public: // for testing
     uint8_t get_checksum1() const { return _checksum1; }
     uint8_t get_checksum2() const { return _checksum2; }
 public: // made public for testing
+    static size_t find_frame_start(const uint8_t* data, size_t len);
     static uint8_t checksum_xor(uint8_t checksum, const uint8_t* data, size_t len);
+    static uint8_t checksum_xor_bytewise(uint8_t checksum, const uint8_t* data, size_t len);
     static uint8_t crc8_calc(uint8_t crc, unsigned char a, uint8_t poly);
     static uint8_t crc8_update(uint8_t crc, const void *data, uint32_t length, uint8_t poly);
-    static uint8_t crc8_dvb_s2(uint8_t crc, unsigned char a) { return crc8_calc(crc, a, 0xD5); }
-    static uint8_t crc8_dvb_s2_update(uint8_t crc, const void *data, uint32_t length) { return crc8_update(crc, data, length, 0xD5); }
+    static uint8_t crc8_dvb_s2(uint8_t crc, unsigned char a);
+    static uint8_t crc8_dvb_s2_update(uint8_t crc, const void *data, uint32_t length);
+    static void checksum_xor_crc8_dvb_s2_update(uint8_t& checksum, uint8_t& crc, const void *data, uint32_t length);
+private:
+    // V1 and V2 over V1 frames share the '$M' preamble and V1 header
+    static constexpr bool V1_FRAMING_SUPPORTED = (SUPPORTED_VERSIONS & (MSP_VERSION_MASK_V1 | MSP_VERSION_MASK_V2_OVER_V1)) != 0;
+    static constexpr bool V2_OVER_V1_SUPPORTED = (SUPPORTED_VERSIONS & MSP_VERSION_MASK_V2_OVER_V1) != 0;
+    static constexpr bool V2_NATIVE_SUPPORTED = (SUPPORTED_VERSIONS & MSP_VERSION_MASK_V2_NATIVE) != 0;
+    static constexpr msp_version_e encoded_version(msp_version_e msp_version);
+    static msp_stream_packet_with_header_t encode_header(int16_t cmd, int16_t result, uint8_t flags, size_t data_len, msp_version_e msp_version);
+    static void update_checksums(msp_stream_packet_with_header_t& pwh, msp_version_e msp_version, const uint8_t* data, size_t len);
+    static void encode_checksums(msp_stream_packet_with_header_t& pwh, msp_version_e msp_version);
+    bool process_packet_state(msp_context_t& pg, msp_stream_packet_with_header_t* pwh);
+    bool resynchronize(msp_context_t& pg, msp_stream_packet_with_header_t* pwh);
+    void abort_packet(uint8_t c, bool c_in_buf);
+    void check_frame_timeout(uint32_t time_microseconds);
+    void discard_packet(uint8_t c, uint32_t len);
+    bool publish_rc_channels(msp_stream_packet_with_header_t* pwh);
+    void encode_rc_ack(msp_version_e msp_version, msp_stream_packet_with_header_t* pwh);
+    bool execute_queued_frame(msp_context_t& pg, MspFrameQueue& frame_queue);
+    void execute_command(msp_context_t& pg, const msp_const_packet_t& command, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh);
+#if !defined(NDEBUG)
+    void check_handler_flags(msp_context_t& pg, const msp_const_packet_t& command, uint8_t handler_flags);
+#endif
+    bool execute_library_command(const msp_const_packet_t& command, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh);
+    void execute_reliable_command(msp_context_t& pg, const msp_const_packet_t& command, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh);
+    void retransmit_frame(const uint8_t* frame, size_t len);
+    void execute_compressed_command(msp_context_t& pg, const msp_const_packet_t& command, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh);
+    bool start_coroutine(msp_context_t& pg, const msp_const_packet_t& command, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh);
+    void defer_reply(msp_context_t& pg, int16_t cmd, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh);
+    void encode_busy_reply(int16_t cmd_msp, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh);
+    void finish_coroutine(msp_context_t& pg, coroutine_slot_t& slot, msp_stream_packet_with_header_t* pwh);
+    void encode_reply(msp_packet_t& reply, msp_version_e msp_version, msp_stream_packet_with_header_t* pwh);
+    bool accept_payload(uint16_t cmd, uint16_t size);
+    void flush_payload();
+    void abort_payload_sink();
+    size_t put_payload(const uint8_t* data, size_t len);
 private:
     MspBase& _msp_base;
     MspSerial* _msp_serial {};
+    MspFrameQueue* _frame_queue {};
+    MspFrameQueue* _high_priority_frame_queue {};
+    MspSnapshot<msp_rc_channels_t>* _rc_channels {};
+    bool _suppress_rc_ack {};
+    // RC ACKs deferred to process_queued_frames(), each counter is written by only one task so no read-modify-write is needed
+    std::atomic<uint32_t> _rc_acks_requested {};
+    std::atomic<uint32_t> _rc_acks_sent {};
+    std::atomic<msp_version_e> _rc_ack_msp_version {};
+    MspReliableWindow* _reliable_window {};
+    uint8_t _reliable_flags {}; // flags for the reply to the reliable request being executed
+    MspCompressor* _compressor {};
+    bool _compress_reply {}; // the request being executed accepts a compressed reply
+    msp_reply_framing_e _reply_framing { MSP_REPLY_FRAMING_SAME };
+    std::atomic<uint8_t> _client_capabilities {};
     msp_pending_system_request_e _pending_request {};
     msp_stream_state_e _stream_state {};
     msp_packet_state_e _packet_state {};
@@ -183,6 +395,21 @@ private:
     uint8_t _cmd_flags {};
     uint8_t _checksum1 {};
     uint8_t _checksum2 {};
+    bool _resynchronizing {};
+    bool _resync_char_pending {};
+    uint8_t _resync_char {};
+    uint16_t _resync_len {};
+    uint32_t _frame_timeout_microseconds {}; // zero disables the frame timeout
+    uint32_t _last_char_time_microseconds {};
+    bool _timestamped {}; // in a timestamped put_char/put_buf, so _last_char_time_microseconds is current
+    uint32_t _expired_frame_count {};
+    uint32_t _discard_remaining {};
+    uint32_t _discarded_frame_count {};
+    uint16_t _discard_size_limit { MSP_STREAM_DISCARD_SIZE_LIMIT };
+    MspPayloadSink* _payload_sink {}; // non-null when the payload of the packet being received is being streamed
+    uint16_t _payload_flushed {}; // number of payload bytes written to the payload sink
+    std::array<coroutine_slot_t, COROUTINE_SLOT_COUNT> _coroutine_slots {};
+    std::array<MspPendingReply, PENDING_REPLY_COUNT> _pending_replies {};
     std::array<uint8_t, MSP_STREAM_INBUF_SIZE> _in_buf {};
     std::array<uint8_t, MSP_STREAM_OUTBUF_SIZE> _out_buf {};
 };
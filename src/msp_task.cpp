@@ -21,6 +21,7 @@
 #include "msp_serial.h"
 #include "msp_task.h"
 
+#include <algorithm>
 #include <cassert>
 
 #if defined(FRAMEWORK_USE_FREERTOS)
@@ -42,11 +43,62 @@
 MspTask::MspTask(uint32_t task_interval_microseconds, MspSerial& msp_serial, msp_context_t& context) :
     TaskBase(task_interval_microseconds),
     _task_interval_milliseconds(task_interval_microseconds/1000), // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    _fixed_interval_microseconds(task_interval_microseconds),
+    _current_interval_microseconds(task_interval_microseconds),
     _msp_serial(msp_serial),
     _context(context)
 {
 }
 
+void MspTask::set_interval(uint32_t task_interval_microseconds)
+{
+    _task_interval_microseconds = task_interval_microseconds;
+    _task_interval_milliseconds = task_interval_microseconds / 1000; // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    _current_interval_microseconds.store(task_interval_microseconds, std::memory_order_relaxed);
+}
+
+/*!
+Enables adaptive polling, the interval starts at max_interval_microseconds and shortens when input arrives.
+*/
+void MspTask::set_adaptive_interval(uint32_t min_interval_microseconds, uint32_t max_interval_microseconds)
+{
+    assert(min_interval_microseconds <= max_interval_microseconds);
+    _min_interval_microseconds = min_interval_microseconds;
+    _max_interval_microseconds = max_interval_microseconds;
+    set_interval(min_interval_microseconds == 0 ? _fixed_interval_microseconds : max_interval_microseconds);
+}
+
+/*!
+Drops to the minimum interval as soon as there is traffic, so that the replies to a burst of requests are not delayed,
+and backs off exponentially once the link has been idle for ADAPTIVE_HOLD_MICROSECONDS.
+*/
+uint32_t MspTask::update_adaptive_interval(uint32_t time_microseconds, bool input_received)
+{
+    if (_min_interval_microseconds == 0) {
+        return _task_interval_microseconds;
+    }
+    if (input_received) {
+        _last_input_time_microseconds = time_microseconds;
+        set_interval(_min_interval_microseconds);
+    } else if (time_microseconds - _last_input_time_microseconds >= ADAPTIVE_HOLD_MICROSECONDS) {
+        set_interval(_task_interval_microseconds > _max_interval_microseconds / 2 ? _max_interval_microseconds : _task_interval_microseconds * 2);
+    }
+    return _task_interval_microseconds;
+}
+
+void MspTask::tick()
+{
+    _msp_serial.process_input(_context);
+    if (_process_output) {
+        _msp_serial.process_output(_context);
+    }
+    if (_min_interval_microseconds != 0) {
+        const uint32_t rx_wire_bytes = _msp_serial.get_link_statistics().get_wire_bytes(MspLinkStatistics::RX);
+        update_adaptive_interval(time_us(), rx_wire_bytes != _rx_wire_bytes_previous);
+        _rx_wire_bytes_previous = rx_wire_bytes;
+    }
+}
+
 /*!
 loop() function for when not using FREERTOS
 */
@@ -57,7 +109,7 @@ void MspTask::loop()
 
     if (_tick_count_delta >= _task_interval_milliseconds) { // if _task_interval_microseconds has passed, then run the update
         _tick_count_previous = tick_count;
-        _msp_serial.process_input(_context);
+        tick();
     }
 }
 
@@ -68,11 +120,12 @@ Task function for the MSP. Sets up and runs the task loop() function.
 {
 #if defined(FRAMEWORK_USE_FREERTOS)
     // pdMS_TO_TICKS Converts a time in milliseconds to a time in ticks.
-    const uint32_t task_interval_ticks = pdMS_TO_TICKS(_task_interval_microseconds / 1000);
-    assert(task_interval_ticks > 0 && "MSP task_interval_ticks is zero.");
+    assert((_min_interval_microseconds != 0 || pdMS_TO_TICKS(_task_interval_microseconds / 1000) > 0) && "MSP task_interval_ticks is zero.");
 
     _previous_wake_time_ticks = xTaskGetTickCount();
     while (true) {
+        // recalculated each time round the loop, since an adaptive interval changes on each tick, and is at least one tick
+        const TickType_t task_interval_ticks = std::max(static_cast<TickType_t>(1), static_cast<TickType_t>(pdMS_TO_TICKS(_task_interval_microseconds / 1000)));
         // delay until the end of the next task_interval_ticks
 #if (tskKERNEL_VERSION_MAJOR > 10) || ((tskKERNEL_VERSION_MAJOR == 10) && (tskKERNEL_VERSION_MINOR >= 5))
             const BaseType_t was_delayed = xTaskDelayUntil(&_previous_wake_time_ticks, task_interval_ticks);
@@ -88,7 +141,7 @@ Task function for the MSP. Sets up and runs the task loop() function.
         _tick_count_previous = tick_count;
 
         if (_tick_count_delta > 0) { // guard against the case of this while loop executing twice on the same tick interval
-            _msp_serial.process_input(_context);
+            tick();
         }
     }
 #else
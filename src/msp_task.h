@@ -20,6 +20,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <task_base.h>
 
 class MspSerial;
@@ -28,6 +29,13 @@ struct msp_context_t;
 
 
 class MspTask : public TaskBase {
+public:
+    // time without input after which an adaptive interval starts to back off
+#if defined(MSP_TASK_ADAPTIVE_HOLD_MICROSECONDS)
+    static constexpr uint32_t ADAPTIVE_HOLD_MICROSECONDS = MSP_TASK_ADAPTIVE_HOLD_MICROSECONDS;
+#else
+    static constexpr uint32_t ADAPTIVE_HOLD_MICROSECONDS = 100000;
+#endif
 public:
     MspTask(uint32_t task_interval_microseconds, MspSerial& msp_serial, msp_context_t& context);
 public:
@@ -42,10 +50,29 @@ private:
 public:
     [[noreturn]] static void task_static(void* arg);
     void loop();
+    // set to false if MspSerial::process_output() is called from another task, eg to execute commands from a frame queue on the other core
+    void set_process_output(bool process_output) { _process_output = process_output; }
+    // adaptive polling: the interval drops to min_interval_microseconds whenever input is received and, once there has been no input
+    // for ADAPTIVE_HOLD_MICROSECONDS, doubles on each tick up to max_interval_microseconds
+    // setting min_interval_microseconds to zero restores the fixed interval the task was created with
+    void set_adaptive_interval(uint32_t min_interval_microseconds, uint32_t max_interval_microseconds);
+    // may be called from any task, task_info_t::task_interval_microseconds remains the interval the task was created with
+    uint32_t get_current_interval_microseconds() const { return _current_interval_microseconds.load(std::memory_order_relaxed); }
+    // called after each tick, returns the interval until the next tick
+    uint32_t update_adaptive_interval(uint32_t time_microseconds, bool input_received);
 private:
     [[noreturn]] void task();
+    void tick();
+    void set_interval(uint32_t task_interval_microseconds);
 private:
     uint32_t _task_interval_milliseconds;
+    const uint32_t _fixed_interval_microseconds;
+    uint32_t _min_interval_microseconds {};
+    uint32_t _max_interval_microseconds {};
+    uint32_t _last_input_time_microseconds {};
+    uint32_t _rx_wire_bytes_previous {};
+    std::atomic<uint32_t> _current_interval_microseconds; // copy of _task_interval_microseconds, for reading from other tasks
     MspSerial& _msp_serial;
     msp_context_t& _context;
+    bool _process_output { true };
 };
@@ -0,0 +1,72 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "msp_tx_notification.h"
+
+#include <time_microseconds.h>
+
+
+MspTxNotification::MspTxNotification()
+{
+#if defined(FRAMEWORK_USE_FREERTOS)
+    _semaphore = xSemaphoreCreateBinaryStatic(&_semaphore_buffer);
+#endif
+}
+
+void MspTxNotification::prepare_wait(size_t space_required)
+{
+#if defined(FRAMEWORK_USE_FREERTOS)
+    xSemaphoreTake(_semaphore, 0); // clear any stale notification
+#endif
+    _notified.store(false, std::memory_order_relaxed);
+    _space_required.store(space_required == 0 ? 1 : space_required, std::memory_order_release);
+}
+
+bool MspTxNotification::wait(uint32_t timeout_us)
+{
+#if defined(FRAMEWORK_USE_FREERTOS)
+    const TickType_t timeout_ticks = pdMS_TO_TICKS((timeout_us + 999) / 1000); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    const bool notified = xSemaphoreTake(_semaphore, timeout_ticks == 0 ? 1 : timeout_ticks) == pdTRUE;
+#else
+    const uint32_t start_us = time_us();
+    while (!_notified.load(std::memory_order_acquire) && time_us() - start_us < timeout_us) {}
+    const bool notified = _notified.load(std::memory_order_acquire);
+#endif
+    _space_required.store(0, std::memory_order_relaxed);
+    return notified;
+}
+
+/*!
+Called from the UART transmit interrupt handler.
+*/
+void MspTxNotification::notify_from_isr(size_t space_available)
+{
+    const size_t space_required = _space_required.load(std::memory_order_acquire);
+    if (space_required == 0 || space_available < space_required) {
+        return;
+    }
+    _space_required.store(0, std::memory_order_relaxed);
+    _notified.store(true, std::memory_order_release);
+#if defined(FRAMEWORK_USE_FREERTOS)
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    xSemaphoreGiveFromISR(_semaphore, &higher_priority_task_woken);
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+#endif
+}
@@ -0,0 +1,68 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(FRAMEWORK_USE_FREERTOS)
+#if defined(FRAMEWORK_ESPIDF) || defined(FRAMEWORK_ARDUINO_ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#else
+#if defined(FRAMEWORK_ARDUINO_STM32)
+#include <STM32FreeRTOS.h>
+#endif
+#include <FreeRTOS.h>
+#include <semphr.h>
+#endif
+#endif
+
+
+/*!
+Lets a task sending MSP frames sleep until the UART transmit interrupt signals that there is space in the transmit buffer,
+rather than polling MspSerialPortBase::available_for_write().
+
+For use in implementations of MspSerialPortBase::wait_for_write_space():
+the port calls prepare_wait() with the space required, enables its transmit interrupt, and then calls wait().
+The transmit interrupt handler calls notify_from_isr() with the space now available, which wakes the waiting task once there is enough.
+Waiting for the transmit buffer to drain is waiting for space equal to the size of the buffer.
+
+Under FreeRTOS the waiting task blocks on a binary semaphore, rather than a task notification,
+so it does not consume any of the task's notification values. Otherwise wait() spins on a flag.
+*/
+class MspTxNotification {
+public:
+    MspTxNotification();
+    void prepare_wait(size_t space_required);
+    // returns false if the timeout expired before notify_from_isr() signalled enough space
+    bool wait(uint32_t timeout_us);
+    void notify_from_isr(size_t space_available);
+    bool is_waiting() const { return _space_required.load(std::memory_order_relaxed) != 0; }
+private:
+#if defined(FRAMEWORK_USE_FREERTOS)
+    StaticSemaphore_t _semaphore_buffer {};
+    SemaphoreHandle_t _semaphore {};
+#endif
+    std::atomic<size_t> _space_required {}; // zero when no task is waiting
+    std::atomic<bool> _notified {};
+};
@@ -0,0 +1,189 @@
+#include <msp_protocol.h>
+#include <msp_stream.h>
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include <unity.h>
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+struct msp_context_t {
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,cppcoreguidelines-pro-bounds-pointer-arithmetic,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+class MspTest : public MspBase {
+public:
+    virtual msp_result_e process_read_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src) override;
+public:
+    size_t _set_name_count {};
+};
+
+msp_result_e MspTest::process_read_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src)
+{
+    (void)pg;
+    (void)src;
+
+    if (cmd_msp == MSP_SET_NAME) {
+        ++_set_name_count;
+        return MSP_RESULT_ACK;
+    }
+    return MSP_RESULT_ERROR;
+}
+
+static uint8_t pseudo_random_byte(uint32_t& seed)
+{
+    seed = seed * 1664525U + 1013904223U;
+    return static_cast<uint8_t>(seed >> 24U);
+}
+
+// noise that is biased towards the characters that drive the state machine
+static uint8_t adversarial_byte(uint32_t& seed)
+{
+    static constexpr std::array<uint8_t, 6> header_chars = { '$', 'M', 'X', '<', '>', 0xFF };
+    const uint8_t r = pseudo_random_byte(seed);
+    return (r & 0x03U) == 0 ? header_chars[pseudo_random_byte(seed) % header_chars.size()] : pseudo_random_byte(seed);
+}
+
+static constexpr std::array<uint8_t, 12> set_name_frame = {
+    '$', 'M', '<', 6, MSP_SET_NAME, 'M', 'y', 'N', 'a', 'm', 'e', 30
+};
+
+void test_msp_v2_native_oversize_is_discarded()
+{
+    static MspTest msp;
+    static MspStream msp_stream(msp);
+    static msp_context_t pg;
+
+    msp_stream.set_packet_state(MSP_IDLE);
+    msp_stream.set_discard_size_limit(0xFFFF);
+
+    // MSPv2 native header declaring a 65535 byte payload
+    std::vector<uint8_t> in_stream = { '$', 'X', '<', 0, MSP_API_VERSION, 0, 0xFF, 0xFF };
+    uint32_t seed = 11;
+    for (size_t ii = 0; ii < 0xFFFF + 1; ++ii) { // payload and checksum
+        in_stream.push_back(pseudo_random_byte(seed));
+    }
+    in_stream.insert(in_stream.end(), set_name_frame.begin(), set_name_frame.end());
+
+    // per-character ingestion: the state machine must never overrun _in_buf
+    for (uint8_t c : in_stream) {
+        msp_stream.put_char(pg, c, nullptr);
+        TEST_ASSERT_TRUE(msp_stream.get_data_size() <= MspStream::MSP_STREAM_INBUF_SIZE);
+    }
+    TEST_ASSERT_EQUAL(1, msp_stream.get_discarded_frame_count());
+    TEST_ASSERT_EQUAL(1, msp._set_name_count);
+    TEST_ASSERT_EQUAL(MSP_IDLE, msp_stream.get_packet_state());
+
+    // bulk ingestion skips the discarded payload in one step
+    const size_t count = msp_stream.put_buf(pg, &in_stream[0], in_stream.size());
+    TEST_ASSERT_EQUAL(1, count);
+    TEST_ASSERT_EQUAL(2, msp_stream.get_discarded_frame_count());
+    TEST_ASSERT_EQUAL(2, msp._set_name_count);
+}
+
+void test_msp_v2_native_over_limit_is_aborted()
+{
+    static MspTest msp;
+    static MspStream msp_stream(msp);
+    static msp_context_t pg;
+
+    msp_stream.set_packet_state(MSP_IDLE);
+
+    // with the default discard size limit, a header claiming a 65535 byte payload is treated as noise
+    std::vector<uint8_t> in_stream = { '$', 'X', '<', 0, MSP_API_VERSION, 0, 0xFF, 0xFF };
+    in_stream.insert(in_stream.end(), set_name_frame.begin(), set_name_frame.end());
+
+    const size_t count = msp_stream.put_buf(pg, &in_stream[0], in_stream.size());
+    TEST_ASSERT_EQUAL(1, count);
+    TEST_ASSERT_EQUAL(0, msp_stream.get_discarded_frame_count());
+    TEST_ASSERT_EQUAL(1, msp._set_name_count);
+}
+
+void test_msp_v1_oversize_is_discarded()
+{
+    static MspTest msp;
+    static MspStream msp_stream(msp);
+    static msp_context_t pg;
+
+    msp_stream.set_packet_state(MSP_IDLE);
+
+    std::vector<uint8_t> in_stream = { '$', 'M', '<', 250, MSP_API_VERSION };
+    in_stream.insert(in_stream.end(), 251, 'M'); // payload and checksum, all of which look like frame starts
+    in_stream.insert(in_stream.end(), set_name_frame.begin(), set_name_frame.end());
+
+    const size_t count = msp_stream.put_buf(pg, &in_stream[0], in_stream.size());
+    TEST_ASSERT_EQUAL(1, count);
+    TEST_ASSERT_EQUAL(1, msp_stream.get_discarded_frame_count());
+    TEST_ASSERT_EQUAL(1, msp._set_name_count);
+}
+
+void test_msp_adversarial_input()
+{
+    static MspTest msp;
+    static MspStream msp_stream(msp);
+    static msp_context_t pg;
+
+    msp_stream.set_packet_state(MSP_IDLE);
+    msp_stream.set_frame_timeout_microseconds(1000);
+
+    enum { CHUNK_SIZE = 64, CHUNK_COUNT = 16384 };
+    std::vector<uint8_t> in_stream(static_cast<size_t>(CHUNK_SIZE) * CHUNK_COUNT);
+    uint32_t seed = 0x1234;
+    for (auto& c : in_stream) {
+        c = adversarial_byte(seed);
+    }
+
+    // per-character ingestion checks the buffer bounds after every character
+    uint32_t time_microseconds = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint8_t c : in_stream) {
+        msp_stream.put_char(pg, c, nullptr, time_microseconds++);
+        TEST_ASSERT_TRUE(msp_stream.get_data_size() <= MspStream::MSP_STREAM_INBUF_SIZE);
+    }
+    auto stop = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(stop - start).count();
+
+    std::array<char, 128> message {};
+    std::snprintf(&message[0], message.size(), "put_char: %zu bytes in %.3f ms, %.1f MB/s",
+        in_stream.size(), seconds * 1000.0, static_cast<double>(in_stream.size()) / seconds / 1.0e6);
+    TEST_MESSAGE(&message[0]);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t ii = 0; ii < in_stream.size(); ii += CHUNK_SIZE) {
+        msp_stream.put_buf(pg, &in_stream[ii], CHUNK_SIZE, time_microseconds);
+        time_microseconds += CHUNK_SIZE;
+    }
+    stop = std::chrono::steady_clock::now();
+    seconds = std::chrono::duration<double>(stop - start).count();
+
+    std::snprintf(&message[0], message.size(), "put_buf:  %zu bytes in %.3f ms, %.1f MB/s, %u discarded, %u expired",
+        in_stream.size(), seconds * 1000.0, static_cast<double>(in_stream.size()) / seconds / 1.0e6,
+        static_cast<unsigned>(msp_stream.get_discarded_frame_count()), static_cast<unsigned>(msp_stream.get_expired_frame_count()));
+    TEST_MESSAGE(&message[0]);
+
+    // after a gap longer than the frame timeout the parser has recovered, whatever state the noise left it in
+    const size_t set_name_count = msp._set_name_count;
+    time_microseconds += 1000000;
+    const size_t count = msp_stream.put_buf(pg, &set_name_frame[0], set_name_frame.size(), time_microseconds);
+    TEST_ASSERT_EQUAL(1, count);
+    TEST_ASSERT_EQUAL(set_name_count + 1, msp._set_name_count);
+}
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,cppcoreguidelines-pro-bounds-pointer-arithmetic,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_msp_v2_native_oversize_is_discarded);
+    RUN_TEST(test_msp_v2_native_over_limit_is_aborted);
+    RUN_TEST(test_msp_v1_oversize_is_discarded);
+    RUN_TEST(test_msp_adversarial_input);
+
+    UNITY_END();
+}
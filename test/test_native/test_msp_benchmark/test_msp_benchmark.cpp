@@ -0,0 +1,408 @@
+#include <msp_base_static.h>
+#include <msp_compressor.h>
+#include <msp_frame_queue.h>
+#include <msp_protocol.h>
+#include <msp_serial.h>
+#include <msp_serial_port_base.h>
+#include <msp_serial_static.h>
+#include <msp_stream.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unity.h>
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+struct msp_context_t {
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+
+/*
+Latency benchmark, run on a virtual clock so results are repeatable.
+
+Each cycle a ground station sends three bulk requests (MSP_DATAFLASH_READ, each with a 400 byte reply) and, at some random point
+while the replies are being transmitted, an MSP_SET_RAW_RC. The latency of the MSP_SET_RAW_RC is the time from its arrival to its execution.
+*/
+struct latency_t {
+    uint64_t max_us;
+    uint64_t total_us;
+    uint32_t count;
+};
+
+struct benchmark_t {
+    uint64_t clock_us {};
+    uint64_t rc_arrival_us {};
+    bool rc_scheduled {};
+    MspStream* msp_stream {};
+    msp_context_t* pg {};
+    latency_t latency {};
+};
+
+static benchmark_t benchmark;
+
+static constexpr std::array<uint8_t, 6> dataflash_read_frame = { '$', 'M', '<', 0, MSP_DATAFLASH_READ, MSP_DATAFLASH_READ };
+static constexpr std::array<uint8_t, 6> raw_rc_frame = { '$', 'M', '<', 0, MSP_SET_RAW_RC, MSP_SET_RAW_RC };
+
+static void deliver_rc_if_due()
+{
+    if (benchmark.rc_scheduled && benchmark.clock_us >= benchmark.rc_arrival_us) {
+        benchmark.rc_scheduled = false;
+        benchmark.msp_stream->put_buf(*benchmark.pg, &raw_rc_frame[0], raw_rc_frame.size());
+    }
+}
+
+class MspBenchmark : public MspBase {
+public:
+    virtual msp_result_e process_write_command(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src) override;
+    virtual msp_result_e process_read_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src) override;
+};
+
+msp_result_e MspBenchmark::process_write_command(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src)
+{
+    (void)pg;
+    (void)src;
+
+    if (cmd_msp == MSP_DATAFLASH_READ) {
+        for (size_t ii = 0; ii < 400; ++ii) {
+            dst.write_u8(static_cast<uint8_t>(ii));
+        }
+        return MSP_RESULT_ACK;
+    }
+    return MSP_RESULT_CMD_UNKNOWN;
+}
+
+msp_result_e MspBenchmark::process_read_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src)
+{
+    (void)pg;
+    (void)src;
+
+    if (cmd_msp == MSP_SET_RAW_RC) {
+        const uint64_t latency_us = benchmark.clock_us - benchmark.rc_arrival_us;
+        benchmark.latency.max_us = std::max(benchmark.latency.max_us, latency_us);
+        benchmark.latency.total_us += latency_us;
+        ++benchmark.latency.count;
+        return MSP_RESULT_ACK;
+    }
+    return MSP_RESULT_ERROR;
+}
+
+// serial port that advances the virtual clock by the time taken to transmit what is written to it
+class MspSerialPortBaud : public MspSerialPortBase
+{
+public:
+    static constexpr uint64_t BAUD_RATE = 115200;
+    static constexpr uint64_t BITS_PER_BYTE = 10;
+public:
+    bool is_data_available() const override { return false; }
+    uint8_t read_byte() override { return 0; }
+    size_t available_for_write() const override { return 64; }
+    size_t write(const uint8_t* buf, size_t len) override {
+        (void)buf;
+        benchmark.clock_us += len * BITS_PER_BYTE * 1000000 / BAUD_RATE;
+        // the parser runs concurrently with transmission, so the RC frame may arrive while a reply is being sent
+        deliver_rc_if_due();
+        return len;
+    }
+};
+
+// bulk replies have a jumbo frame header
+static constexpr uint64_t BULK_REPLY_US = (7 + 400 + 1) * MspSerialPortBaud::BITS_PER_BYTE * 1000000 / MspSerialPortBaud::BAUD_RATE;
+
+static latency_t run_benchmark(MspStream& msp_stream, MspSerial& msp_serial, msp_context_t& pg)
+{
+    benchmark = benchmark_t {};
+    benchmark.msp_stream = &msp_stream;
+    benchmark.pg = &pg;
+
+    enum { CYCLE_COUNT = 1000 };
+    uint32_t seed = 17;
+    for (size_t ii = 0; ii < CYCLE_COUNT; ++ii) {
+        for (size_t jj = 0; jj < 3; ++jj) {
+            msp_stream.put_buf(pg, &dataflash_read_frame[0], dataflash_read_frame.size());
+        }
+        seed = seed * 1664525U + 1013904223U;
+        benchmark.rc_arrival_us = benchmark.clock_us + (seed >> 8U) % (3 * BULK_REPLY_US);
+        benchmark.rc_scheduled = true;
+        msp_serial.process_output(pg);
+        // if the RC frame arrives after the bulk replies have been sent, then the link is idle until it arrives
+        benchmark.clock_us = std::max(benchmark.clock_us, benchmark.rc_arrival_us);
+        deliver_rc_if_due();
+        msp_serial.process_output(pg);
+    }
+    TEST_ASSERT_EQUAL(CYCLE_COUNT, benchmark.latency.count);
+    return benchmark.latency;
+}
+
+static void report(const char* name, const latency_t& latency)
+{
+    std::array<char, 128> message {};
+    std::snprintf(&message[0], message.size(), "%s: MSP_SET_RAW_RC latency max %.1f ms, mean %.1f ms",
+        name, static_cast<double>(latency.max_us) / 1000.0, static_cast<double>(latency.total_us) / latency.count / 1000.0);
+    TEST_MESSAGE(&message[0]);
+}
+
+void test_msp_benchmark_priority_latency()
+{
+    static MspBenchmark msp;
+    static msp_context_t pg;
+
+    static MspStream msp_stream_fifo(msp);
+    static MspSerialPortBaud msp_serial_port_fifo;
+    static MspSerial msp_serial_fifo(msp_stream_fifo, msp_serial_port_fifo);
+    static MspFrameQueue frame_queue_fifo;
+    msp_stream_fifo.set_frame_queue(&frame_queue_fifo);
+    const latency_t fifo = run_benchmark(msp_stream_fifo, msp_serial_fifo, pg);
+    report("single lane", fifo);
+
+    static MspStream msp_stream_priority(msp);
+    static MspSerialPortBaud msp_serial_port_priority;
+    static MspSerial msp_serial_priority(msp_stream_priority, msp_serial_port_priority);
+    static MspFrameQueue frame_queue;
+    static MspFrameQueue high_priority_frame_queue;
+    msp_stream_priority.set_frame_queue(&frame_queue, &high_priority_frame_queue);
+    const latency_t priority = run_benchmark(msp_stream_priority, msp_serial_priority, pg);
+    report("priority lanes", priority);
+
+    // with priority lanes the RC frame waits for at most the bulk reply that is being sent when it arrives
+    TEST_ASSERT_TRUE(priority.max_us <= BULK_REPLY_US);
+    TEST_ASSERT_TRUE(priority.max_us < fifo.max_us);
+    TEST_ASSERT_TRUE(priority.total_us < fifo.total_us);
+}
+
+/*
+Dispatch benchmark, comparing virtual dispatch (MspSerialPortBase, MspSerial, MspBase) with static dispatch (MspSerialStatic, MspBaseStatic).
+The input is a stream of MSP_SET_RAW_RC frames, each with 8 channels, read from memory a byte at a time.
+*/
+struct dispatch_t {
+    const uint8_t* data;
+    size_t len;
+    size_t pos;
+    size_t written;
+    uint32_t channel_sum;
+    uint32_t frame_count;
+};
+
+static dispatch_t dispatch;
+
+static msp_result_e process_raw_rc(int16_t cmd_msp, StreamBufReader& src)
+{
+    if (cmd_msp != MSP_SET_RAW_RC) {
+        return MSP_RESULT_ERROR;
+    }
+    while (src.bytes_remaining() > 0) {
+        dispatch.channel_sum += src.read_u8();
+    }
+    ++dispatch.frame_count;
+    return MSP_RESULT_ACK;
+}
+
+class MspSerialPortMemory : public MspSerialPortBase {
+public:
+    bool is_data_available() const override { return dispatch.pos < dispatch.len; }
+    uint8_t read_byte() override { return dispatch.data[dispatch.pos++]; } // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    size_t available_for_write() const override { return 256; }
+    size_t write(const uint8_t* buf, size_t len) override { (void)buf; dispatch.written += len; return len; }
+};
+
+class MspSerialPortMemoryStatic {
+public:
+    bool is_data_available() const { return dispatch.pos < dispatch.len; }
+    uint8_t read_byte() { return dispatch.data[dispatch.pos++]; } // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    size_t available_for_write() const { return 256; }
+    size_t write(const uint8_t* buf, size_t len) { (void)buf; dispatch.written += len; return len; }
+};
+static_assert(msp_serial_port_c<MspSerialPortMemory>);
+static_assert(msp_serial_port_c<MspSerialPortMemoryStatic>);
+
+class MspDispatch : public MspBase {
+public:
+    msp_result_e process_read_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src) override { (void)pg; return process_raw_rc(cmd_msp, src); }
+};
+
+class MspDispatchStatic final : public MspBaseStatic<MspDispatchStatic> {
+public:
+    msp_result_e process_read_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src) override { (void)pg; return process_raw_rc(cmd_msp, src); }
+};
+static_assert(msp_command_handler_c<MspDispatchStatic>);
+
+static double run_dispatch_benchmark(MspSerial& msp_serial, msp_context_t& pg, const std::vector<uint8_t>& input, uint32_t frame_count)
+{
+    double best_seconds = 1.0e9;
+    for (size_t run = 0; run < 10; ++run) {
+        dispatch = dispatch_t { .data = &input[0], .len = input.size(), .pos = 0, .written = 0, .channel_sum = 0, .frame_count = 0 };
+        const auto start = std::chrono::steady_clock::now();
+        msp_serial.process_input(pg);
+        const auto stop = std::chrono::steady_clock::now();
+        best_seconds = std::min(best_seconds, std::chrono::duration<double>(stop - start).count());
+        TEST_ASSERT_EQUAL(frame_count, dispatch.frame_count);
+        TEST_ASSERT_EQUAL(frame_count * 6, dispatch.written); // ACK replies
+    }
+    return best_seconds * 1.0e9 / frame_count;
+}
+
+void test_msp_benchmark_static_dispatch()
+{
+    static msp_context_t pg;
+
+    enum { FRAME_COUNT = 50000 };
+    std::vector<uint8_t> input;
+    uint32_t seed = 23;
+    for (size_t ii = 0; ii < FRAME_COUNT; ++ii) {
+        const std::array<uint8_t, 5> header = { '$', 'M', '<', 16, MSP_SET_RAW_RC };
+        for (uint8_t c : header) {
+            input.push_back(c);
+        }
+        uint8_t checksum = 16 ^ MSP_SET_RAW_RC;
+        for (size_t jj = 0; jj < 16; ++jj) {
+            seed = seed * 1664525U + 1013904223U;
+            const auto c = static_cast<uint8_t>(seed >> 24U);
+            input.push_back(c);
+            checksum ^= c;
+        }
+        input.push_back(checksum);
+    }
+
+    static MspDispatch msp;
+    static MspStream msp_stream(msp);
+    static MspSerialPortMemory msp_serial_port;
+    static MspSerial msp_serial(msp_stream, msp_serial_port);
+    const double virtual_ns = run_dispatch_benchmark(msp_serial, pg, input, FRAME_COUNT);
+    const uint32_t channel_sum = dispatch.channel_sum;
+
+    static MspDispatchStatic msp_static;
+    static MspStream msp_stream_static(msp_static);
+    static MspSerialPortMemoryStatic msp_serial_port_static;
+    static MspSerialStatic<MspSerialPortMemoryStatic> msp_serial_static(msp_stream_static, msp_serial_port_static);
+    const double static_ns = run_dispatch_benchmark(msp_serial_static, pg, input, FRAME_COUNT);
+    TEST_ASSERT_EQUAL(channel_sum, dispatch.channel_sum);
+
+    std::array<char, 128> message {};
+    std::snprintf(&message[0], message.size(), "22 byte MSP_SET_RAW_RC frame: virtual dispatch %.1f ns/frame, static dispatch %.1f ns/frame", virtual_ns, static_ns);
+    TEST_MESSAGE(&message[0]);
+}
+/*
+Compression benchmark, comparing the effective throughput of large replies sent compressed and uncompressed.
+
+Effective throughput is payload bytes delivered per second, allowing for the wire time at the given baud rate and, when compressed,
+the time taken to compress and decompress. The CPU time is measured on the host, so the break-even figure, the compression and
+decompression time per payload byte at which compression stops paying for itself, is given to allow comparison with slower targets.
+*/
+struct compression_sample_t {
+    const char* name;
+    std::vector<uint8_t> payload;
+};
+
+static std::vector<compression_sample_t> compression_samples()
+{
+    std::vector<compression_sample_t> samples;
+
+    const std::string box_names =
+        "ARM;ANGLE;HORIZON;HEADFREE;FAILSAFE;BEEPER;OSD DISABLE;TELEMETRY;BLACKBOX;AIRMODE;ANTI GRAVITY;"
+        "VTX PIT MODE;PARALYZE;USER1;USER2;USER3;USER4;PID AUDIO;BEEPER MUTE;CAMERA CONTROL 1;CAMERA CONTROL 2;"
+        "CAMERA CONTROL 3;FLIP OVER AFTER CRASH;PREARM;BEEP GPS SATELLITE COUNT;LAP TIMER RESET;MSP OVERRIDE;STICK COMMANDS DISABLE;";
+    samples.push_back({ "MSP_BOXNAMES", std::vector<uint8_t>(box_names.begin(), box_names.end()) });
+
+    // four OSD font characters, mostly transparent
+    std::vector<uint8_t> osd_chars;
+    for (size_t ch = 0; ch < 4; ++ch) {
+        for (size_t row = 0; row < 18; ++row) {
+            const uint8_t pixels = (row > 3 && row < 14) ? static_cast<uint8_t>(0x55 ^ (ch << 4U) ^ (row & 0x03U)) : 0xAA;
+            osd_chars.insert(osd_chars.end(), { 0x55, pixels, 0x55 });
+        }
+        osd_chars.insert(osd_chars.end(), 10, 0x55);
+    }
+    samples.push_back({ "MSP_OSD_CHAR_READ", osd_chars });
+
+    // blackbox log: P frames of small, mostly repeated, deltas
+    std::vector<uint8_t> blackbox;
+    uint32_t seed = 29;
+    while (blackbox.size() < 400) {
+        blackbox.push_back('P');
+        for (size_t field = 0; field < 16; ++field) {
+            seed = seed * 1664525U + 1013904223U;
+            blackbox.push_back((seed >> 28U) == 0 ? static_cast<uint8_t>(seed >> 20U) : static_cast<uint8_t>(field & 0x03U));
+        }
+    }
+    samples.push_back({ "MSP_DATAFLASH_READ", blackbox });
+
+    std::vector<uint8_t> random;
+    for (size_t ii = 0; ii < 400; ++ii) {
+        seed = seed * 1664525U + 1013904223U;
+        random.push_back(static_cast<uint8_t>(seed >> 24U));
+    }
+    samples.push_back({ "random", random });
+
+    return samples;
+}
+
+void test_msp_benchmark_compression()
+{
+    static MspCompressor compressor;
+    static constexpr std::array<uint32_t, 4> baud_rates = { 115200, 460800, 921600, 2000000 };
+    static constexpr double FRAME_OVERHEAD = 9; // MSPv2 native header and checksum
+    static constexpr double BITS_PER_BYTE = 10;
+
+    std::array<char, 160> message {};
+    for (const auto& sample : compression_samples()) {
+        const std::vector<uint8_t>& payload = sample.payload;
+        static constexpr size_t RUN_COUNT = 2000;
+
+        size_t compressed_len = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t run = 0; run < RUN_COUNT; ++run) {
+            compressed_len = compressor.compress(&payload[0], payload.size());
+        }
+        auto stop = std::chrono::steady_clock::now();
+        const double compress_us = std::chrono::duration<double, std::micro>(stop - start).count() / RUN_COUNT;
+
+        double decompress_us = 0.0;
+        if (compressed_len > 0) {
+            const std::vector<uint8_t> compressed(compressor.get_buf(), compressor.get_buf() + compressed_len);
+            start = std::chrono::steady_clock::now();
+            for (size_t run = 0; run < RUN_COUNT; ++run) {
+                TEST_ASSERT_EQUAL(payload.size(), compressor.decompress(&compressed[0], compressed.size()));
+            }
+            stop = std::chrono::steady_clock::now();
+            decompress_us = std::chrono::duration<double, std::micro>(stop - start).count() / RUN_COUNT;
+            TEST_ASSERT_EQUAL_UINT8_ARRAY(&payload[0], compressor.get_buf(), payload.size());
+        }
+        // incompressible replies are sent uncompressed, having paid for the attempt
+        const size_t sent_len = compressed_len > 0 ? compressed_len : payload.size();
+        const auto len = static_cast<double>(payload.size());
+
+        std::snprintf(&message[0], message.size(), "%s: %zu bytes compressed to %zu, compress %.1f ns/byte, decompress %.1f ns/byte",
+            sample.name, payload.size(), compressed_len, compress_us * 1000.0 / len, decompress_us * 1000.0 / len);
+        TEST_MESSAGE(&message[0]);
+        for (uint32_t baud_rate : baud_rates) {
+            const double raw_us = (len + FRAME_OVERHEAD) * BITS_PER_BYTE * 1.0e6 / baud_rate;
+            const double compressed_us = (static_cast<double>(sent_len) + FRAME_OVERHEAD) * BITS_PER_BYTE * 1.0e6 / baud_rate + compress_us + decompress_us;
+            const double break_even_ns = (len - static_cast<double>(sent_len)) * BITS_PER_BYTE * 1.0e9 / baud_rate / len;
+            std::snprintf(&message[0], message.size(), "    %7u baud: uncompressed %6.1f KB/s, compressed %6.1f KB/s, break-even %.0f ns/byte",
+                static_cast<unsigned>(baud_rate), len / raw_us * 1000.0, len / compressed_us * 1000.0, break_even_ns);
+            TEST_MESSAGE(&message[0]);
+            if (baud_rate == baud_rates[0] && sent_len < payload.size() / 2) {
+                TEST_ASSERT_TRUE(compressed_us < raw_us);
+            }
+        }
+    }
+}
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_msp_benchmark_priority_latency);
+    RUN_TEST(test_msp_benchmark_static_dispatch);
+    RUN_TEST(test_msp_benchmark_compression);
+
+    UNITY_END();
+}
@@ -0,0 +1,145 @@
+#include <msp_protocol.h>
+#include <msp_stream.h>
+
+#include <algorithm>
+
+#include <unity.h>
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+struct msp_context_t {
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-pro-bounds-constant-array-index,cppcoreguidelines-pro-bounds-pointer-arithmetic,misc-const-correctness,readability-magic-numbers)
+static uint8_t pseudo_random_byte(uint32_t& seed)
+{
+    seed = seed * 1664525U + 1013904223U;
+    return static_cast<uint8_t>(seed >> 24U);
+}
+
+void test_checksum_xor_matches_bytewise()
+{
+    // buffer is over-sized so that every alignment and length combination can be tested
+    alignas(16) std::array<uint8_t, 320> buf {};
+    uint32_t seed = 1;
+    for (auto& b : buf) {
+        b = pseudo_random_byte(seed);
+    }
+
+    for (size_t offset = 0; offset < 16; ++offset) {
+        for (size_t len = 0; len <= buf.size() - 16; ++len) {
+            const uint8_t expected = MspStream::checksum_xor_bytewise(0x5A, &buf[offset], len);
+            TEST_ASSERT_EQUAL(expected, MspStream::checksum_xor(0x5A, &buf[offset], len));
+        }
+    }
+}
+
+void test_crc8_dvb_s2_matches_crc8_calc()
+{
+    for (unsigned crc = 0; crc < 256; ++crc) {
+        for (unsigned a = 0; a < 256; ++a) {
+            TEST_ASSERT_EQUAL(MspStream::crc8_calc(static_cast<uint8_t>(crc), static_cast<uint8_t>(a), 0xD5), MspStream::crc8_dvb_s2(static_cast<uint8_t>(crc), static_cast<uint8_t>(a)));
+        }
+    }
+
+    std::array<uint8_t, 200> buf {};
+    uint32_t seed = 7;
+    for (auto& b : buf) {
+        b = pseudo_random_byte(seed);
+    }
+    TEST_ASSERT_EQUAL(MspStream::crc8_update(0, &buf[0], buf.size(), 0xD5), MspStream::crc8_dvb_s2_update(0, &buf[0], buf.size()));
+}
+
+void test_checksum_xor_crc8_dvb_s2_update()
+{
+    std::array<uint8_t, 257> buf {};
+    uint32_t seed = 3;
+    for (auto& b : buf) {
+        b = pseudo_random_byte(seed);
+    }
+
+    for (size_t len = 0; len <= buf.size(); ++len) {
+        uint8_t checksum = 0x11;
+        uint8_t crc = 0x22;
+        MspStream::checksum_xor_crc8_dvb_s2_update(checksum, crc, &buf[0], static_cast<uint32_t>(len));
+        TEST_ASSERT_EQUAL(MspStream::checksum_xor_bytewise(0x11, &buf[0], len), checksum);
+        TEST_ASSERT_EQUAL(MspStream::crc8_update(0x22, &buf[0], static_cast<uint32_t>(len), 0xD5), crc);
+    }
+}
+
+void test_serial_encode_v2_over_v1_checksums()
+{
+    static MspBase msp;
+    static MspStream msp_stream(msp);
+    static msp_context_t pg;
+
+    std::array<uint8_t, 40> payload {};
+    uint32_t seed = 5;
+    for (auto& b : payload) {
+        b = pseudo_random_byte(seed);
+    }
+
+    const msp_const_packet_t packet = {
+        .payload = StreamBufReader(&payload[0], payload.size()),
+        .cmd = MSP_API_VERSION,
+        .result = MSP_RESULT_ACK,
+        .flags = 0,
+        .direction = MspBase::DIRECTION_REPLY
+    };
+    const msp_stream_packet_with_header_t pwh = msp_stream.serial_encode(packet, MSP_V2_OVER_V1);
+    TEST_ASSERT_EQUAL(10, pwh.hdr_len);
+    TEST_ASSERT_EQUAL(2, pwh.crc_len);
+
+    // V2 CRC covers the V2 header and payload
+    uint8_t crc = MspStream::crc8_update(0, &pwh.hdr_buf[5], 5, 0xD5);
+    crc = MspStream::crc8_update(crc, &payload[0], payload.size(), 0xD5);
+    TEST_ASSERT_EQUAL(crc, pwh.crc_buf[0]);
+
+    // V1 checksum covers everything after the preamble, including the V2 CRC
+    uint8_t checksum = MspStream::checksum_xor_bytewise(0, &pwh.hdr_buf[3], pwh.hdr_len - 3);
+    checksum = MspStream::checksum_xor_bytewise(checksum, &payload[0], payload.size());
+    checksum = MspStream::checksum_xor_bytewise(checksum, &pwh.crc_buf[0], 1);
+    TEST_ASSERT_EQUAL(checksum, pwh.crc_buf[1]);
+
+    // and the receive state machine accepts the encoded frame
+    TEST_ASSERT_EQUAL('>', pwh.hdr_buf[2]);
+    msp_stream.set_packet_state(MSP_IDLE);
+    bool complete = false;
+    for (size_t ii = 0; ii < pwh.hdr_len; ++ii) {
+        complete = msp_stream.put_char(pg, pwh.hdr_buf[ii], nullptr);
+    }
+    for (uint8_t c : payload) {
+        complete = msp_stream.put_char(pg, c, nullptr);
+    }
+    TEST_ASSERT_FALSE(complete);
+    complete = msp_stream.put_char(pg, pwh.crc_buf[0], nullptr);
+    TEST_ASSERT_FALSE(complete);
+    complete = msp_stream.put_char(pg, pwh.crc_buf[1], nullptr);
+    TEST_ASSERT_TRUE(complete);
+
+    // as does the bulk receive, which checksums the payload in blocks
+    std::array<uint8_t, 10 + 40 + 2> frame {};
+    std::copy_n(pwh.hdr_buf.begin(), pwh.hdr_len, frame.begin());
+    std::copy(payload.begin(), payload.end(), frame.begin() + pwh.hdr_len);
+    std::copy_n(pwh.crc_buf.begin(), pwh.crc_len, frame.end() - 2);
+    TEST_ASSERT_EQUAL(1, msp_stream.put_buf(pg, &frame[0], frame.size()));
+    frame[20] ^= 0x80;
+    TEST_ASSERT_EQUAL(0, msp_stream.put_buf(pg, &frame[0], frame.size()));
+}
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-pro-bounds-constant-array-index,cppcoreguidelines-pro-bounds-pointer-arithmetic,misc-const-correctness,readability-magic-numbers)
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_checksum_xor_matches_bytewise);
+    RUN_TEST(test_crc8_dvb_s2_matches_crc8_calc);
+    RUN_TEST(test_checksum_xor_crc8_dvb_s2_update);
+    RUN_TEST(test_serial_encode_v2_over_v1_checksums);
+
+    UNITY_END();
+}
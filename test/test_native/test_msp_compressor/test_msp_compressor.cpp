@@ -0,0 +1,237 @@
+#include <msp_compressor.h>
+#include <msp_protocol.h>
+#include <msp_reliable_window.h>
+#include <msp_serial.h>
+#include <msp_serial_port_base.h>
+#include <msp_stream.h>
+
+#include <string>
+#include <vector>
+
+#include <unity.h>
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+struct msp_context_t {
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,cppcoreguidelines-pro-bounds-pointer-arithmetic,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+static const std::string box_names =
+    "ARM;ANGLE;HORIZON;HEADFREE;FAILSAFE;BEEPER;OSD DISABLE;TELEMETRY;BLACKBOX;AIRMODE;ANTI GRAVITY;"
+    "VTX PIT MODE;PARALYZE;USER1;USER2;USER3;USER4;PID AUDIO;BEEPER MUTE;CAMERA CONTROL 1;CAMERA CONTROL 2;"
+    "CAMERA CONTROL 3;FLIP OVER AFTER CRASH;PREARM;BEEP GPS SATELLITE COUNT;LAP TIMER RESET;MSP OVERRIDE;STICK COMMANDS DISABLE;";
+
+static uint8_t pseudo_random_byte(uint32_t& seed)
+{
+    seed = seed * 1664525U + 1013904223U;
+    return static_cast<uint8_t>(seed >> 24U);
+}
+
+// OSD font characters, 2 bits per pixel, mostly transparent with a few repeated rows
+static std::vector<uint8_t> osd_chars()
+{
+    std::vector<uint8_t> chars;
+    for (size_t ch = 0; ch < 4; ++ch) {
+        for (size_t row = 0; row < 18; ++row) {
+            const uint8_t pixels = (row > 3 && row < 14) ? static_cast<uint8_t>(0x55 ^ (ch << 4U) ^ (row & 0x03U)) : 0xAA;
+            chars.insert(chars.end(), { 0x55, pixels, 0x55 });
+        }
+        chars.insert(chars.end(), 10, 0x55); // padding to 64 bytes
+    }
+    return chars;
+}
+
+class MspTest : public MspBase {
+public:
+    virtual msp_result_e process_command(msp_context_t& pg, const msp_const_packet_t& command, msp_packet_t& reply) override {
+        _last_flags = command.flags;
+        return MspBase::process_command(pg, command, reply);
+    }
+    virtual msp_result_e process_write_command(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src) override {
+        (void)pg;
+        (void)src;
+        if (cmd_msp == MSP_OSD_CHAR_READ) {
+            const std::vector<uint8_t> chars = osd_chars();
+            dst.write_data(&chars[0], chars.size());
+            return MSP_RESULT_ACK;
+        }
+        if (cmd_msp == MSP_API_VERSION) {
+            dst.write_u8(0);
+            dst.write_u8(1);
+            dst.write_u8(46);
+            return MSP_RESULT_ACK;
+        }
+        return MSP_RESULT_CMD_UNKNOWN;
+    }
+    virtual void process_reply(msp_context_t& pg, const msp_packet_t& reply) override {
+        (void)pg;
+        StreamBufReader src(reply.payload);
+        _reply.assign(src.ptr(), src.ptr() + src.bytes_remaining());
+        _reply_flags = reply.flags;
+        ++_reply_count;
+    }
+public:
+    uint8_t _last_flags {};
+    std::vector<uint8_t> _reply;
+    uint8_t _reply_flags {};
+    size_t _reply_count {};
+};
+
+class MspSerialPortCapture : public MspSerialPortBase {
+public:
+    bool is_data_available() const override { return false; }
+    uint8_t read_byte() override { return 0; }
+    size_t available_for_write() const override { return 512; }
+    size_t write(const uint8_t* buf, size_t len) override {
+        _tx.insert(_tx.end(), buf, buf + len);
+        return len;
+    }
+public:
+    std::vector<uint8_t> _tx;
+};
+
+static std::vector<uint8_t> encode_v2(uint8_t flags, uint16_t cmd)
+{
+    std::vector<uint8_t> frame = { '$', 'X', '<', flags, static_cast<uint8_t>(cmd), static_cast<uint8_t>(cmd >> 8), 0, 0 };
+    frame.push_back(MspStream::crc8_dvb_s2_update(0, &frame[3], static_cast<uint32_t>(frame.size() - 3)));
+    return frame;
+}
+
+static void check_round_trip(MspCompressor& compressor, const std::vector<uint8_t>& data, bool compressible)
+{
+    const size_t compressed_len = compressor.compress(&data[0], data.size());
+    if (!compressible) {
+        TEST_ASSERT_EQUAL(0, compressed_len);
+        return;
+    }
+    TEST_ASSERT_TRUE(compressed_len > 0);
+    TEST_ASSERT_TRUE(compressed_len < data.size());
+    const std::vector<uint8_t> compressed(compressor.get_buf(), compressor.get_buf() + compressed_len);
+    TEST_ASSERT_EQUAL(data.size(), compressor.decompress(&compressed[0], compressed.size()));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(&data[0], compressor.get_buf(), data.size());
+}
+
+void test_compressor_round_trip()
+{
+    static MspCompressor compressor;
+
+    const std::vector<uint8_t> text(box_names.begin(), box_names.end());
+    check_round_trip(compressor, text, true);
+
+    // run of zeros, as in blank flash or an empty OSD character
+    check_round_trip(compressor, std::vector<uint8_t>(MspCompressor::BUFFER_SIZE, 0), true);
+
+    check_round_trip(compressor, osd_chars(), true);
+
+    // far matches, repeated more than NEAR_OFFSET_MAX bytes back
+    std::vector<uint8_t> far;
+    uint32_t seed = 3;
+    for (size_t ii = 0; ii < 200; ++ii) {
+        far.push_back(pseudo_random_byte(seed));
+    }
+    far.insert(far.end(), far.begin(), far.begin() + 200);
+    check_round_trip(compressor, far, true);
+
+    // random data does not compress, nor do replies below the threshold
+    std::vector<uint8_t> random;
+    for (size_t ii = 0; ii < 300; ++ii) {
+        random.push_back(pseudo_random_byte(seed));
+    }
+    check_round_trip(compressor, random, false);
+    check_round_trip(compressor, std::vector<uint8_t>(MspCompressor::COMPRESSION_THRESHOLD - 1, 0), false);
+    TEST_ASSERT_EQUAL(4, compressor.get_statistics().compressed);
+    TEST_ASSERT_EQUAL(1, compressor.get_statistics().not_compressed);
+
+    // corrupt data is rejected rather than overrunning the buffer
+    const std::array<uint8_t, 2> truncated_literals = { 0x05, 'A' };
+    TEST_ASSERT_EQUAL(MspCompressor::DECOMPRESS_ERROR, compressor.decompress(&truncated_literals[0], truncated_literals.size()));
+    const std::array<uint8_t, 4> offset_before_start = { 0x00, 'A', 0x80, 0x01 };
+    TEST_ASSERT_EQUAL(MspCompressor::DECOMPRESS_ERROR, compressor.decompress(&offset_before_start[0], offset_before_start.size()));
+    const std::array<uint8_t, 3> truncated_far_offset = { 0x00, 'A', 0x80 };
+    TEST_ASSERT_EQUAL(MspCompressor::DECOMPRESS_ERROR, compressor.decompress(&truncated_far_offset[0], truncated_far_offset.size()));
+    std::vector<uint8_t> too_long = { 0x00, 0x00 };
+    for (size_t ii = 0; ii < MspCompressor::BUFFER_SIZE / 130 + 1; ++ii) {
+        too_long.insert(too_long.end(), { 0xFF, 0x00 });
+    }
+    TEST_ASSERT_EQUAL(MspCompressor::DECOMPRESS_ERROR, compressor.decompress(&too_long[0], too_long.size()));
+    TEST_ASSERT_EQUAL(4, compressor.get_statistics().decompress_errors);
+}
+
+void test_compressed_replies()
+{
+    static MspTest msp;
+    static msp_context_t pg;
+    static MspStream msp_stream(msp);
+    static MspSerialPortCapture port;
+    static MspSerial msp_serial(msp_stream, port);
+    static MspCompressor compressor;
+    msp_stream.set_compressor(&compressor);
+
+    static MspTest msp_client;
+    static MspStream msp_stream_client(msp_client);
+    static MspCompressor compressor_client;
+    msp_stream_client.set_compressor(&compressor_client);
+
+    const std::vector<uint8_t> chars = osd_chars();
+
+    // a client that does not advertise compression gets the reply uncompressed
+    std::vector<uint8_t> request = encode_v2(0, MSP_OSD_CHAR_READ);
+    msp_stream.put_buf(pg, &request[0], request.size());
+    TEST_ASSERT_EQUAL(9 + chars.size(), port._tx.size());
+    TEST_ASSERT_EQUAL(0, port._tx[3]);
+    port._tx.clear();
+
+    // one that does gets it compressed, and decompresses it
+    request = encode_v2(MspCompressor::FLAG_COMPRESSED, MSP_OSD_CHAR_READ);
+    msp_stream.put_buf(pg, &request[0], request.size());
+    TEST_ASSERT_EQUAL(0, msp._last_flags); // the handler does not see the compression flag
+    TEST_ASSERT_EQUAL(MspCompressor::FLAG_COMPRESSED, port._tx[3]);
+    TEST_ASSERT_TRUE(port._tx.size() < 9 + chars.size());
+    TEST_ASSERT_TRUE(port._tx.size() - 9 <= MspStream::MSP_STREAM_INBUF_SIZE);
+    msp_stream_client.put_buf(pg, &port._tx[0], port._tx.size());
+    TEST_ASSERT_EQUAL(1, msp_client._reply_count);
+    TEST_ASSERT_EQUAL(0, msp_client._reply_flags);
+    TEST_ASSERT_EQUAL(chars.size(), msp_client._reply.size());
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(&chars[0], &msp_client._reply[0], chars.size());
+    port._tx.clear();
+
+    // short replies are sent uncompressed, even when the client accepts compression
+    request = encode_v2(MspCompressor::FLAG_COMPRESSED, MSP_API_VERSION);
+    msp_stream.put_buf(pg, &request[0], request.size());
+    TEST_ASSERT_EQUAL(9 + 3, port._tx.size());
+    TEST_ASSERT_EQUAL(0, port._tx[3]);
+    msp_stream_client.put_buf(pg, &port._tx[0], port._tx.size());
+    TEST_ASSERT_EQUAL(2, msp_client._reply_count);
+    TEST_ASSERT_EQUAL(3, msp_client._reply.size());
+    port._tx.clear();
+
+    // compression combines with reliable delivery, the retained reply is the compressed one
+    static MspReliableWindow reliable_window;
+    msp_stream.set_reliable_window(&reliable_window);
+    const uint8_t flags = MspReliableWindow::make_flags(3) | MspCompressor::FLAG_COMPRESSED;
+    request = encode_v2(flags, MSP_OSD_CHAR_READ);
+    msp_stream.put_buf(pg, &request[0], request.size());
+    TEST_ASSERT_EQUAL(flags, port._tx[3]);
+    TEST_ASSERT_EQUAL(1, reliable_window.get_retained_count());
+    msp_stream_client.put_buf(pg, &port._tx[0], port._tx.size());
+    TEST_ASSERT_EQUAL(3, msp_client._reply_count);
+    TEST_ASSERT_EQUAL(MspReliableWindow::make_flags(3), msp_client._reply_flags);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(&chars[0], &msp_client._reply[0], chars.size());
+    TEST_ASSERT_EQUAL(2, compressor.get_statistics().compressed);
+    TEST_ASSERT_EQUAL(2, compressor_client.get_statistics().decompressed);
+}
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,cppcoreguidelines-pro-bounds-pointer-arithmetic,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_compressor_round_trip);
+    RUN_TEST(test_compressed_replies);
+
+    UNITY_END();
+}
@@ -0,0 +1,188 @@
+#include <msp_coroutine.h>
+#include <msp_protocol.h>
+#include <msp_serial.h>
+#include <msp_serial_port_base.h>
+#include <msp_stream.h>
+
+#include <vector>
+
+#include <unity.h>
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+struct msp_context_t {
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-avoid-reference-coroutine-parameters,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+class MspCoroutineTest : public MspBase {
+public:
+    MspCoroutineTest() : MspBase(HANDLES_COROUTINE_COMMANDS) {}
+    virtual MspCoroutine process_command_coroutine(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src) override;
+    virtual bool is_coroutine_command(int16_t cmd_msp) const override { return cmd_msp == MSP_DATAFLASH_READ || cmd_msp == MSP_EEPROM_WRITE; }
+    virtual msp_result_e process_write_command(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src) override;
+    MspCoroutine dataflash_read(StreamBufWriter& dst, uint32_t address);
+    MspCoroutine eeprom_write();
+public:
+    bool _flash_ready {};
+    size_t _eeprom_write_count {};
+};
+
+MspCoroutine MspCoroutineTest::process_command_coroutine(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src)
+{
+    (void)pg;
+
+    switch (cmd_msp) {
+    case MSP_DATAFLASH_READ:
+        return dataflash_read(dst, src.read_u32()); // src is read before the coroutine first suspends
+    case MSP_EEPROM_WRITE:
+        return eeprom_write();
+    default:
+        return {};
+    }
+}
+
+// synchronous handler, which blocks the MSP task until the write completes
+msp_result_e MspCoroutineTest::process_write_command(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src)
+{
+    if (cmd_msp == MSP_EEPROM_WRITE) {
+        ++_eeprom_write_count;
+        return MSP_RESULT_ACK;
+    }
+    return MspBase::process_write_command(pg, cmd_msp, dst, src);
+}
+
+MspCoroutine MspCoroutineTest::dataflash_read(StreamBufWriter& dst, uint32_t address)
+{
+    co_await msp_wait_until([this]() { return _flash_ready; });
+    dst.write_u32(address);
+    dst.write_u8(0xA5);
+    co_return MSP_RESULT_ACK;
+}
+
+MspCoroutine MspCoroutineTest::eeprom_write()
+{
+    co_await msp_yield();
+    co_await msp_yield();
+    ++_eeprom_write_count;
+    co_return MSP_RESULT_ACK;
+}
+
+// serial port that captures everything written to it
+class MspSerialPortCapture : public MspSerialPortBase
+{
+public:
+    bool is_data_available() const override { return false; }
+    uint8_t read_byte() override { return 0; }
+    size_t available_for_write() const override { return 64; }
+    size_t write(const uint8_t* buf, size_t len) override {
+        _out.insert(_out.end(), buf, buf + len); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        return len;
+    }
+public:
+    std::vector<uint8_t> _out;
+};
+
+static std::vector<uint8_t> msp_v1_frame(uint8_t cmd, const std::vector<uint8_t>& payload)
+{
+    std::vector<uint8_t> frame = { '$', 'M', '<', static_cast<uint8_t>(payload.size()), cmd };
+    for (uint8_t c : payload) {
+        frame.push_back(c);
+    }
+    frame.push_back(MspStream::checksum_xor(0, &frame[3], frame.size() - 3));
+    return frame;
+}
+
+void test_msp_coroutine_wait_until()
+{
+    static MspCoroutineTest msp;
+    static MspStream msp_stream(msp);
+    static MspSerialPortCapture msp_serial_port;
+    static MspSerial msp_serial(msp_stream, msp_serial_port);
+    static msp_context_t pg;
+
+    const std::vector<uint8_t> frame = msp_v1_frame(MSP_DATAFLASH_READ, { 0x78, 0x56, 0x34, 0x12 });
+    TEST_ASSERT_EQUAL(1, msp_stream.put_buf(pg, &frame[0], frame.size()));
+
+    // the coroutine has suspended waiting for the flash, so no reply yet
+    TEST_ASSERT_EQUAL(1, msp_stream.get_active_coroutine_count());
+    TEST_ASSERT_TRUE(msp_serial_port._out.empty());
+    msp_serial.process_output(pg);
+    TEST_ASSERT_TRUE(msp_serial_port._out.empty());
+
+    // other commands are serviced while the coroutine is suspended
+    const std::vector<uint8_t> api_version = msp_v1_frame(MSP_API_VERSION, {});
+    TEST_ASSERT_EQUAL(1, msp_stream.put_buf(pg, &api_version[0], api_version.size()));
+    TEST_ASSERT_EQUAL(5 + 3 + 1, msp_serial_port._out.size());
+    TEST_ASSERT_EQUAL(MSP_API_VERSION, msp_serial_port._out[4]);
+    msp_serial_port._out.clear();
+
+    msp._flash_ready = true;
+    msp_serial.process_output(pg);
+    TEST_ASSERT_EQUAL(0, msp_stream.get_active_coroutine_count());
+
+    const std::vector<uint8_t>& out = msp_serial_port._out;
+    TEST_ASSERT_EQUAL(5 + 5 + 1, out.size());
+    TEST_ASSERT_EQUAL('>', out[2]);
+    TEST_ASSERT_EQUAL(5, out[3]);
+    TEST_ASSERT_EQUAL(MSP_DATAFLASH_READ, out[4]);
+    TEST_ASSERT_EQUAL(0x78, out[5]);
+    TEST_ASSERT_EQUAL(0x12, out[8]);
+    TEST_ASSERT_EQUAL(0xA5, out[9]);
+    TEST_ASSERT_EQUAL(MspStream::checksum_xor(0, &out[3], 7), out[10]);
+}
+
+void test_msp_coroutine_yield()
+{
+    static MspCoroutineTest msp;
+    static MspStream msp_stream(msp);
+    static MspSerialPortCapture msp_serial_port;
+    static MspSerial msp_serial(msp_stream, msp_serial_port);
+    static msp_context_t pg;
+
+    const std::vector<uint8_t> frame = msp_v1_frame(MSP_EEPROM_WRITE, {});
+    TEST_ASSERT_EQUAL(1, msp_stream.put_buf(pg, &frame[0], frame.size()));
+    TEST_ASSERT_EQUAL(1, msp_stream.put_buf(pg, &frame[0], frame.size()));
+    TEST_ASSERT_EQUAL(2, msp_stream.get_active_coroutine_count());
+
+    // all coroutine slots are in use, so the command is refused, rather than processed by the synchronous handler
+    TEST_ASSERT_EQUAL(1, msp_stream.put_buf(pg, &frame[0], frame.size()));
+    TEST_ASSERT_EQUAL(6, msp_serial_port._out.size());
+    TEST_ASSERT_EQUAL('!', msp_serial_port._out[2]);
+    TEST_ASSERT_EQUAL(0, msp._eeprom_write_count);
+    TEST_ASSERT_EQUAL(2, msp_stream.get_active_coroutine_count());
+
+    // commands without a coroutine handler are still processed
+    const std::vector<uint8_t> api_version = msp_v1_frame(MSP_API_VERSION, {});
+    TEST_ASSERT_EQUAL(1, msp_stream.put_buf(pg, &api_version[0], api_version.size()));
+    TEST_ASSERT_EQUAL(6 + 5 + 3 + 1, msp_serial_port._out.size());
+    msp_serial_port._out.clear();
+
+    msp_serial.process_output(pg);
+    TEST_ASSERT_EQUAL(0, msp._eeprom_write_count);
+    msp_serial.process_output(pg);
+    TEST_ASSERT_EQUAL(2, msp._eeprom_write_count);
+    TEST_ASSERT_EQUAL(0, msp_stream.get_active_coroutine_count());
+
+    // two zero length ACK replies
+    const std::vector<uint8_t>& out = msp_serial_port._out;
+    TEST_ASSERT_EQUAL(12, out.size());
+    TEST_ASSERT_EQUAL('>', out[2]);
+    TEST_ASSERT_EQUAL(0, out[3]);
+    TEST_ASSERT_EQUAL(MSP_EEPROM_WRITE, out[4]);
+    TEST_ASSERT_EQUAL(MSP_EEPROM_WRITE, out[5]);
+}
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-avoid-reference-coroutine-parameters,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_msp_coroutine_wait_until);
+    RUN_TEST(test_msp_coroutine_yield);
+
+    UNITY_END();
+}
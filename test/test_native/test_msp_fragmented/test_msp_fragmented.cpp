@@ -0,0 +1,298 @@
+#include <msp_protocol.h>
+#include <msp_serial_fragmented.h>
+#include <msp_serial_port_base.h>
+#include <msp_stream.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <unity.h>
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+struct msp_context_t {
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,cppcoreguidelines-pro-bounds-pointer-arithmetic,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+class MspTest : public MspBase {
+public:
+    enum { NAME_LEN = 40 };
+    virtual msp_result_e process_write_command(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src) override {
+        (void)pg;
+        (void)src;
+        if (cmd_msp != MSP_NAME) {
+            return MSP_RESULT_CMD_UNKNOWN;
+        }
+        for (size_t ii = 0; ii < NAME_LEN; ++ii) {
+            dst.write_u8(static_cast<uint8_t>('a' + ii % 26));
+        }
+        return MSP_RESULT_ACK;
+    }
+    virtual msp_result_e process_read_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src) override {
+        (void)pg;
+        (void)src;
+        if (cmd_msp == MSP_SET_NAME) {
+            ++_set_name_count;
+            return MSP_RESULT_ACK;
+        }
+        return MSP_RESULT_ERROR;
+    }
+public:
+    size_t _set_name_count {};
+};
+
+// packet port: each write is one packet, and each read returns one packet
+class MspPacketPort : public MspSerialPortBase {
+public:
+    bool is_data_available() const override { return _rx_index < _rx.size(); }
+    uint8_t read_byte() override { return 0; }
+    size_t available_for_write() const override { return 64; }
+    size_t write(const uint8_t* buf, size_t len) override {
+        _tx.emplace_back(buf, buf + len);
+        return len;
+    }
+    size_t read(uint8_t* buf, size_t len) override {
+        if (_rx_index == _rx.size()) {
+            return 0;
+        }
+        const std::vector<uint8_t>& packet = _rx[_rx_index++];
+        len = std::min(len, packet.size());
+        std::copy_n(packet.begin(), len, buf);
+        return len;
+    }
+public:
+    std::vector<std::vector<uint8_t>> _tx;
+    std::vector<std::vector<uint8_t>> _rx;
+    size_t _rx_index {};
+};
+
+// packet port whose transmit buffer takes one packet at a time, and which signals when it is free again
+class MspNotifyPacketPort : public MspPacketPort {
+public:
+    size_t available_for_write() const override { return _space; }
+    size_t write(const uint8_t* buf, size_t len) override {
+        _space = 0;
+        return MspPacketPort::write(buf, len);
+    }
+    bool wait_for_write_space(size_t len, uint32_t timeout_us) override {
+        (void)len;
+        (void)timeout_us;
+        ++_wait_count;
+        _space = 64;
+        return true;
+    }
+public:
+    size_t _space {};
+    size_t _wait_count {};
+};
+
+static constexpr size_t MTU = 8;
+static constexpr size_t CHUNK_SIZE = MTU - MspSerialFragmented::HEADER_SIZE;
+
+// a 26 byte MSP_SET_NAME request, which is 5 fragments
+static std::vector<uint8_t> set_name_frame()
+{
+    std::vector<uint8_t> frame = { '$', 'M', '<', 20, MSP_SET_NAME };
+    uint8_t checksum = 20 ^ MSP_SET_NAME;
+    for (uint8_t ii = 0; ii < 20; ++ii) {
+        frame.push_back(static_cast<uint8_t>('A' + ii));
+        checksum ^= static_cast<uint8_t>('A' + ii);
+    }
+    frame.push_back(checksum);
+    return frame;
+}
+
+// fragments frames as the ground station would
+static std::vector<std::vector<uint8_t>> fragment_frames(size_t frame_count)
+{
+    static MspBase msp;
+    MspStream msp_stream(msp);
+    MspPacketPort port;
+    MspSerialFragmented msp_serial(msp_stream, port, MTU);
+    const std::vector<uint8_t> frame = set_name_frame();
+    for (size_t ii = 0; ii < frame_count; ++ii) {
+        msp_serial.send_frame(&frame[0], frame.size(), nullptr, 0, nullptr, 0);
+    }
+    TEST_ASSERT_EQUAL(frame_count * 5, msp_serial.get_fragment_statistics().fragments_sent);
+    return port._tx;
+}
+
+void test_fragment_reassembly()
+{
+    static MspTest msp;
+    static msp_context_t pg;
+    MspStream msp_stream(msp);
+    MspPacketPort port;
+    MspSerialFragmented msp_serial(msp_stream, port, MTU);
+
+    const std::vector<std::vector<uint8_t>> fragments = fragment_frames(3);
+    TEST_ASSERT_EQUAL(15, fragments.size());
+    for (size_t ii = 0; ii < fragments.size(); ++ii) {
+        TEST_ASSERT_EQUAL(ii / 5, fragments[ii][0] & MspSerialFragmented::SEQUENCE_MASK);
+        TEST_ASSERT_EQUAL(ii % 5 == 4, (fragments[ii][0] & MspSerialFragmented::LAST_FRAGMENT) != 0);
+        TEST_ASSERT_EQUAL(ii % 5, fragments[ii][1]);
+        TEST_ASSERT_EQUAL(ii % 5 == 4 ? 2 + 26 - 4 * CHUNK_SIZE : MTU, fragments[ii].size());
+    }
+
+    // each frame's fragments reversed, with the first two frames interleaved and a fragment duplicated
+    const std::array<size_t, 16> order = { 4, 9, 3, 8, 2, 7, 1, 6, 0, 5, 5, 14, 13, 12, 11, 10 };
+    for (size_t ii : order) {
+        port._rx.push_back(fragments[ii]);
+    }
+    msp_serial.process_input(pg);
+    TEST_ASSERT_EQUAL(3, msp._set_name_count);
+    TEST_ASSERT_EQUAL(3, msp_serial.get_fragment_statistics().frames_reassembled);
+    TEST_ASSERT_EQUAL(1, msp_serial.get_fragment_statistics().fragments_duplicate);
+    TEST_ASSERT_EQUAL(0, msp_serial.get_fragment_statistics().frames_lost);
+    TEST_ASSERT_EQUAL(3, msp_serial.get_link_statistics().get_statistics().rx_frames[MSP_V1]);
+
+    // a late duplicate of a reassembled frame does not start a new frame
+    msp_serial.put_fragment(pg, &fragments[0][0], fragments[0].size(), 0);
+    TEST_ASSERT_EQUAL(2, msp_serial.get_fragment_statistics().fragments_duplicate);
+}
+
+void test_fragment_loss()
+{
+    static MspTest msp;
+    static msp_context_t pg;
+    MspStream msp_stream(msp);
+    MspPacketPort port;
+    MspSerialFragmented msp_serial(msp_stream, port, MTU);
+
+    // frame 1 loses a fragment, frames 2 and 3 are interleaved, so frame 1 is evicted to make room for frame 3
+    const std::vector<std::vector<uint8_t>> fragments = fragment_frames(4);
+    const std::array<size_t, 14> order = { 0, 1, 2, 3, 4, 5, 6, 8, 9, 10, 15, 11, 12, 13 };
+    for (size_t ii : order) {
+        msp_serial.put_fragment(pg, &fragments[ii][0], fragments[ii].size(), 0);
+    }
+    TEST_ASSERT_EQUAL(1, msp._set_name_count);
+    TEST_ASSERT_EQUAL(1, msp_serial.get_fragment_statistics().frames_lost);
+    msp_serial.put_fragment(pg, &fragments[14][0], fragments[14].size(), 0);
+    TEST_ASSERT_EQUAL(2, msp._set_name_count);
+    for (size_t ii = 16; ii < 20; ++ii) {
+        msp_serial.put_fragment(pg, &fragments[ii][0], fragments[ii].size(), 0);
+    }
+    TEST_ASSERT_EQUAL(3, msp._set_name_count);
+    TEST_ASSERT_EQUAL(1, msp_serial.get_fragment_statistics().frames_lost);
+
+    // the missing fragment arriving late starts a frame that is never completed
+    msp_serial.put_fragment(pg, &fragments[7][0], fragments[7].size(), 0);
+    TEST_ASSERT_EQUAL(3, msp._set_name_count);
+
+    // malformed fragments are rejected
+    const std::array<uint8_t, 2> header_only = { 0x05, 0 };
+    msp_serial.put_fragment(pg, &header_only[0], header_only.size(), 0);
+    const std::array<uint8_t, 5> short_middle = { 0x05, 0, 1, 2, 3 };
+    msp_serial.put_fragment(pg, &short_middle[0], short_middle.size(), 0);
+    const std::array<uint8_t, 4> beyond_end = { 0x05 | MspSerialFragmented::LAST_FRAGMENT, 255, 1, 2 };
+    msp_serial.put_fragment(pg, &beyond_end[0], beyond_end.size(), 0);
+    TEST_ASSERT_EQUAL(3, msp_serial.get_fragment_statistics().fragments_invalid);
+}
+
+void test_fragment_past_last()
+{
+    static MspTest msp;
+    static msp_context_t pg;
+    MspStream msp_stream(msp);
+    MspPacketPort port;
+    MspSerialFragmented msp_serial(msp_stream, port, MTU);
+
+    // fragments 0, 1, 3 (marked as the last) and 5 of a frame, so there is a hole at 2
+    const std::vector<std::vector<uint8_t>> fragments = fragment_frames(1);
+    std::vector<uint8_t> last = fragments[3];
+    last[0] |= MspSerialFragmented::LAST_FRAGMENT;
+    last.resize(MspSerialFragmented::HEADER_SIZE + 1);
+    std::vector<uint8_t> past_last = fragments[1];
+    past_last[1] = 5;
+
+    // fragment 5 arrives before the last fragment, so is accepted until the last fragment arrives
+    msp_serial.put_fragment(pg, &past_last[0], past_last.size(), 0);
+    msp_serial.put_fragment(pg, &fragments[0][0], fragments[0].size(), 0);
+    msp_serial.put_fragment(pg, &fragments[1][0], fragments[1].size(), 0);
+    TEST_ASSERT_EQUAL(0, msp_serial.get_fragment_statistics().fragments_invalid);
+    // four fragments with a last index of 3, but not a complete frame
+    msp_serial.put_fragment(pg, &last[0], last.size(), 0);
+    TEST_ASSERT_EQUAL(1, msp_serial.get_fragment_statistics().fragments_invalid);
+    TEST_ASSERT_EQUAL(0, msp_serial.get_fragment_statistics().frames_reassembled);
+
+    // once the last fragment is known, fragments past it, and other last fragments, are rejected
+    past_last[1] = 4;
+    msp_serial.put_fragment(pg, &past_last[0], past_last.size(), 0);
+    std::vector<uint8_t> other_last = fragments[2];
+    other_last[0] |= MspSerialFragmented::LAST_FRAGMENT;
+    msp_serial.put_fragment(pg, &other_last[0], other_last.size(), 0);
+    TEST_ASSERT_EQUAL(3, msp_serial.get_fragment_statistics().fragments_invalid);
+    TEST_ASSERT_EQUAL(0, msp_serial.get_fragment_statistics().frames_reassembled);
+
+    // filling the hole completes the frame
+    msp_serial.put_fragment(pg, &fragments[2][0], fragments[2].size(), 0);
+    TEST_ASSERT_EQUAL(1, msp_serial.get_fragment_statistics().frames_reassembled);
+}
+
+void test_fragmented_reply()
+{
+    static MspTest msp;
+    static msp_context_t pg;
+    MspStream msp_stream(msp);
+    MspPacketPort port;
+    MspSerialFragmented msp_serial(msp_stream, port, MTU);
+
+    const std::array<uint8_t, 8> fragment = { MspSerialFragmented::LAST_FRAGMENT, 0, '$', 'M', '<', 0, MSP_NAME, MSP_NAME };
+    msp_serial.put_fragment(pg, &fragment[0], fragment.size(), 0);
+
+    // the 46 byte reply is sent as 8 fragments, and reassembles into the reply frame
+    static constexpr size_t REPLY_SIZE = 6 + MspTest::NAME_LEN;
+    TEST_ASSERT_EQUAL((REPLY_SIZE + CHUNK_SIZE - 1) / CHUNK_SIZE, port._tx.size());
+    std::vector<uint8_t> reply;
+    for (size_t ii = 0; ii < port._tx.size(); ++ii) {
+        TEST_ASSERT_EQUAL(ii, port._tx[ii][1]);
+        TEST_ASSERT_EQUAL(ii == port._tx.size() - 1, (port._tx[ii][0] & MspSerialFragmented::LAST_FRAGMENT) != 0);
+        reply.insert(reply.end(), port._tx[ii].begin() + 2, port._tx[ii].end());
+    }
+    TEST_ASSERT_EQUAL(REPLY_SIZE, reply.size());
+    TEST_ASSERT_EQUAL('>', reply[2]);
+    TEST_ASSERT_EQUAL(MspTest::NAME_LEN, reply[3]);
+    TEST_ASSERT_EQUAL(MSP_NAME, reply[4]);
+    TEST_ASSERT_EQUAL('a', reply[5]);
+
+    // the next reply has the next sequence number
+    port._tx.clear();
+    msp_serial.put_fragment(pg, &fragment[0], fragment.size(), 0); // a duplicate of the request, so ignored
+    TEST_ASSERT_EQUAL(0, port._tx.size());
+    std::array<uint8_t, 8> next_fragment = fragment;
+    next_fragment[0] |= 1;
+    msp_serial.put_fragment(pg, &next_fragment[0], next_fragment.size(), 0);
+    TEST_ASSERT_EQUAL(1, port._tx[0][0] & MspSerialFragmented::SEQUENCE_MASK);
+}
+void test_fragmented_tx_wait_notify()
+{
+    static MspBase msp;
+    MspStream msp_stream(msp);
+    MspNotifyPacketPort port;
+    MspSerialFragmented msp_serial(msp_stream, port, MTU);
+    msp_serial.set_tx_wait_policy(MSP_TX_WAIT_NOTIFY);
+
+    // each fragment waits for the transmit buffer through the port, rather than polling it
+    const std::vector<uint8_t> frame = set_name_frame();
+    msp_serial.send_frame(&frame[0], frame.size(), nullptr, 0, nullptr, 0);
+    TEST_ASSERT_EQUAL(5, port._tx.size());
+    TEST_ASSERT_EQUAL(5, port._wait_count);
+}
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,cppcoreguidelines-pro-bounds-pointer-arithmetic,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_fragment_reassembly);
+    RUN_TEST(test_fragment_loss);
+    RUN_TEST(test_fragment_past_last);
+    RUN_TEST(test_fragmented_reply);
+    RUN_TEST(test_fragmented_tx_wait_notify);
+
+    UNITY_END();
+}
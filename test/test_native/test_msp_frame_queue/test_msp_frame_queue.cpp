@@ -0,0 +1,137 @@
+#include <msp_frame_queue.h>
+#include <msp_protocol.h>
+#include <msp_serial.h>
+#include <msp_serial_port_base.h>
+#include <msp_stream.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <unity.h>
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+struct msp_context_t {
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+class MspTest : public MspBase {
+public:
+    virtual msp_result_e process_read_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src) override;
+public:
+    uint32_t _set_name_count {};
+};
+
+msp_result_e MspTest::process_read_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src)
+{
+    (void)pg;
+    (void)src;
+
+    if (cmd_msp == MSP_SET_NAME) {
+        ++_set_name_count;
+        return MSP_RESULT_ACK;
+    }
+    return MSP_RESULT_ERROR;
+}
+
+// serial port that counts the bytes written to it
+class MspSerialPortCount : public MspSerialPortBase
+{
+public:
+    bool is_data_available() const override { return false; }
+    uint8_t read_byte() override { return 0; }
+    size_t available_for_write() const override { return 64; }
+    size_t write(const uint8_t* buf, size_t len) override { (void)buf; _count += len; return len; }
+public:
+    size_t _count {};
+};
+
+static constexpr std::array<uint8_t, 12> set_name_frame = {
+    '$', 'M', '<', 6, MSP_SET_NAME, 'M', 'y', 'N', 'a', 'm', 'e', 30
+};
+static constexpr size_t REPLY_SIZE = 6; // ACK with no payload
+
+void test_msp_frame_queue()
+{
+    static MspTest msp;
+    static MspStream msp_stream(msp);
+    static MspSerialPortCount msp_serial_port;
+    static MspSerial msp_serial(msp_stream, msp_serial_port);
+    static MspFrameQueue frame_queue;
+    static msp_context_t pg;
+
+    msp_stream.set_frame_queue(&frame_queue);
+
+    // frames are queued, but not executed
+    TEST_ASSERT_EQUAL(1, msp_stream.put_buf(pg, &set_name_frame[0], set_name_frame.size()));
+    TEST_ASSERT_EQUAL(1, msp_stream.put_buf(pg, &set_name_frame[0], set_name_frame.size()));
+    TEST_ASSERT_EQUAL(2, frame_queue.size());
+    TEST_ASSERT_EQUAL(0, msp._set_name_count);
+    TEST_ASSERT_EQUAL(0, msp_serial_port._count);
+
+    msp_serial.process_output(pg);
+    TEST_ASSERT_EQUAL(0, frame_queue.size());
+    TEST_ASSERT_EQUAL(2, msp._set_name_count);
+    TEST_ASSERT_EQUAL(2 * REPLY_SIZE, msp_serial_port._count);
+
+    // frames that arrive when the queue is full are dropped
+    for (size_t ii = 0; ii < MspFrameQueue::SLOT_COUNT + 1; ++ii) {
+        msp_stream.put_buf(pg, &set_name_frame[0], set_name_frame.size());
+    }
+    TEST_ASSERT_EQUAL(MspFrameQueue::SLOT_COUNT, frame_queue.size());
+    TEST_ASSERT_EQUAL(1, frame_queue.get_dropped_frame_count());
+    msp_serial.process_output(pg);
+    TEST_ASSERT_EQUAL(2 + MspFrameQueue::SLOT_COUNT, msp._set_name_count);
+}
+
+void test_msp_frame_queue_threads()
+{
+    static MspTest msp;
+    static MspStream msp_stream(msp);
+    static MspSerialPortCount msp_serial_port;
+    static MspSerial msp_serial(msp_stream, msp_serial_port);
+    static MspFrameQueue frame_queue;
+    static msp_context_t pg;
+
+    msp_stream.set_frame_queue(&frame_queue);
+
+    enum { FRAME_COUNT = 20000 };
+    std::atomic<bool> parsing_done { false };
+
+    // commands are executed on one thread while they are parsed on another
+    std::thread executor([&]() {
+        while (!parsing_done.load() || frame_queue.size() > 0) {
+            msp_serial.process_output(pg);
+        }
+    });
+    size_t count = 0;
+    for (size_t ii = 0; ii < FRAME_COUNT; ++ii) {
+        while (frame_queue.size() == MspFrameQueue::SLOT_COUNT) {
+            std::this_thread::yield();
+        }
+        count += msp_stream.put_buf(pg, &set_name_frame[0], set_name_frame.size());
+    }
+    parsing_done = true;
+    executor.join();
+
+    TEST_ASSERT_EQUAL(FRAME_COUNT, count);
+    TEST_ASSERT_EQUAL(0, frame_queue.get_dropped_frame_count());
+    TEST_ASSERT_EQUAL(FRAME_COUNT, msp._set_name_count);
+    TEST_ASSERT_EQUAL(FRAME_COUNT * REPLY_SIZE, msp_serial_port._count);
+}
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_msp_frame_queue);
+    RUN_TEST(test_msp_frame_queue_threads);
+
+    UNITY_END();
+}
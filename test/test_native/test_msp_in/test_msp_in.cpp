@@ -2,6 +2,8 @@
 #include <msp_serial.h>
 #include <msp_stream.h>
 
+#include <vector>
+
 #include <unity.h>
 
 void setUp() {
@@ -217,6 +219,297 @@ void test_msp_set_name_serial_encode_v1()
     TEST_ASSERT_EQUAL('m', pwh.data_ptr[4]);
     TEST_ASSERT_EQUAL('e', pwh.data_ptr[5]);
 }
+void test_msp_find_frame_start()
+{
+    std::array<uint8_t, 64> buf {};
+    buf.fill(0x55);
+    TEST_ASSERT_EQUAL(buf.size(), MspStream::find_frame_start(&buf[0], buf.size()));
+    TEST_ASSERT_EQUAL(0, MspStream::find_frame_start(&buf[0], 0));
+
+    for (size_t ii = 0; ii < buf.size(); ++ii) {
+        buf[ii] = (ii & 1U) ? 'X' : 'M';
+        TEST_ASSERT_EQUAL(ii, MspStream::find_frame_start(&buf[0], buf.size()));
+        buf[ii] = 0x55;
+    }
+}
+
+void test_msp_set_name_put_buf_noise()
+{
+    static MspTest msp;
+    static MspStream msp_stream(msp);
+    static msp_context_t pg;
+
+    msp_stream.set_packet_state(MSP_IDLE);
+    msp._name.fill(0xFF);
+
+    const std::array<uint8_t, 50> inStream = {
+        0x00, 0x13, 0x99, '$', 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC,
+        0x00, 0x13, 0x99, '$', 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC,
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+        '$', 'M', '<', 6, MspTest::MSP_SET_NAME, 'M', 'y', 'N', 'a', 'm', 'e', 30
+    };
+
+    const size_t count = msp_stream.put_buf(pg, &inStream[0], inStream.size());
+    TEST_ASSERT_EQUAL(1, count);
+    TEST_ASSERT_EQUAL(MSP_IDLE, msp_stream.get_packet_state());
+    TEST_ASSERT_EQUAL('M', msp._name[0]);
+    TEST_ASSERT_EQUAL('e', msp._name[5]);
+    TEST_ASSERT_EQUAL(0, msp._name[6]);
+}
+
+void test_msp_set_name_resync_after_truncated_frame()
+{
+    static MspTest msp;
+    static MspStream msp_stream(msp);
+    static msp_context_t pg;
+
+    msp_stream.set_packet_state(MSP_IDLE);
+    msp._name.fill(0xFF);
+
+    // a frame declaring a 10 byte payload is truncated after 3 bytes and a complete frame follows:
+    // the truncated frame swallows the start of the complete frame as payload, and fails its checksum
+    // on the 'N' of the complete frame. Rewinding recovers the complete frame.
+    const std::array<uint8_t, 20> inStream = {
+        '$', 'M', '<', 10, MspTest::MSP_SET_NAME, 0x01, 0x02, 0x03,
+        '$', 'M', '<', 6, MspTest::MSP_SET_NAME, 'M', 'y', 'N', 'a', 'm', 'e', 30
+    };
+
+    const size_t count = msp_stream.put_buf(pg, &inStream[0], inStream.size());
+    TEST_ASSERT_EQUAL(1, count);
+    TEST_ASSERT_EQUAL(MSP_IDLE, msp_stream.get_packet_state());
+    TEST_ASSERT_EQUAL('M', msp._name[0]);
+    TEST_ASSERT_EQUAL('y', msp._name[1]);
+    TEST_ASSERT_EQUAL('e', msp._name[5]);
+    TEST_ASSERT_EQUAL(0, msp._name[6]);
+}
+void test_msp_set_name_frame_timeout()
+{
+    static MspTest msp;
+    static MspStream msp_stream(msp);
+    static msp_context_t pg;
+
+    msp_stream.set_packet_state(MSP_IDLE);
+    msp_stream.set_frame_timeout_microseconds(2000);
+    msp._name.fill(0xFF);
+
+    const std::array<uint8_t, 8> truncated = {
+        '$', 'M', '<', 10, MspTest::MSP_SET_NAME, 0x01, 0x02, 0x03
+    };
+    const std::array<uint8_t, 12> complete = {
+        '$', 'M', '<', 6, MspTest::MSP_SET_NAME, 'M', 'y', 'N', 'a', 'm', 'e', 30
+    };
+
+    size_t count = msp_stream.put_buf(pg, &truncated[0], truncated.size(), 1000);
+    TEST_ASSERT_EQUAL(0, count);
+    TEST_ASSERT_EQUAL(MSP_PAYLOAD_V1, msp_stream.get_packet_state());
+    TEST_ASSERT_EQUAL(0, msp_stream.get_expired_frame_count());
+
+    // gap within the timeout, so frame is still in progress
+    count = msp_stream.put_buf(pg, &truncated[5], 1, 2500);
+    TEST_ASSERT_EQUAL(0, count);
+    TEST_ASSERT_EQUAL(MSP_PAYLOAD_V1, msp_stream.get_packet_state());
+
+    // the complete frame arrives after a gap that exceeds the timeout, so the truncated frame is abandoned
+    count = msp_stream.put_buf(pg, &complete[0], complete.size(), 5000);
+    TEST_ASSERT_EQUAL(1, count);
+    TEST_ASSERT_EQUAL(1, msp_stream.get_expired_frame_count());
+    TEST_ASSERT_EQUAL(MSP_IDLE, msp_stream.get_packet_state());
+    TEST_ASSERT_EQUAL('M', msp._name[0]);
+    TEST_ASSERT_EQUAL('e', msp._name[5]);
+
+    // idle gaps do not count as expired frames
+    count = msp_stream.put_buf(pg, &complete[0], complete.size(), 100000);
+    TEST_ASSERT_EQUAL(1, count);
+    TEST_ASSERT_EQUAL(1, msp_stream.get_expired_frame_count());
+}
+
+class MspPayloadSinkTest : public MspPayloadSink {
+public:
+    void write(const uint8_t* data, size_t len) override {
+        TEST_ASSERT_TRUE(len <= MspStream::MSP_STREAM_INBUF_SIZE);
+        _pending.insert(_pending.end(), data, data + len);
+    }
+    msp_result_e commit(msp_context_t& pg, StreamBufWriter& dst) override {
+        (void)pg;
+        _committed = _pending;
+        _pending.clear();
+        ++_commit_count;
+        dst.write_u16(static_cast<uint16_t>(_committed.size()));
+        return MSP_RESULT_ACK;
+    }
+    void abort() override {
+        _pending.clear();
+        ++_abort_count;
+    }
+public:
+    std::vector<uint8_t> _pending;
+    std::vector<uint8_t> _committed;
+    size_t _commit_count {};
+    size_t _abort_count {};
+};
+
+class MspSinkTest : public MspTest {
+public:
+    virtual MspPayloadSink* get_payload_sink(int16_t cmd_msp, size_t payload_size) override {
+        (void)payload_size;
+        return cmd_msp == MSP_OSD_CHAR_WRITE ? &_sink : nullptr;
+    }
+public:
+    MspPayloadSinkTest _sink;
+};
+
+static std::vector<uint8_t> msp_v2_native_frame(uint16_t cmd, size_t payload_size)
+{
+    std::vector<uint8_t> frame = { '$', 'X', '<', 0, static_cast<uint8_t>(cmd), static_cast<uint8_t>(cmd >> 8U),
+        static_cast<uint8_t>(payload_size), static_cast<uint8_t>(payload_size >> 8U) };
+    for (size_t ii = 0; ii < payload_size; ++ii) {
+        frame.push_back(static_cast<uint8_t>(ii * 7));
+    }
+    frame.push_back(MspStream::crc8_dvb_s2_update(0, &frame[3], static_cast<uint32_t>(frame.size() - 3)));
+    return frame;
+}
+
+void test_msp_payload_sink()
+{
+    static MspSinkTest msp;
+    static MspStream msp_stream(msp);
+    static msp_context_t pg;
+
+    msp_stream.set_packet_state(MSP_IDLE);
+
+    // payload much larger than the input buffer
+    std::vector<uint8_t> frame = msp_v2_native_frame(MSP_OSD_CHAR_WRITE, 1000);
+    size_t count = 0;
+    for (size_t ii = 0; ii < frame.size(); ii += 64) {
+        count += msp_stream.put_buf(pg, &frame[ii], std::min(static_cast<size_t>(64), frame.size() - ii));
+    }
+    TEST_ASSERT_EQUAL(1, count);
+    TEST_ASSERT_EQUAL(1, msp._sink._commit_count);
+    TEST_ASSERT_EQUAL(1000, msp._sink._committed.size());
+    TEST_ASSERT_EQUAL_MEMORY(&frame[8], &msp._sink._committed[0], 1000);
+    TEST_ASSERT_EQUAL(0, msp_stream.get_discarded_frame_count());
+
+    // character at a time, with the reply checked
+    msp_stream_packet_with_header_t pwh {};
+    bool complete = false;
+    for (uint8_t c : frame) {
+        complete = msp_stream.put_char(pg, c, &pwh);
+    }
+    TEST_ASSERT_TRUE(complete);
+    TEST_ASSERT_EQUAL(2, msp._sink._commit_count);
+    TEST_ASSERT_EQUAL_MEMORY(&frame[8], &msp._sink._committed[0], 1000);
+    TEST_ASSERT_EQUAL('X', pwh.hdr_buf[1]);
+    TEST_ASSERT_EQUAL('>', pwh.hdr_buf[2]);
+    TEST_ASSERT_EQUAL(MSP_OSD_CHAR_WRITE, pwh.hdr_buf[4]);
+    TEST_ASSERT_EQUAL(2, pwh.data_len);
+    TEST_ASSERT_EQUAL(1000 & 0xFF, pwh.data_ptr[0]);
+    TEST_ASSERT_EQUAL(1000 >> 8, pwh.data_ptr[1]);
+
+    // corrupted frame is aborted, not committed
+    frame[500] ^= 0x01;
+    count = msp_stream.put_buf(pg, &frame[0], frame.size());
+    TEST_ASSERT_EQUAL(0, count);
+    TEST_ASSERT_EQUAL(2, msp._sink._commit_count);
+    TEST_ASSERT_EQUAL(1, msp._sink._abort_count);
+    TEST_ASSERT_TRUE(msp._sink._pending.empty());
+
+    // commands without a sink are still discarded if they are too large
+    const std::vector<uint8_t> other = msp_v2_native_frame(MSP_SET_NAME, 300);
+    count = msp_stream.put_buf(pg, &other[0], other.size());
+    TEST_ASSERT_EQUAL(0, count);
+    TEST_ASSERT_EQUAL(1, msp_stream.get_discarded_frame_count());
+}
+
+void test_msp_payload_sink_frame_timeout()
+{
+    static MspSinkTest msp;
+    static MspStream msp_stream(msp);
+    static msp_context_t pg;
+
+    msp_stream.set_packet_state(MSP_IDLE);
+    msp_stream.set_frame_timeout_microseconds(2000);
+
+    const std::vector<uint8_t> frame = msp_v2_native_frame(MSP_OSD_CHAR_WRITE, 500);
+    size_t count = msp_stream.put_buf(pg, &frame[0], 400, 1000);
+    TEST_ASSERT_EQUAL(0, count);
+    TEST_ASSERT_FALSE(msp._sink._pending.empty());
+
+    // frame abandoned after the timeout, and the next frame is received in full
+    count = msp_stream.put_buf(pg, &frame[0], frame.size(), 10000);
+    TEST_ASSERT_EQUAL(1, count);
+    TEST_ASSERT_EQUAL(1, msp._sink._abort_count);
+    TEST_ASSERT_EQUAL(1, msp._sink._commit_count);
+    TEST_ASSERT_EQUAL(500, msp._sink._committed.size());
+}
+void test_msp_set_raw_rc_fast_path()
+{
+    static MspTest msp;
+    static MspStream msp_stream(msp);
+    static msp_context_t pg;
+    static MspSnapshot<msp_rc_channels_t> rc_channels;
+
+    msp_stream.set_packet_state(MSP_IDLE);
+    msp_stream.set_rc_channels_snapshot(&rc_channels);
+
+    // 4 channels, 1500, 1000, 2000, 1234
+    std::vector<uint8_t> frame = { '$', 'M', '<', 8, MSP_SET_RAW_RC, 0xDC, 0x05, 0xE8, 0x03, 0xD0, 0x07, 0xD2, 0x04 };
+    uint8_t checksum = 0;
+    for (size_t ii = 3; ii < frame.size(); ++ii) {
+        checksum ^= frame[ii];
+    }
+    frame.push_back(checksum);
+
+    msp_stream_packet_with_header_t pwh {};
+    bool complete = false;
+    uint32_t time_microseconds = 1000;
+    for (uint8_t c : frame) {
+        complete = msp_stream.put_char(pg, c, &pwh, time_microseconds);
+        time_microseconds += 87;
+    }
+    TEST_ASSERT_TRUE(complete);
+    TEST_ASSERT_EQUAL(1, rc_channels.get_publication_count());
+    msp_rc_channels_t rc = rc_channels.read();
+    TEST_ASSERT_EQUAL(4, rc.channel_count);
+    TEST_ASSERT_EQUAL(1500, rc.channels[0]);
+    TEST_ASSERT_EQUAL(1000, rc.channels[1]);
+    TEST_ASSERT_EQUAL(2000, rc.channels[2]);
+    TEST_ASSERT_EQUAL(1234, rc.channels[3]);
+    TEST_ASSERT_EQUAL(1000 + 13*87, rc.arrival_time_microseconds);
+    // the ACK is still sent
+    TEST_ASSERT_EQUAL('>', pwh.hdr_buf[2]);
+    TEST_ASSERT_EQUAL(0, pwh.hdr_buf[3]);
+    TEST_ASSERT_EQUAL(MSP_SET_RAW_RC, pwh.hdr_buf[4]);
+
+    // with the ACK suppressed, no reply is encoded
+    msp_stream.set_rc_channels_snapshot(&rc_channels, true);
+    pwh = {};
+    TEST_ASSERT_EQUAL(1, msp_stream.put_buf(pg, &frame[0], frame.size(), 5000));
+    TEST_ASSERT_EQUAL(2, rc_channels.get_publication_count());
+    TEST_ASSERT_EQUAL(5000, rc_channels.read().arrival_time_microseconds);
+    complete = false;
+    for (uint8_t c : frame) {
+        complete = msp_stream.put_char(pg, c, &pwh);
+    }
+    TEST_ASSERT_TRUE(complete);
+    TEST_ASSERT_EQUAL(0, pwh.hdr_buf[0]);
+    // frames received without timestamps have no arrival time, rather than a stale one
+    TEST_ASSERT_EQUAL(3, rc_channels.get_publication_count());
+    TEST_ASSERT_EQUAL(0, rc_channels.read().arrival_time_microseconds);
+
+    // a malformed payload is dispatched as normal, and MspTest rejects it
+    std::vector<uint8_t> odd = { '$', 'M', '<', 3, MSP_SET_RAW_RC, 0xDC, 0x05, 0xE8 };
+    checksum = 0;
+    for (size_t ii = 3; ii < odd.size(); ++ii) {
+        checksum ^= odd[ii];
+    }
+    odd.push_back(checksum);
+    for (uint8_t c : odd) {
+        complete = msp_stream.put_char(pg, c, &pwh);
+    }
+    TEST_ASSERT_TRUE(complete);
+    TEST_ASSERT_EQUAL(3, rc_channels.get_publication_count());
+    TEST_ASSERT_EQUAL('!', pwh.hdr_buf[2]);
+}
 // NOLINTEND(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-pointer-arithmetic,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
 
 int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
@@ -226,6 +519,13 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
     RUN_TEST(test_msp_set_name);
     RUN_TEST(test_msp_set_name_loop);
     RUN_TEST(test_msp_set_name_serial_encode_v1);
+    RUN_TEST(test_msp_find_frame_start);
+    RUN_TEST(test_msp_set_name_put_buf_noise);
+    RUN_TEST(test_msp_set_name_resync_after_truncated_frame);
+    RUN_TEST(test_msp_set_name_frame_timeout);
+    RUN_TEST(test_msp_payload_sink);
+    RUN_TEST(test_msp_payload_sink_frame_timeout);
+    RUN_TEST(test_msp_set_raw_rc_fast_path);
 
     UNITY_END();
 }
@@ -2,6 +2,10 @@
 #include <msp_serial.h>
 #include <msp_serial_port_base.h>
 #include <msp_stream.h>
+#include <time_microseconds.h>
+
+#include <thread>
+#include <vector>
 
 #include <unity.h>
 
@@ -360,7 +364,7 @@ void test_msp_attitude()
 
     msp_stream.set_packet_state(MSP_IDLE);
 
-    msp_stream_packet_with_header_t pwh;
+    msp_stream_packet_with_header_t pwh {};
 
     const uint8_t payloadSize = 0;
     const uint8_t type = MspTest::MSP_ATTITUDE; // 108
@@ -429,6 +433,316 @@ void test_msp_attitude()
 #endif
 }
 
+class MspPayloadGeneratorTest : public MspPayloadGenerator {
+public:
+    explicit MspPayloadGeneratorTest(size_t length) : _length(length), _supply_length(length) {}
+    size_t get_payload_length() const override { return _length; }
+    size_t read(uint8_t* buf, size_t len) override {
+        size_t count = 0;
+        while (count < len && _offset < _supply_length) {
+            buf[count++] = static_cast<uint8_t>(_offset++);
+        }
+        return count;
+    }
+public:
+    size_t _length;
+    size_t _supply_length; // number of bytes actually supplied
+    size_t _offset {};
+};
+
+class MspStreamedTest : public MspBase {
+public:
+    MspStreamedTest() : MspBase(HANDLES_STREAM_COMMANDS) {}
+    virtual MspPayloadGenerator* process_stream_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src) override;
+public:
+    MspPayloadGeneratorTest _generator { 1000 };
+};
+
+MspPayloadGenerator* MspStreamedTest::process_stream_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src)
+{
+    (void)pg;
+    (void)src;
+
+    if (cmd_msp == MSP_DATAFLASH_READ) {
+        _generator._offset = 0;
+        return &_generator;
+    }
+    return nullptr;
+}
+
+// serial port that captures everything written to it, and has a small transmit buffer
+class MspSerialPortCapture : public MspSerialPortBase
+{
+public:
+    bool is_data_available() const override { return false; }
+    uint8_t read_byte() override { return 0; }
+    size_t available_for_write() const override { return 24; }
+    size_t write(const uint8_t* buf, size_t len) override {
+        TEST_ASSERT_TRUE(len <= 24);
+        _out.insert(_out.end(), buf, buf + len);
+        return len;
+    }
+public:
+    std::vector<uint8_t> _out;
+};
+
+void test_streamed_reply_v2_native()
+{
+    static MspStreamedTest msp;
+    static MspStream msp_stream(msp);
+    static MspSerialPortCapture msp_serial_port;
+    static MspSerial msp_serial(msp_stream, msp_serial_port);
+    static msp_context_t pg;
+
+    msp_stream.set_packet_state(MSP_IDLE);
+
+    std::array<uint8_t, 9> in_stream = { '$', 'X', '<', 0, MSP_DATAFLASH_READ, 0, 0, 0, 0 };
+    in_stream[8] = MspStream::crc8_dvb_s2_update(0, &in_stream[3], 5);
+    msp_stream_packet_with_header_t pwh {};
+    for (uint8_t c : in_stream) {
+        msp_stream.put_char(pg, c, &pwh);
+    }
+
+    // the reply is larger than the output buffer, so has been streamed out
+    const std::vector<uint8_t>& out = msp_serial_port._out;
+    TEST_ASSERT_EQUAL(8 + 1000 + 1, out.size());
+    TEST_ASSERT_EQUAL('$', out[0]);
+    TEST_ASSERT_EQUAL('X', out[1]);
+    TEST_ASSERT_EQUAL('>', out[2]);
+    TEST_ASSERT_EQUAL(MSP_DATAFLASH_READ, out[4]);
+    TEST_ASSERT_EQUAL(1000 & 0xFF, out[6]);
+    TEST_ASSERT_EQUAL(1000 >> 8, out[7]);
+    for (size_t ii = 0; ii < 1000; ++ii) {
+        TEST_ASSERT_EQUAL(static_cast<uint8_t>(ii), out[8 + ii]);
+    }
+    const uint8_t crc = MspStream::crc8_dvb_s2_update(0, &out[3], 5 + 1000);
+    TEST_ASSERT_EQUAL(crc, out[8 + 1000]);
+    TEST_ASSERT_EQUAL(crc, pwh.checksum);
+    TEST_ASSERT_EQUAL(1000, pwh.data_len);
+}
+
+void test_streamed_reply_v1_jumbo()
+{
+    static MspStreamedTest msp;
+    static MspStream msp_stream(msp);
+    static MspSerialPortCapture msp_serial_port;
+    static MspSerial msp_serial(msp_stream, msp_serial_port);
+    static msp_context_t pg;
+
+    msp_stream.set_packet_state(MSP_IDLE);
+
+    // generator supplies less than it declares, so the payload is padded
+    msp._generator._length = 300;
+    msp._generator._supply_length = 250;
+    const std::array<uint8_t, 6> in_stream = { '$', 'M', '<', 0, MSP_DATAFLASH_READ, MSP_DATAFLASH_READ };
+    const size_t count = msp_stream.put_buf(pg, &in_stream[0], in_stream.size());
+    TEST_ASSERT_EQUAL(1, count);
+
+    // V1 jumbo header: size byte of 255 followed by 16-bit size
+    const std::vector<uint8_t>& out = msp_serial_port._out;
+    TEST_ASSERT_EQUAL(7 + 300 + 1, out.size());
+    TEST_ASSERT_EQUAL('M', out[1]);
+    TEST_ASSERT_EQUAL(255, out[3]);
+    TEST_ASSERT_EQUAL(MSP_DATAFLASH_READ, out[4]);
+    TEST_ASSERT_EQUAL(300 & 0xFF, out[5]);
+    TEST_ASSERT_EQUAL(300 >> 8, out[6]);
+    TEST_ASSERT_EQUAL(249, out[7 + 249]);
+    TEST_ASSERT_EQUAL(0, out[7 + 250]);
+    TEST_ASSERT_EQUAL(0, out[7 + 299]);
+    const uint8_t checksum = MspStream::checksum_xor_bytewise(0, &out[3], 4 + 300);
+    TEST_ASSERT_EQUAL(checksum, out[7 + 300]);
+}
+
+class MspDeferredTest : public MspBase {
+public:
+    virtual msp_result_e process_write_command(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src) override;
+    virtual void set_pending_reply(msp_context_t& pg, int16_t cmd_msp, MspPendingReply& pending_reply) override;
+    virtual void expire_pending_reply(msp_context_t& pg, int16_t cmd_msp, MspPendingReply& pending_reply) override {
+        (void)pg;
+        (void)cmd_msp;
+        (void)pending_reply;
+        ++_expired_count;
+    }
+public:
+    MspPendingReply* _pending_reply {};
+    size_t _expired_count {};
+};
+
+msp_result_e MspDeferredTest::process_write_command(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src)
+{
+    // attitude is supplied later by the flight loop
+    if (cmd_msp == MspTest::MSP_ATTITUDE) {
+        return MSP_RESULT_PENDING;
+    }
+    return MspBase::process_write_command(pg, cmd_msp, dst, src);
+}
+
+void MspDeferredTest::set_pending_reply(msp_context_t& pg, int16_t cmd_msp, MspPendingReply& pending_reply)
+{
+    (void)pg;
+    (void)cmd_msp;
+    _pending_reply = &pending_reply;
+}
+
+void test_deferred_reply()
+{
+    static MspDeferredTest msp;
+    static MspStream msp_stream(msp);
+    static MspSerialPortCapture msp_serial_port;
+    static MspSerial msp_serial(msp_stream, msp_serial_port);
+    static msp_context_t pg;
+
+    const std::array<uint8_t, 6> attitude = { '$', 'M', '<', 0, MspTest::MSP_ATTITUDE, MspTest::MSP_ATTITUDE };
+    TEST_ASSERT_EQUAL(1, msp_stream.put_buf(pg, &attitude[0], attitude.size()));
+    TEST_ASSERT_NOT_NULL(msp._pending_reply);
+    TEST_ASSERT_EQUAL(1, msp_stream.get_pending_reply_count());
+    TEST_ASSERT_TRUE(msp_serial_port._out.empty());
+
+    // other commands are answered while the reply is pending
+    const std::array<uint8_t, 6> api_version = { '$', 'M', '<', 0, MSP_API_VERSION, MSP_API_VERSION };
+    TEST_ASSERT_EQUAL(1, msp_stream.put_buf(pg, &api_version[0], api_version.size()));
+    TEST_ASSERT_EQUAL(5 + 3 + 1, msp_serial_port._out.size());
+    msp_serial_port._out.clear();
+    msp_serial.process_output(pg);
+    TEST_ASSERT_TRUE(msp_serial_port._out.empty());
+
+    // reply is completed by another task
+    std::thread flight_loop([]() {
+        const std::array<uint8_t, 6> payload = { 100, 0, 200, 0, 44, 1 };
+        TEST_ASSERT_TRUE(msp._pending_reply->complete(MSP_RESULT_ACK, &payload[0], payload.size()));
+    });
+    flight_loop.join();
+    TEST_ASSERT_FALSE(msp._pending_reply->complete(MSP_RESULT_ACK, nullptr, 0)); // can only be completed once
+
+    msp_serial.process_output(pg);
+    TEST_ASSERT_EQUAL(0, msp_stream.get_pending_reply_count());
+    const std::vector<uint8_t>& out = msp_serial_port._out;
+    TEST_ASSERT_EQUAL(5 + 6 + 1, out.size());
+    TEST_ASSERT_EQUAL('>', out[2]);
+    TEST_ASSERT_EQUAL(6, out[3]);
+    TEST_ASSERT_EQUAL(MspTest::MSP_ATTITUDE, out[4]);
+    TEST_ASSERT_EQUAL(200, out[7]);
+    static constexpr uint8_t replyChecksum = 235;
+    TEST_ASSERT_EQUAL(replyChecksum, out[11]);
+
+    // all pending replies in use, so error reply is sent
+    msp_serial_port._out.clear();
+    for (size_t ii = 0; ii <= MspStream::PENDING_REPLY_COUNT; ++ii) {
+        msp_stream.put_buf(pg, &attitude[0], attitude.size());
+    }
+    TEST_ASSERT_EQUAL(MspStream::PENDING_REPLY_COUNT, msp_stream.get_pending_reply_count());
+    TEST_ASSERT_EQUAL(6, out.size());
+    TEST_ASSERT_EQUAL('!', out[2]);
+
+    // a cancelled reply is answered with an error, and frees its slot
+    msp_serial_port._out.clear();
+    TEST_ASSERT_TRUE(msp._pending_reply->cancel());
+    msp_serial.process_output(pg);
+    TEST_ASSERT_EQUAL(MspStream::PENDING_REPLY_COUNT - 1, msp_stream.get_pending_reply_count());
+    TEST_ASSERT_EQUAL(6, out.size());
+    TEST_ASSERT_EQUAL('!', out[2]);
+    TEST_ASSERT_EQUAL(MspTest::MSP_ATTITUDE, out[4]);
+
+    // replies that are never completed expire, rather than holding their slots forever
+    msp_serial_port._out.clear();
+    msp_stream.expire_pending_replies(pg, time_us());
+    TEST_ASSERT_EQUAL(0, msp._expired_count);
+    msp_stream.expire_pending_replies(pg, time_us() + MspStream::PENDING_REPLY_TIMEOUT_US);
+    TEST_ASSERT_EQUAL(MspStream::PENDING_REPLY_COUNT - 1, msp._expired_count);
+    msp_stream.send_completed_replies();
+    TEST_ASSERT_EQUAL(0, msp_stream.get_pending_reply_count());
+    TEST_ASSERT_EQUAL(6 * (MspStream::PENDING_REPLY_COUNT - 1), out.size());
+    TEST_ASSERT_EQUAL('!', out[2]);
+}
+
+// encodes a command frame, by encoding a reply and changing its direction
+static std::vector<uint8_t> encode_command(int16_t cmd, msp_version_e msp_version)
+{
+    static MspBase msp;
+    static MspStream msp_stream(msp);
+
+    const msp_const_packet_t packet = {
+        .payload = StreamBufReader(nullptr, 0),
+        .cmd = cmd,
+        .result = MSP_RESULT_ACK,
+        .flags = 0,
+        .direction = MspBase::DIRECTION_REQUEST
+    };
+    const msp_stream_packet_with_header_t pwh = msp_stream.serial_encode(packet, msp_version);
+    std::vector<uint8_t> frame;
+    for (size_t ii = 0; ii < pwh.hdr_len; ++ii) {
+        frame.push_back(pwh.hdr_buf[ii]);
+    }
+    for (size_t ii = 0; ii < pwh.crc_len; ++ii) {
+        frame.push_back(pwh.crc_buf[ii]);
+    }
+    frame[2] = '<';
+    return frame;
+}
+
+static msp_stream_packet_with_header_t send_command(MspStream& msp_stream, msp_context_t& pg, const std::vector<uint8_t>& frame)
+{
+    msp_stream_packet_with_header_t pwh {};
+    bool complete = false;
+    for (uint8_t c : frame) {
+        complete = msp_stream.put_char(pg, c, &pwh);
+    }
+    TEST_ASSERT_TRUE(complete);
+    return pwh;
+}
+
+void test_reply_framing_cheapest()
+{
+    static MspTest msp;
+    static MspStream msp_stream(msp);
+    static msp_context_t pg;
+
+    const std::vector<uint8_t> api_version_v2_over_v1 = encode_command(MSP_API_VERSION, MSP_V2_OVER_V1);
+    const std::vector<uint8_t> api_version_v2_native = encode_command(MSP_API_VERSION, MSP_V2_NATIVE);
+    const std::vector<uint8_t> v2_command_v2_over_v1 = encode_command(0x1001, MSP_V2_OVER_V1);
+
+    // by default the reply uses the framing of the command
+    msp_stream.set_packet_state(MSP_IDLE);
+    msp_stream_packet_with_header_t pwh = send_command(msp_stream, pg, api_version_v2_over_v1);
+    TEST_ASSERT_EQUAL(10, pwh.hdr_len);
+    TEST_ASSERT_EQUAL(2, pwh.crc_len);
+    TEST_ASSERT_EQUAL(MspStream::get_framing_overhead(MSP_V2_OVER_V1, 3), pwh.hdr_len + pwh.crc_len);
+    TEST_ASSERT_EQUAL(MspStream::CLIENT_CAPABILITY_V2_OVER_V1, msp_stream.get_client_capabilities());
+
+    // the client parses '$M' frames, so a V1 reply is cheaper
+    msp_stream.set_reply_framing(MSP_REPLY_FRAMING_CHEAPEST);
+    pwh = send_command(msp_stream, pg, api_version_v2_over_v1);
+    TEST_ASSERT_EQUAL('M', pwh.hdr_buf[1]);
+    TEST_ASSERT_EQUAL(5, pwh.hdr_len);
+    TEST_ASSERT_EQUAL(1, pwh.crc_len);
+    TEST_ASSERT_EQUAL(3, pwh.hdr_buf[3]);
+    TEST_ASSERT_EQUAL(MSP_API_VERSION, pwh.hdr_buf[4]);
+    TEST_ASSERT_EQUAL(MSP_PROTOCOL_VERSION ^ MSP_API_VERSION_MAJOR ^ MSP_API_VERSION_MINOR ^ 3 ^ MSP_API_VERSION, pwh.crc_buf[0]);
+
+    // a command above 255 cannot be sent in V1, and until the client has sent a V2 native frame the reply is V2 over V1
+    pwh = send_command(msp_stream, pg, v2_command_v2_over_v1);
+    TEST_ASSERT_EQUAL(10, pwh.hdr_len);
+
+    // once the client has sent a V2 native frame, V2 native is used rather than V2 over V1
+    pwh = send_command(msp_stream, pg, api_version_v2_native);
+    TEST_ASSERT_EQUAL('M', pwh.hdr_buf[1]);
+    pwh = send_command(msp_stream, pg, v2_command_v2_over_v1);
+    TEST_ASSERT_EQUAL('X', pwh.hdr_buf[1]);
+    TEST_ASSERT_EQUAL(8, pwh.hdr_len);
+    TEST_ASSERT_EQUAL(MspStream::CLIENT_CAPABILITY_V2_OVER_V1 | MspStream::CLIENT_CAPABILITY_V2_NATIVE, msp_stream.get_client_capabilities());
+
+    // pushes follow the negotiated framing
+    const std::array<uint8_t, 6> attitude = { 100, 0, 200, 0, 44, 1 };
+    pwh = msp_stream.serial_encode_msp_v1(MspTest::MSP_ATTITUDE, &attitude[0], static_cast<uint8_t>(attitude.size()));
+    TEST_ASSERT_EQUAL('M', pwh.hdr_buf[1]);
+    TEST_ASSERT_EQUAL(5, pwh.hdr_len);
+
+    // a new session starts with no capabilities, so replies again use the framing of the command
+    msp_stream.reset_session();
+    TEST_ASSERT_EQUAL(0, msp_stream.get_client_capabilities());
+    pwh = send_command(msp_stream, pg, api_version_v2_native);
+    TEST_ASSERT_EQUAL('X', pwh.hdr_buf[1]);
+}
 // NOLINTEND(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-pointer-arithmetic,hicpp-use-equals-delete,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-equals-delete,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
 
 int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
@@ -441,6 +755,10 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
     RUN_TEST(test_putchar_array_stream_no_payload);
     RUN_TEST(test_putchar_array_stream_loop);
     RUN_TEST(test_msp_attitude);
+    RUN_TEST(test_streamed_reply_v2_native);
+    RUN_TEST(test_streamed_reply_v1_jumbo);
+    RUN_TEST(test_deferred_reply);
+    RUN_TEST(test_reply_framing_cheapest);
 
     UNITY_END();
 }
@@ -0,0 +1,259 @@
+#include <msp_reliable_window.h>
+#include <msp_serial.h>
+#include <msp_serial_port_base.h>
+#include <msp_stream.h>
+
+#include <vector>
+
+#include <unity.h>
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+struct msp_context_t {
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,cppcoreguidelines-pro-bounds-pointer-arithmetic,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+class MspTest : public MspBase {
+public:
+    static constexpr int16_t MSP2_TEST_READ = 0x3001;
+    static constexpr int16_t MSP2_TEST_INCREMENT = 0x3002; // non-idempotent, with no reply
+    static constexpr int16_t MSP2_TEST_LARGE_READ = 0x3003; // reply too large to retain
+    virtual msp_result_e process_command(msp_context_t& pg, const msp_const_packet_t& command, msp_packet_t& reply) override {
+        _last_flags = command.flags;
+        return MspBase::process_command(pg, command, reply);
+    }
+    virtual msp_result_e process_write_command(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src) override {
+        (void)pg;
+        (void)src;
+        if (cmd_msp == MSP2_TEST_LARGE_READ) {
+            ++_execution_count;
+            for (size_t ii = 0; ii < MspReliableWindow::FRAME_SIZE; ++ii) {
+                dst.write_u8(static_cast<uint8_t>(ii));
+            }
+            return MSP_RESULT_ACK;
+        }
+        if (cmd_msp != MSP2_TEST_READ) {
+            return MSP_RESULT_CMD_UNKNOWN;
+        }
+        ++_execution_count;
+        dst.write_u8(static_cast<uint8_t>(_execution_count));
+        return MSP_RESULT_ACK;
+    }
+    virtual msp_result_e process_read_command(msp_context_t& pg, int16_t cmd_msp, StreamBufReader& src) override {
+        (void)pg;
+        (void)src;
+        if (cmd_msp != MSP2_TEST_INCREMENT) {
+            return MSP_RESULT_CMD_UNKNOWN;
+        }
+        ++_increment_count;
+        return MSP_RESULT_NO_REPLY;
+    }
+public:
+    size_t _execution_count {};
+    size_t _increment_count {};
+    uint8_t _last_flags {};
+};
+
+class MspSerialPortCapture : public MspSerialPortBase {
+public:
+    bool is_data_available() const override { return false; }
+    uint8_t read_byte() override { return 0; }
+    size_t available_for_write() const override { return 256; }
+    size_t write(const uint8_t* buf, size_t len) override {
+        _tx.insert(_tx.end(), buf, buf + len);
+        return len;
+    }
+public:
+    std::vector<uint8_t> _tx;
+};
+
+struct frame_t {
+    uint8_t flags;
+    uint16_t cmd;
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> bytes;
+};
+
+static std::vector<uint8_t> encode_v2(uint8_t flags, uint16_t cmd, const std::vector<uint8_t>& payload)
+{
+    std::vector<uint8_t> frame = { '$', 'X', '<', flags, static_cast<uint8_t>(cmd), static_cast<uint8_t>(cmd >> 8),
+        static_cast<uint8_t>(payload.size()), static_cast<uint8_t>(payload.size() >> 8) };
+    frame.insert(frame.end(), payload.begin(), payload.end());
+    frame.push_back(MspStream::crc8_dvb_s2_update(0, &frame[3], static_cast<uint32_t>(frame.size() - 3)));
+    return frame;
+}
+
+// splits the captured bytes into MSPv2 native frames
+static std::vector<frame_t> decode_v2(std::vector<uint8_t>& tx)
+{
+    std::vector<frame_t> frames;
+    size_t ii = 0;
+    while (ii + 9 <= tx.size()) {
+        TEST_ASSERT_EQUAL('$', tx[ii]);
+        TEST_ASSERT_EQUAL('X', tx[ii + 1]);
+        TEST_ASSERT_EQUAL('>', tx[ii + 2]);
+        const size_t size = tx[ii + 6] | (tx[ii + 7] << 8U);
+        frame_t frame = {
+            .flags = tx[ii + 3],
+            .cmd = static_cast<uint16_t>(tx[ii + 4] | (tx[ii + 5] << 8U)),
+            .payload = std::vector<uint8_t>(tx.begin() + static_cast<std::ptrdiff_t>(ii + 8), tx.begin() + static_cast<std::ptrdiff_t>(ii + 8 + size)),
+            .bytes = std::vector<uint8_t>(tx.begin() + static_cast<std::ptrdiff_t>(ii), tx.begin() + static_cast<std::ptrdiff_t>(ii + 9 + size))
+        };
+        TEST_ASSERT_EQUAL(MspStream::crc8_dvb_s2_update(0, &tx[ii + 3], static_cast<uint32_t>(5 + size)), tx[ii + 8 + size]);
+        frames.push_back(frame);
+        ii += 9 + size;
+    }
+    TEST_ASSERT_EQUAL(tx.size(), ii);
+    tx.clear();
+    return frames;
+}
+
+static void put_frame(MspStream& msp_stream, msp_context_t& pg, const std::vector<uint8_t>& frame)
+{
+    msp_stream.put_buf(pg, &frame[0], frame.size());
+}
+
+void test_reliable_window_flags()
+{
+    TEST_ASSERT_EQUAL(0x80, MspReliableWindow::make_flags(0));
+    TEST_ASSERT_EQUAL(0x9E, MspReliableWindow::make_flags(15));
+    TEST_ASSERT_EQUAL(0x82, MspReliableWindow::make_flags(17)); // sequence wraps
+    TEST_ASSERT_EQUAL(5, MspReliableWindow::get_sequence(MspReliableWindow::make_flags(5) | MspReliableWindow::FLAG_ACK | 0x01));
+    TEST_ASSERT_EQUAL(0x21, MspReliableWindow::strip_flags(0xFF));
+}
+
+void test_reliable_delivery()
+{
+    static MspTest msp;
+    static msp_context_t pg;
+    static MspStream msp_stream(msp);
+    static MspSerialPortCapture port;
+    static MspSerial msp_serial(msp_stream, port);
+    static MspReliableWindow reliable_window;
+    msp_stream.set_reliable_window(&reliable_window);
+
+    // four requests in flight at once
+    std::vector<uint8_t> requests;
+    for (uint8_t sequence = 0; sequence < 4; ++sequence) {
+        const std::vector<uint8_t> request = encode_v2(MspReliableWindow::make_flags(sequence), MspTest::MSP2_TEST_READ, {});
+        requests.insert(requests.end(), request.begin(), request.end());
+    }
+    put_frame(msp_stream, pg, requests);
+    std::vector<frame_t> replies = decode_v2(port._tx);
+    TEST_ASSERT_EQUAL(4, replies.size());
+    for (uint8_t sequence = 0; sequence < 4; ++sequence) {
+        TEST_ASSERT_EQUAL(MspReliableWindow::make_flags(sequence), replies[sequence].flags);
+        TEST_ASSERT_EQUAL(sequence + 1, replies[sequence].payload[0]);
+    }
+    TEST_ASSERT_EQUAL(0, msp._last_flags); // the handler does not see the reliability flags
+    TEST_ASSERT_EQUAL(4, reliable_window.get_retained_count());
+    const std::vector<uint8_t> reply1 = replies[1].bytes;
+
+    // the reply to request 1 was lost, so the client repeats it: the retained reply is resent without executing the command again
+    put_frame(msp_stream, pg, encode_v2(MspReliableWindow::make_flags(1), MspTest::MSP2_TEST_READ, {}));
+    replies = decode_v2(port._tx);
+    TEST_ASSERT_EQUAL(1, replies.size());
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(&reply1[0], &replies[0].bytes[0], reply1.size());
+    TEST_ASSERT_EQUAL(4, msp._execution_count);
+    TEST_ASSERT_EQUAL(1, reliable_window.get_statistics().duplicates);
+
+    // acknowledging 0, 2 and 3 selectively retransmits 1
+    const uint8_t ack_flags = MspReliableWindow::make_flags(0) | MspReliableWindow::FLAG_ACK;
+    put_frame(msp_stream, pg, encode_v2(ack_flags, MspTest::MSP2_TEST_READ, { 0x0D, 0x00 }));
+    replies = decode_v2(port._tx);
+    TEST_ASSERT_EQUAL(1, replies.size());
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(&reply1[0], &replies[0].bytes[0], reply1.size());
+    TEST_ASSERT_EQUAL(1, reliable_window.get_retained_count());
+    TEST_ASSERT_EQUAL(4, msp._execution_count);
+    // both resends of reply 1 are counted as retransmissions, not as new frames
+    const msp_link_statistics_t statistics = msp_serial.get_link_statistics().get_statistics();
+    TEST_ASSERT_EQUAL(2, statistics.tx_retransmitted_frames);
+    TEST_ASSERT_EQUAL(4, statistics.tx_frames[MSP_V2_NATIVE]);
+    TEST_ASSERT_EQUAL(6 * reply1.size(), statistics.tx_wire_bytes);
+
+    put_frame(msp_stream, pg, encode_v2(ack_flags, MspTest::MSP2_TEST_READ, { 0x02, 0x00 }));
+    TEST_ASSERT_EQUAL(0, decode_v2(port._tx).size());
+    TEST_ASSERT_EQUAL(0, reliable_window.get_retained_count());
+    TEST_ASSERT_EQUAL(4, reliable_window.get_statistics().acknowledged);
+
+    // requests implicitly acknowledge replies a window or more behind them
+    for (uint8_t sequence = 4; sequence < 8; ++sequence) {
+        put_frame(msp_stream, pg, encode_v2(MspReliableWindow::make_flags(sequence), MspTest::MSP2_TEST_READ, {}));
+    }
+    TEST_ASSERT_EQUAL(4, reliable_window.get_retained_count());
+    // a repeat of request 5 does not release the replies ahead of it
+    put_frame(msp_stream, pg, encode_v2(MspReliableWindow::make_flags(5), MspTest::MSP2_TEST_READ, {}));
+    TEST_ASSERT_EQUAL(4, reliable_window.get_retained_count());
+    put_frame(msp_stream, pg, encode_v2(MspReliableWindow::make_flags(9), MspTest::MSP2_TEST_READ, {}));
+    TEST_ASSERT_EQUAL(3, reliable_window.get_retained_count()); // 4 and 5 released, 9 retained
+    TEST_ASSERT_EQUAL(6, reliable_window.get_statistics().acknowledged);
+    TEST_ASSERT_EQUAL(0, reliable_window.get_statistics().evicted);
+    TEST_ASSERT_EQUAL(6, decode_v2(port._tx).size());
+    TEST_ASSERT_EQUAL(9, msp._execution_count);
+
+    // unreliable requests are unaffected
+    put_frame(msp_stream, pg, encode_v2(0, MspTest::MSP2_TEST_READ, {}));
+    replies = decode_v2(port._tx);
+    TEST_ASSERT_EQUAL(1, replies.size());
+    TEST_ASSERT_EQUAL(0, replies[0].flags);
+    TEST_ASSERT_EQUAL(3, reliable_window.get_retained_count());
+}
+void test_reliable_duplicate_not_retained()
+{
+    static MspTest msp;
+    static msp_context_t pg;
+    static MspStream msp_stream(msp);
+    static MspSerialPortCapture port;
+    static MspSerial msp_serial(msp_stream, port);
+    static MspReliableWindow reliable_window;
+    msp_stream.set_reliable_window(&reliable_window);
+
+    // a non-idempotent command with no reply is executed once, and a repeat of it is acknowledged rather than executed again
+    put_frame(msp_stream, pg, encode_v2(MspReliableWindow::make_flags(0), MspTest::MSP2_TEST_INCREMENT, {}));
+    TEST_ASSERT_EQUAL(1, msp._increment_count);
+    TEST_ASSERT_EQUAL(0, decode_v2(port._tx).size());
+    put_frame(msp_stream, pg, encode_v2(MspReliableWindow::make_flags(0), MspTest::MSP2_TEST_INCREMENT, {}));
+    TEST_ASSERT_EQUAL(1, msp._increment_count);
+    std::vector<frame_t> replies = decode_v2(port._tx);
+    TEST_ASSERT_EQUAL(1, replies.size());
+    TEST_ASSERT_EQUAL(MspReliableWindow::make_flags(0), replies[0].flags);
+    TEST_ASSERT_EQUAL(MspTest::MSP2_TEST_INCREMENT, replies[0].cmd);
+    TEST_ASSERT_EQUAL(0, replies[0].payload.size());
+
+    // likewise a command whose reply is too large to retain
+    put_frame(msp_stream, pg, encode_v2(MspReliableWindow::make_flags(1), MspTest::MSP2_TEST_LARGE_READ, {}));
+    replies = decode_v2(port._tx);
+    TEST_ASSERT_EQUAL(1, replies.size());
+    TEST_ASSERT_EQUAL(MspReliableWindow::FRAME_SIZE, replies[0].payload.size());
+    TEST_ASSERT_EQUAL(1, reliable_window.get_statistics().not_retained);
+    put_frame(msp_stream, pg, encode_v2(MspReliableWindow::make_flags(1), MspTest::MSP2_TEST_LARGE_READ, {}));
+    replies = decode_v2(port._tx);
+    TEST_ASSERT_EQUAL(1, replies.size());
+    TEST_ASSERT_EQUAL(0, replies[0].payload.size());
+    TEST_ASSERT_EQUAL(1, msp._execution_count);
+    TEST_ASSERT_EQUAL(2, reliable_window.get_statistics().duplicates);
+
+    // once the window has moved on, the sequence number can be reused
+    for (uint8_t sequence = 2; sequence < 16; ++sequence) {
+        put_frame(msp_stream, pg, encode_v2(MspReliableWindow::make_flags(sequence), MspTest::MSP2_TEST_READ, {}));
+    }
+    decode_v2(port._tx);
+    put_frame(msp_stream, pg, encode_v2(MspReliableWindow::make_flags(0), MspTest::MSP2_TEST_INCREMENT, {}));
+    TEST_ASSERT_EQUAL(2, msp._increment_count);
+}
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,cppcoreguidelines-pro-bounds-pointer-arithmetic,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_reliable_window_flags);
+    RUN_TEST(test_reliable_delivery);
+    RUN_TEST(test_reliable_duplicate_not_retained);
+
+    UNITY_END();
+}
@@ -0,0 +1,196 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "msp_serial_port_simulator.h"
+
+#include <algorithm>
+
+
+MspSerialPortSimulator::MspSerialPortSimulator(const config_t& config) :
+    _config(config),
+    _byte_time_ns(static_cast<uint64_t>(config.bits_per_byte) * 1000000000U / config.baud_rate),
+    _seed(config.seed)
+{
+    _tx_fifo.reserve(config.tx_fifo_size);
+    _rx_fifo.reserve(config.rx_fifo_size);
+}
+
+uint32_t MspSerialPortSimulator::random() const
+{
+    _seed = _seed * 1664525U + 1013904223U; // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    return _seed;
+}
+
+/*!
+Inverts each data bit of c with probability bit_error_rate_ppm / 1000000.
+*/
+uint8_t MspSerialPortSimulator::corrupt(uint8_t c) const
+{
+    static constexpr uint32_t PPM = 1000000;
+    if (_config.bit_error_rate_ppm == 0) {
+        return c;
+    }
+    for (unsigned bit = 0; bit < 8; ++bit) {
+        if ((random() >> 8U) % PPM < _config.bit_error_rate_ppm) {
+            c ^= static_cast<uint8_t>(1U << bit);
+            ++_statistics.bit_error_count;
+        }
+    }
+    return c;
+}
+
+/*!
+Advances the virtual clock to time_ns, transmitting and receiving the bytes that complete in that time.
+*/
+void MspSerialPortSimulator::run_link(uint64_t time_ns) const
+{
+    // port to host: the byte at the front of the transmit FIFO is on the wire
+    while (!_tx_fifo.empty() && _tx_next_ns <= time_ns) {
+        _host_rx.push_back(corrupt(_tx_fifo.front()));
+        _tx_fifo.erase(_tx_fifo.begin());
+        ++_statistics.tx_bytes;
+        _statistics.tx_busy_ns += _byte_time_ns;
+        if (!_tx_fifo.empty()) {
+            _tx_next_ns += _byte_time_ns + (_config.jitter_ns ? random() % (_config.jitter_ns + 1) : 0);
+        }
+    }
+    // host to port
+    while (_host_tx_read < _host_tx.size() && _rx_next_ns <= time_ns) {
+        const uint8_t c = corrupt(_host_tx[_host_tx_read++]);
+        if (_rx_fifo.size() - _rx_fifo_read < _config.rx_fifo_size) {
+            _rx_fifo.push_back(c);
+        } else {
+            ++_statistics.rx_overrun_count;
+        }
+        ++_statistics.rx_bytes;
+        _statistics.rx_busy_ns += _byte_time_ns;
+        if (_host_tx_read < _host_tx.size()) {
+            _rx_next_ns += _byte_time_ns + (_config.jitter_ns ? random() % (_config.jitter_ns + 1) : 0);
+        }
+    }
+    if (_host_tx_read == _host_tx.size()) {
+        _host_tx.clear();
+        _host_tx_read = 0;
+    }
+    if (_rx_fifo_read == _rx_fifo.size()) {
+        _rx_fifo.clear();
+        _rx_fifo_read = 0;
+    }
+    _time_ns = time_ns;
+}
+
+bool MspSerialPortSimulator::is_data_available() const
+{
+    _statistics.cpu_ns += _config.poll_ns;
+    run_link(_time_ns + _config.poll_ns);
+    return _rx_fifo_read < _rx_fifo.size();
+}
+
+uint8_t MspSerialPortSimulator::read_byte()
+{
+    _statistics.cpu_ns += _config.byte_ns;
+    run_link(_time_ns + _config.byte_ns);
+    if (_rx_fifo_read == _rx_fifo.size()) {
+        return 0;
+    }
+    return _rx_fifo[_rx_fifo_read++];
+}
+
+size_t MspSerialPortSimulator::available_for_write() const
+{
+    _statistics.cpu_ns += _config.poll_ns;
+    run_link(_time_ns + _config.poll_ns);
+    return _config.tx_fifo_size - _tx_fifo.size();
+}
+
+size_t MspSerialPortSimulator::write(const uint8_t* buf, size_t len)
+{
+    len = std::min(len, _config.tx_fifo_size - _tx_fifo.size());
+    for (size_t ii = 0; ii < len; ++ii) {
+        if (_tx_fifo.empty()) {
+            // line is idle, so transmission starts now
+            _tx_next_ns = _time_ns + _byte_time_ns;
+        }
+        _tx_fifo.push_back(buf[ii]); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    }
+    const uint64_t cpu_ns = static_cast<uint64_t>(_config.byte_ns) * len;
+    _statistics.cpu_ns += cpu_ns;
+    run_link(_time_ns + cpu_ns);
+    return len;
+}
+
+bool MspSerialPortSimulator::wait_for_write_space(size_t len, uint32_t timeout_us)
+{
+    const uint64_t timeout_ns = _time_ns + static_cast<uint64_t>(timeout_us) * 1000U;
+    len = std::min(len, static_cast<size_t>(_config.tx_fifo_size));
+    while (_config.tx_fifo_size - _tx_fifo.size() < len) {
+        if (_tx_next_ns > timeout_ns) {
+            run_link(timeout_ns);
+            return false;
+        }
+        run_link(_tx_next_ns);
+    }
+    return true;
+}
+
+/*!
+Queues data to be sent from the host to the port, it arrives in the port's receive FIFO at the baud rate.
+*/
+void MspSerialPortSimulator::host_write(const uint8_t* data, size_t len)
+{
+    if (_host_tx_read == _host_tx.size()) {
+        // line is idle, so transmission starts now
+        _rx_next_ns = _time_ns + _byte_time_ns;
+    }
+    _host_tx.insert(_host_tx.end(), data, data + len); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+}
+
+/*!
+Reads data the host has received from the port.
+*/
+size_t MspSerialPortSimulator::host_read(uint8_t* buf, size_t len)
+{
+    len = std::min(len, host_bytes_available());
+    std::copy_n(_host_rx.begin() + static_cast<std::ptrdiff_t>(_host_rx_read), len, buf);
+    _host_rx_read += len;
+    if (_host_rx_read == _host_rx.size()) {
+        _host_rx.clear();
+        _host_rx_read = 0;
+    }
+    return len;
+}
+
+float MspSerialPortSimulator::get_tx_utilisation() const
+{
+    const uint64_t elapsed_ns = _time_ns - _statistics_start_ns;
+    return elapsed_ns == 0 ? 0.0F : static_cast<float>(static_cast<double>(_statistics.tx_busy_ns) / static_cast<double>(elapsed_ns));
+}
+
+float MspSerialPortSimulator::get_rx_utilisation() const
+{
+    const uint64_t elapsed_ns = _time_ns - _statistics_start_ns;
+    return elapsed_ns == 0 ? 0.0F : static_cast<float>(static_cast<double>(_statistics.rx_busy_ns) / static_cast<double>(elapsed_ns));
+}
+
+float MspSerialPortSimulator::get_cpu_utilisation() const
+{
+    const uint64_t elapsed_ns = _time_ns - _statistics_start_ns;
+    return elapsed_ns == 0 ? 0.0F : static_cast<float>(static_cast<double>(_statistics.cpu_ns) / static_cast<double>(elapsed_ns));
+}
@@ -0,0 +1,115 @@
+/*
+ * This file is part of the MultiWiiSerialProtocol library.
+ *
+ * The MultiWiiSerialProtocol library is free software. You can redistribute
+ * this software and/or modify this software under the terms of the
+ * GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * The MultiWiiSerialProtocol library is distributed in the hope that they
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.
+ *
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <msp_serial_port_base.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/*!
+Simulated serial port, for benchmarking MSP links on native without hardware.
+Test only: it allocates its FIFOs on the heap, so is not part of the library.
+
+The port runs on a virtual clock that is advanced by the simulator, rather than in real time.
+Bytes are transmitted at the configured baud rate, with an optional random gap (jitter) between bytes and optional bit errors.
+The transmit and receive FIFOs have the configured depth: writes are limited to the space in the transmit FIFO
+and bytes arriving when the receive FIFO is full are lost (an overrun).
+
+Each call made by the MSP library advances the virtual clock by a CPU cost, so that busy-waiting in MspSerial::send_frame()
+consumes time, and the CPU time spent by the MSP task can be measured.
+
+The other end of the link (the host, eg a ground station) uses host_write() and host_read().
+*/
+class MspSerialPortSimulator : public MspSerialPortBase {
+public:
+    struct config_t {
+        uint32_t baud_rate { 115200 };
+        uint32_t bits_per_byte { 10 };          // start bit, 8 data bits, stop bit
+        uint32_t tx_fifo_size { 32 };
+        uint32_t rx_fifo_size { 32 };
+        uint32_t jitter_ns { 0 };               // maximum random gap added after each byte
+        uint32_t bit_error_rate_ppm { 0 };      // probability, in parts per million, of each data bit being inverted
+        uint32_t poll_ns { 100 };               // CPU time of a call to is_data_available() or available_for_write()
+        uint32_t byte_ns { 20 };                // CPU time to read or write a byte
+        uint32_t seed { 1 };
+    };
+    struct statistics_t {
+        uint64_t tx_bytes;          // bytes transmitted to the host
+        uint64_t rx_bytes;          // bytes received from the host
+        uint64_t tx_busy_ns;        // time the transmit line was busy
+        uint64_t rx_busy_ns;        // time the receive line was busy
+        uint64_t cpu_ns;            // CPU time spent in calls to the port
+        uint32_t rx_overrun_count;  // bytes lost because the receive FIFO was full
+        uint32_t bit_error_count;   // bits inverted, in either direction
+    };
+public:
+    explicit MspSerialPortSimulator(const config_t& config);
+    // MspSerialPortBase functions
+    bool is_data_available() const override;
+    uint8_t read_byte() override;
+    size_t available_for_write() const override;
+    size_t write(const uint8_t* buf, size_t len) override;
+    // models a transmit interrupt: the virtual clock is advanced to when the space becomes available, without consuming CPU time
+    bool wait_for_write_space(size_t len, uint32_t timeout_us) override;
+public:
+    // host side of the link
+    void host_write(const uint8_t* data, size_t len);
+    size_t host_read(uint8_t* buf, size_t len);
+    size_t host_bytes_available() const { return _host_rx.size() - _host_rx_read; }
+    // virtual clock, advancing it runs the link
+    uint64_t get_time_ns() const { return _time_ns; }
+    void advance_time_ns(uint64_t ns) const { run_link(_time_ns + ns); }
+    void advance_time_to_ns(uint64_t time_ns) const { if (time_ns > _time_ns) { run_link(time_ns); } }
+    // utilisation of each direction, as a fraction of the time elapsed since the statistics were reset
+    float get_tx_utilisation() const;
+    float get_rx_utilisation() const;
+    float get_cpu_utilisation() const;
+    const statistics_t& get_statistics() const { return _statistics; }
+    void reset_statistics() { _statistics = statistics_t {}; _statistics_start_ns = _time_ns; }
+    const config_t& get_config() const { return _config; }
+    uint64_t get_byte_time_ns() const { return _byte_time_ns; }
+private:
+    void run_link(uint64_t time_ns) const; // const, since it is called from the const MspSerialPortBase functions
+    uint8_t corrupt(uint8_t c) const;
+    uint32_t random() const;
+private:
+    const config_t _config;
+    const uint64_t _byte_time_ns;
+    // the state of the link changes with the virtual clock, which is advanced even by the const functions
+    mutable uint64_t _time_ns {};
+    mutable uint64_t _statistics_start_ns {};
+    mutable uint32_t _seed;
+    mutable statistics_t _statistics {};
+    // port to host
+    mutable std::vector<uint8_t> _tx_fifo;
+    mutable uint64_t _tx_next_ns {}; // time at which the byte at the front of the transmit FIFO will have been transmitted
+    mutable std::vector<uint8_t> _host_rx;
+    mutable size_t _host_rx_read {};
+    // host to port
+    mutable std::vector<uint8_t> _host_tx;
+    mutable size_t _host_tx_read {};
+    mutable uint64_t _rx_next_ns {};
+    mutable std::vector<uint8_t> _rx_fifo;
+    mutable size_t _rx_fifo_read {};
+};
@@ -0,0 +1,521 @@
+#include "msp_serial_port_simulator.h"
+
+#include <msp_frame_queue.h>
+#include <msp_link_statistics.h>
+#include <msp_protocol.h>
+#include <msp_serial.h>
+#include <msp_stream.h>
+#include <msp_task.h>
+#include <msp_tx_notification.h>
+
+#include <cstdio>
+
+#include <unity.h>
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+struct msp_context_t {
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+void test_simulator_timing()
+{
+    MspSerialPortSimulator port({ .baud_rate = 115200, .tx_fifo_size = 32, .poll_ns = 0, .byte_ns = 0 });
+    TEST_ASSERT_EQUAL(86805, port.get_byte_time_ns());
+
+    std::array<uint8_t, 40> data {};
+    for (size_t ii = 0; ii < data.size(); ++ii) {
+        data[ii] = static_cast<uint8_t>(ii);
+    }
+    TEST_ASSERT_EQUAL(32, port.available_for_write());
+    TEST_ASSERT_EQUAL(32, port.write(&data[0], data.size())); // limited by the FIFO size
+    TEST_ASSERT_EQUAL(0, port.available_for_write());
+
+    port.advance_time_ns(port.get_byte_time_ns() * 10);
+    TEST_ASSERT_EQUAL(10, port.available_for_write());
+    TEST_ASSERT_EQUAL(10, port.host_bytes_available());
+    port.advance_time_ns(port.get_byte_time_ns() * 30);
+    TEST_ASSERT_EQUAL(32, port.host_bytes_available());
+    std::array<uint8_t, 40> received {};
+    TEST_ASSERT_EQUAL(32, port.host_read(&received[0], received.size()));
+    TEST_ASSERT_EQUAL(0, received[0]);
+    TEST_ASSERT_EQUAL(31, received[31]);
+    TEST_ASSERT_EQUAL_FLOAT(32.0F / 40.0F, port.get_tx_utilisation());
+}
+
+void test_simulator_rx_overrun()
+{
+    MspSerialPortSimulator port({ .baud_rate = 1000000, .rx_fifo_size = 32 });
+
+    std::array<uint8_t, 100> data {};
+    for (size_t ii = 0; ii < data.size(); ++ii) {
+        data[ii] = static_cast<uint8_t>(ii);
+    }
+    port.host_write(&data[0], data.size());
+    port.advance_time_ns(port.get_byte_time_ns() * 100);
+    TEST_ASSERT_EQUAL(68, port.get_statistics().rx_overrun_count);
+
+    size_t count = 0;
+    while (port.is_data_available()) {
+        TEST_ASSERT_EQUAL(count, port.read_byte());
+        ++count;
+    }
+    TEST_ASSERT_EQUAL(32, count);
+}
+
+void test_simulator_bit_errors()
+{
+    MspSerialPortSimulator port({ .baud_rate = 1000000, .tx_fifo_size = 64, .bit_error_rate_ppm = 10000, .seed = 7 });
+
+    enum { BYTE_COUNT = 10000 };
+    std::array<uint8_t, 64> data {};
+    size_t errored_byte_count = 0;
+    for (size_t sent = 0; sent < BYTE_COUNT; sent += data.size()) {
+        port.write(&data[0], data.size());
+        port.advance_time_ns(port.get_byte_time_ns() * data.size());
+        std::array<uint8_t, 64> received {};
+        const size_t len = port.host_read(&received[0], received.size());
+        TEST_ASSERT_EQUAL(data.size(), len);
+        for (uint8_t c : received) {
+            errored_byte_count += (c != 0) ? 1 : 0;
+        }
+    }
+    // 1% of the 80000 or so bits
+    const uint32_t bit_error_count = port.get_statistics().bit_error_count;
+    TEST_ASSERT_TRUE(bit_error_count > 600 && bit_error_count < 1000);
+    TEST_ASSERT_TRUE(errored_byte_count > 0 && errored_byte_count <= bit_error_count);
+}
+
+/*
+Link benchmark: a host pipelines requests for a 64 byte reply, with two requests outstanding, and the MSP task runs every millisecond.
+Reports the link utilisation achieved and the CPU used by the MSP task, most of which is spent busy-waiting in send_frame() for space in the transmit FIFO.
+*/
+class MspBenchmark : public MspBase {
+public:
+    enum { REPLY_SIZE = 64 };
+    virtual msp_result_e process_write_command(msp_context_t& pg, int16_t cmd_msp, StreamBufWriter& dst, StreamBufReader& src) override {
+        (void)pg;
+        (void)src;
+        if (cmd_msp != MSP_ATTITUDE) {
+            return MSP_RESULT_CMD_UNKNOWN;
+        }
+        for (size_t ii = 0; ii < REPLY_SIZE; ++ii) {
+            dst.write_u8(static_cast<uint8_t>(ii));
+        }
+        return MSP_RESULT_ACK;
+    }
+};
+
+static void run_link_benchmark(uint32_t baud_rate, uint32_t tx_fifo_size)
+{
+    static MspBenchmark msp;
+    static msp_context_t pg;
+    MspStream msp_stream(msp);
+    MspSerialPortSimulator port({ .baud_rate = baud_rate, .tx_fifo_size = tx_fifo_size, .rx_fifo_size = 32 });
+    MspSerial msp_serial(msp_stream, port);
+
+    static constexpr std::array<uint8_t, 6> request = { '$', 'M', '<', 0, MSP_ATTITUDE, MSP_ATTITUDE };
+    enum { REPLY_FRAME_SIZE = MspBenchmark::REPLY_SIZE + 6, TASK_INTERVAL_NS = 1000000, DURATION_NS = 1000000000 };
+
+    port.host_write(&request[0], request.size());
+    port.host_write(&request[0], request.size());
+    uint32_t reply_count = 0;
+    size_t received = 0;
+    uint64_t tick_ns = 0;
+    while (port.get_time_ns() < DURATION_NS) {
+        tick_ns += TASK_INTERVAL_NS;
+        port.advance_time_to_ns(tick_ns);
+        msp_serial.process_input(pg);
+        msp_serial.process_output(pg);
+        std::array<uint8_t, 256> buf {};
+        received += port.host_read(&buf[0], buf.size());
+        while (received >= REPLY_FRAME_SIZE) {
+            received -= REPLY_FRAME_SIZE;
+            ++reply_count;
+            port.host_write(&request[0], request.size());
+        }
+    }
+
+    std::array<char, 160> message {};
+    std::snprintf(&message[0], message.size(), "%7u baud, %3u byte TX FIFO: %4u replies/s, TX utilisation %5.1f%%, MSP task CPU %5.1f%%",
+        static_cast<unsigned>(baud_rate), static_cast<unsigned>(tx_fifo_size), static_cast<unsigned>(reply_count),
+        static_cast<double>(port.get_tx_utilisation()) * 100.0, static_cast<double>(port.get_cpu_utilisation()) * 100.0);
+    TEST_MESSAGE(&message[0]);
+    TEST_ASSERT_TRUE(reply_count > 0);
+    TEST_ASSERT_EQUAL(0, port.get_statistics().rx_overrun_count);
+}
+
+void test_simulator_link_benchmark()
+{
+    run_link_benchmark(115200, 32);
+    run_link_benchmark(115200, 256);
+    run_link_benchmark(1000000, 32);
+    run_link_benchmark(1000000, 256);
+}
+static uint32_t read_u32(const uint8_t* data)
+{
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8U) | (static_cast<uint32_t>(data[2]) << 16U) | (static_cast<uint32_t>(data[3]) << 24U); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+}
+
+void test_link_statistics()
+{
+    static MspBase msp;
+    static msp_context_t pg;
+    MspStream msp_stream(msp);
+    MspSerialPortSimulator port({ .baud_rate = 1000000, .tx_fifo_size = 256, .rx_fifo_size = 256 });
+    MspSerial msp_serial(msp_stream, port);
+
+    // 10 MSP_API_VERSION requests, each with a 3 byte reply, with some noise between them
+    static constexpr std::array<uint8_t, 6> api_version = { '$', 'M', '<', 0, MSP_API_VERSION, MSP_API_VERSION };
+    static constexpr std::array<uint8_t, 2> noise = { 0x55, 0xAA };
+    for (size_t ii = 0; ii < 10; ++ii) {
+        port.host_write(&api_version[0], api_version.size());
+        port.host_write(&noise[0], noise.size());
+    }
+    port.advance_time_ns(port.get_byte_time_ns() * 80);
+    msp_serial.process_input(pg);
+    port.advance_time_ns(port.get_byte_time_ns() * 200);
+
+    msp_link_statistics_t statistics = msp_serial.get_link_statistics().get_statistics();
+    TEST_ASSERT_EQUAL(80, statistics.rx_wire_bytes);
+    TEST_ASSERT_EQUAL(0, statistics.rx_payload_bytes);
+    TEST_ASSERT_EQUAL(10, statistics.rx_frames[MSP_V1]);
+    TEST_ASSERT_EQUAL(60, statistics.rx_framing_bytes[MSP_V1]);
+    TEST_ASSERT_EQUAL(10, statistics.tx_frames[MSP_V1]);
+    TEST_ASSERT_EQUAL(30, statistics.tx_payload_bytes);
+    TEST_ASSERT_EQUAL(60, statistics.tx_framing_bytes[MSP_V1]);
+    TEST_ASSERT_EQUAL(90, statistics.tx_wire_bytes);
+    TEST_ASSERT_EQUAL(90, port.host_bytes_available());
+    std::array<uint8_t, 128> buf {};
+    port.host_read(&buf[0], buf.size());
+
+    // the statistics are also available through MSP2_LINK_STATISTICS
+    std::array<uint8_t, 9> link_statistics = { '$', 'X', '<', 0, MSP2_LINK_STATISTICS & 0xFFU, MSP2_LINK_STATISTICS >> 8U, 0, 0, 0 };
+    link_statistics[8] = MspStream::crc8_dvb_s2_update(0, &link_statistics[3], 5);
+    port.host_write(&link_statistics[0], link_statistics.size());
+    port.advance_time_ns(port.get_byte_time_ns() * link_statistics.size());
+    msp_serial.process_input(pg);
+    port.advance_time_ns(port.get_byte_time_ns() * 200);
+
+    const size_t len = port.host_read(&buf[0], buf.size());
+    TEST_ASSERT_EQUAL(8 + MspLinkStatistics::MSP_PAYLOAD_SIZE + 1, len);
+    TEST_ASSERT_EQUAL('X', buf[1]);
+    TEST_ASSERT_EQUAL('>', buf[2]);
+    TEST_ASSERT_EQUAL(MspLinkStatistics::MSP_PAYLOAD_SIZE, buf[6]);
+    const uint8_t* payload = &buf[8];
+    TEST_ASSERT_EQUAL(90, read_u32(payload)); // tx_wire_bytes, the reply itself is not yet counted
+    TEST_ASSERT_EQUAL(30, read_u32(payload + 4)); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    TEST_ASSERT_EQUAL(89, read_u32(payload + 8)); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    // rx frames for MSP V2 native
+    TEST_ASSERT_EQUAL(1, read_u32(payload + 40 + 2*16 + 8)); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    TEST_ASSERT_EQUAL(0, read_u32(payload + 40 + 4*16)); // tx_retransmitted_frames NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    TEST_ASSERT_EQUAL(1, msp_serial.get_link_statistics().get_statistics().tx_frames[MSP_V2_NATIVE]);
+}
+
+void test_link_statistics_rates()
+{
+    MspLinkStatistics link_statistics;
+
+    // 1000 bytes transmitted in every bucket
+    uint32_t time_microseconds = 1000;
+    for (size_t ii = 0; ii < 20; ++ii) {
+        link_statistics.update_rates(time_microseconds);
+        link_statistics.record_wire_bytes(MspLinkStatistics::TX, 1000);
+        time_microseconds += MspLinkStatistics::WINDOW_BUCKET_US;
+    }
+    TEST_ASSERT_EQUAL(8000, link_statistics.get_statistics().tx_wire_rate);
+
+    // the link goes idle, and the rate decays as the window slides
+    for (size_t ii = 0; ii < 4; ++ii) {
+        link_statistics.update_rates(time_microseconds);
+        time_microseconds += MspLinkStatistics::WINDOW_BUCKET_US;
+    }
+    TEST_ASSERT_EQUAL(8000 * 4 / 7, link_statistics.get_statistics().tx_wire_rate);
+    // updates within a bucket do not change the rates
+    link_statistics.record_wire_bytes(MspLinkStatistics::TX, 1000);
+    link_statistics.update_rates(time_microseconds - MspLinkStatistics::WINDOW_BUCKET_US + 1);
+    TEST_ASSERT_EQUAL(8000 * 4 / 7, link_statistics.get_statistics().tx_wire_rate);
+    TEST_ASSERT_EQUAL(0, link_statistics.get_statistics().rx_wire_rate);
+}
+void test_input_budget()
+{
+    static MspBase msp;
+    static msp_context_t pg;
+    MspStream msp_stream(msp);
+    MspSerialPortSimulator port({ .baud_rate = 1000000, .tx_fifo_size = 256, .rx_fifo_size = 256 });
+    MspSerial msp_serial(msp_stream, port);
+
+    // 32 bytes per tick is 5 frames and the first 2 bytes of the next
+    msp_serial.set_input_budget({ .max_bytes = 32, .max_frames = 0, .max_microseconds = 0 });
+
+    static constexpr std::array<uint8_t, 6> api_version = { '$', 'M', '<', 0, MSP_API_VERSION, MSP_API_VERSION };
+    for (size_t ii = 0; ii < 20; ++ii) {
+        port.host_write(&api_version[0], api_version.size());
+    }
+    port.advance_time_ns(port.get_byte_time_ns() * 120);
+
+    msp_serial.process_input(pg);
+    TEST_ASSERT_EQUAL(5, msp_serial.get_link_statistics().get_statistics().rx_frames[MSP_V1]);
+    TEST_ASSERT_EQUAL(MSP_HEADER_M, msp_stream.get_packet_state());
+    TEST_ASSERT_EQUAL(1, msp_serial.get_input_budget_exhausted_count());
+
+    // the partially received frame is completed on the next tick, and the last 24 bytes are within the budget
+    for (size_t ii = 0; ii < 3; ++ii) {
+        msp_serial.process_input(pg);
+    }
+    TEST_ASSERT_EQUAL(20, msp_serial.get_link_statistics().get_statistics().rx_frames[MSP_V1]);
+    TEST_ASSERT_EQUAL(3, msp_serial.get_input_budget_exhausted_count());
+    TEST_ASSERT_FALSE(port.is_data_available());
+
+    // frame budget
+    msp_serial.set_input_budget({ .max_bytes = 0, .max_frames = 12, .max_microseconds = 0 });
+    for (size_t ii = 0; ii < 30; ++ii) {
+        port.host_write(&api_version[0], api_version.size());
+    }
+    port.advance_time_ns(port.get_byte_time_ns() * 180);
+    msp_serial.process_input(pg);
+    // checked after each 64 byte chunk, so stops after the second chunk
+    TEST_ASSERT_EQUAL(20 + 21, msp_serial.get_link_statistics().get_statistics().rx_frames[MSP_V1]);
+    TEST_ASSERT_EQUAL(4, msp_serial.get_input_budget_exhausted_count());
+    msp_serial.process_input(pg);
+    TEST_ASSERT_EQUAL(20 + 30, msp_serial.get_link_statistics().get_statistics().rx_frames[MSP_V1]);
+    TEST_ASSERT_EQUAL(4, msp_serial.get_input_budget_exhausted_count());
+}
+void test_adaptive_interval()
+{
+    static MspBase msp;
+    static msp_context_t pg;
+    static MspStream msp_stream(msp);
+    static MspSerialPortSimulator port({});
+    static MspSerial msp_serial(msp_stream, port);
+    task_info_t task_info {};
+    MspTask* msp_task = MspTask::create_task(task_info, msp_serial, pg, 1, 0, 10000);
+    TEST_ASSERT_EQUAL(10000, msp_task->get_current_interval_microseconds());
+
+    // starts idle, at the maximum interval
+    msp_task->set_adaptive_interval(1000, 50000);
+    TEST_ASSERT_EQUAL(50000, msp_task->get_current_interval_microseconds());
+
+    uint32_t time_us = 1000000;
+    TEST_ASSERT_EQUAL(1000, msp_task->update_adaptive_interval(time_us, true));
+    TEST_ASSERT_EQUAL(1000, msp_task->get_current_interval_microseconds());
+
+    // held at the minimum while the link has been idle for less than the hold time
+    time_us += MspTask::ADAPTIVE_HOLD_MICROSECONDS - 1;
+    TEST_ASSERT_EQUAL(1000, msp_task->update_adaptive_interval(time_us, false));
+
+    // then backs off exponentially, up to the maximum
+    time_us += 1;
+    TEST_ASSERT_EQUAL(2000, msp_task->update_adaptive_interval(time_us, false));
+    TEST_ASSERT_EQUAL(4000, msp_task->update_adaptive_interval(time_us, false));
+    TEST_ASSERT_EQUAL(8000, msp_task->update_adaptive_interval(time_us, false));
+    TEST_ASSERT_EQUAL(16000, msp_task->update_adaptive_interval(time_us, false));
+    TEST_ASSERT_EQUAL(32000, msp_task->update_adaptive_interval(time_us, false));
+    TEST_ASSERT_EQUAL(50000, msp_task->update_adaptive_interval(time_us, false));
+    TEST_ASSERT_EQUAL(50000, msp_task->update_adaptive_interval(time_us, false));
+    TEST_ASSERT_EQUAL(50000, msp_task->get_current_interval_microseconds());
+    // the caller's task_info is not written to once create_task() has returned
+    TEST_ASSERT_EQUAL(10000, task_info.task_interval_microseconds);
+
+    // and returns to the minimum as soon as input arrives
+    TEST_ASSERT_EQUAL(1000, msp_task->update_adaptive_interval(time_us, true));
+
+    // disabling restores the fixed interval
+    msp_task->set_adaptive_interval(0, 0);
+    TEST_ASSERT_EQUAL(10000, msp_task->get_current_interval_microseconds());
+    TEST_ASSERT_EQUAL(10000, msp_task->update_adaptive_interval(time_us, true));
+}
+void test_tx_wait_policy()
+{
+    static MspBenchmark msp;
+    static msp_context_t pg;
+    MspStream msp_stream(msp);
+    MspSerialPortSimulator port({ .baud_rate = 115200, .tx_fifo_size = 32 });
+    MspSerial msp_serial(msp_stream, port);
+
+    TEST_ASSERT_EQUAL(MSP_TX_WAIT_DEFAULT, msp_serial.get_tx_wait_policy());
+    TEST_ASSERT_EQUAL(0, msp_serial.get_tx_drain_time_us(32));
+    // sleeping requires the baud rate
+    msp_serial.set_tx_wait_policy(MSP_TX_WAIT_SLEEP);
+    TEST_ASSERT_EQUAL(MSP_TX_WAIT_YIELD, msp_serial.get_tx_wait_policy());
+    msp_serial.set_tx_wait_policy(MSP_TX_WAIT_SLEEP, 115200);
+    TEST_ASSERT_EQUAL(MSP_TX_WAIT_SLEEP, msp_serial.get_tx_wait_policy());
+    TEST_ASSERT_EQUAL(2778, msp_serial.get_tx_drain_time_us(32));
+    TEST_ASSERT_EQUAL(87, msp_serial.get_tx_drain_time_us(1));
+
+    // a reply larger than the transmit FIFO is sent completely, spinning while the FIFO drains
+    msp_serial.set_tx_wait_policy(MSP_TX_WAIT_SPIN);
+    static constexpr std::array<uint8_t, 6> request = { '$', 'M', '<', 0, MSP_ATTITUDE, MSP_ATTITUDE };
+    port.host_write(&request[0], request.size());
+    port.advance_time_ns(port.get_byte_time_ns() * request.size());
+    msp_serial.process_input(pg);
+    port.advance_time_ns(port.get_byte_time_ns() * 32);
+    TEST_ASSERT_EQUAL(MspBenchmark::REPLY_SIZE + 6, port.host_bytes_available());
+}
+void test_tx_notification()
+{
+    MspTxNotification notification;
+    TEST_ASSERT_FALSE(notification.is_waiting());
+
+    notification.prepare_wait(10);
+    TEST_ASSERT_TRUE(notification.is_waiting());
+    notification.notify_from_isr(5); // not enough space yet
+    TEST_ASSERT_TRUE(notification.is_waiting());
+    notification.notify_from_isr(10);
+    TEST_ASSERT_FALSE(notification.is_waiting());
+    TEST_ASSERT_TRUE(notification.wait(100));
+
+    // times out if the interrupt does not signal
+    notification.prepare_wait(10);
+    TEST_ASSERT_FALSE(notification.wait(100));
+    TEST_ASSERT_FALSE(notification.is_waiting());
+}
+
+static uint64_t send_reply_cpu_ns(msp_tx_wait_policy_e tx_wait_policy)
+{
+    static MspBenchmark msp;
+    static msp_context_t pg;
+    MspStream msp_stream(msp);
+    MspSerialPortSimulator port({ .baud_rate = 115200, .tx_fifo_size = 16 });
+    MspSerial msp_serial(msp_stream, port);
+    msp_serial.set_tx_wait_policy(tx_wait_policy, 115200);
+
+    static constexpr std::array<uint8_t, 6> request = { '$', 'M', '<', 0, MSP_ATTITUDE, MSP_ATTITUDE };
+    port.host_write(&request[0], request.size());
+    port.advance_time_ns(port.get_byte_time_ns() * request.size());
+    port.reset_statistics();
+    msp_serial.process_input(pg);
+    port.advance_time_ns(port.get_byte_time_ns() * 16);
+    TEST_ASSERT_EQUAL(MspBenchmark::REPLY_SIZE + 6, port.host_bytes_available());
+    return port.get_statistics().cpu_ns;
+}
+
+void test_tx_wait_notify()
+{
+    // with notification the task does not poll the port while the transmit FIFO drains
+    const uint64_t spin_cpu_ns = send_reply_cpu_ns(MSP_TX_WAIT_SPIN);
+    const uint64_t notify_cpu_ns = send_reply_cpu_ns(MSP_TX_WAIT_NOTIFY);
+    TEST_ASSERT_TRUE(notify_cpu_ns * 10 < spin_cpu_ns);
+
+    std::array<char, 128> message {};
+    std::snprintf(&message[0], message.size(), "70 byte reply, 16 byte FIFO: spin %.1f us CPU, notify %.1f us CPU",
+        static_cast<double>(spin_cpu_ns) / 1000.0, static_cast<double>(notify_cpu_ns) / 1000.0);
+    TEST_MESSAGE(&message[0]);
+}
+class MspSerialPortCountingWrites : public MspSerialPortSimulator {
+public:
+    explicit MspSerialPortCountingWrites(const config_t& config) : MspSerialPortSimulator(config) {}
+    size_t write(const uint8_t* buf, size_t len) override {
+        if (len > 0) {
+            ++_write_count;
+        }
+        return MspSerialPortSimulator::write(buf, len);
+    }
+public:
+    size_t _write_count {};
+};
+
+void test_tx_coalescing()
+{
+    static MspBase msp;
+    static msp_context_t pg;
+    MspStream msp_stream(msp);
+    MspSerialPortCountingWrites port({ .baud_rate = 1000000, .tx_fifo_size = 256, .rx_fifo_size = 256 });
+    MspSerial msp_serial(msp_stream, port);
+
+    static constexpr std::array<uint8_t, 6> api_version = { '$', 'M', '<', 0, MSP_API_VERSION, MSP_API_VERSION };
+    enum { REPLY_SIZE = 6 + 3, REQUEST_COUNT = 10 };
+    auto send_requests = [&port]() {
+        for (size_t ii = 0; ii < REQUEST_COUNT; ++ii) {
+            port.host_write(&api_version[0], api_version.size());
+        }
+        port.advance_time_ns(port.get_byte_time_ns() * api_version.size() * REQUEST_COUNT);
+    };
+
+    // without coalescing each reply is written as header, payload and checksum
+    send_requests();
+    msp_serial.process_input(pg);
+    TEST_ASSERT_EQUAL(3 * REQUEST_COUNT, port._write_count);
+
+    // with coalescing the replies are written as full packets, and the remainder at the end of process_input()
+    msp_serial.set_tx_coalescing(32, 0);
+    port._write_count = 0;
+    send_requests();
+    msp_serial.process_input(pg);
+    TEST_ASSERT_EQUAL(0, msp_serial.get_tx_coalesced_len());
+    TEST_ASSERT_EQUAL(REQUEST_COUNT * REPLY_SIZE / 32 + 1, port._write_count);
+
+    // with a flush timeout, the partial packet is held over to the next call
+    msp_serial.set_tx_coalescing(32, 1000000);
+    port._write_count = 0;
+    send_requests();
+    msp_serial.process_input(pg);
+    TEST_ASSERT_EQUAL(REQUEST_COUNT * REPLY_SIZE / 32, port._write_count);
+    TEST_ASSERT_EQUAL(REQUEST_COUNT * REPLY_SIZE % 32, msp_serial.get_tx_coalesced_len());
+    msp_serial.flush_tx();
+    TEST_ASSERT_EQUAL(REQUEST_COUNT * REPLY_SIZE / 32 + 1, port._write_count);
+
+    // and all the replies arrive intact
+    port.advance_time_ns(port.get_byte_time_ns() * 3 * REQUEST_COUNT * REPLY_SIZE);
+    TEST_ASSERT_EQUAL(3 * REQUEST_COUNT * REPLY_SIZE, port.host_bytes_available());
+    std::array<uint8_t, 3 * REQUEST_COUNT * REPLY_SIZE> received {};
+    port.host_read(&received[0], received.size());
+    for (size_t ii = 0; ii < received.size(); ii += REPLY_SIZE) {
+        TEST_ASSERT_EQUAL('$', received[ii]);
+        TEST_ASSERT_EQUAL('>', received[ii + 2]);
+        TEST_ASSERT_EQUAL(MSP_API_VERSION, received[ii + 4]);
+    }
+
+    // with a frame queue, replies (including the RC fast path ACK) are written only by process_output(), which may be on another task,
+    // so process_input() neither writes to nor flushes the coalescing buffer
+    static MspFrameQueue frame_queue;
+    static MspSnapshot<msp_rc_channels_t> rc_channels;
+    msp_stream.set_frame_queue(&frame_queue);
+    msp_stream.set_rc_channels_snapshot(&rc_channels);
+    msp_serial.set_tx_coalescing(32, 0);
+    port._write_count = 0;
+    enum { QUEUED_COUNT = MspFrameQueue::SLOT_COUNT, QUEUED_REPLY_SIZE = 6 + QUEUED_COUNT * REPLY_SIZE };
+    for (size_t ii = 0; ii < QUEUED_COUNT; ++ii) {
+        port.host_write(&api_version[0], api_version.size());
+    }
+    port.advance_time_ns(port.get_byte_time_ns() * api_version.size() * QUEUED_COUNT);
+    static constexpr std::array<uint8_t, 8> set_raw_rc = { '$', 'M', '<', 2, MSP_SET_RAW_RC, 0xDC, 0x05, 2 ^ MSP_SET_RAW_RC ^ 0xDC ^ 0x05 };
+    port.host_write(&set_raw_rc[0], set_raw_rc.size());
+    port.advance_time_ns(port.get_byte_time_ns() * set_raw_rc.size());
+    msp_serial.process_input(pg);
+    TEST_ASSERT_EQUAL(1, rc_channels.get_publication_count());
+    TEST_ASSERT_EQUAL(0, port._write_count);
+    TEST_ASSERT_EQUAL(0, msp_serial.get_tx_coalesced_len());
+    msp_serial.process_output(pg);
+    TEST_ASSERT_EQUAL(0, msp_serial.get_tx_coalesced_len());
+    TEST_ASSERT_EQUAL(QUEUED_REPLY_SIZE / 32 + 1, port._write_count);
+    port.advance_time_ns(port.get_byte_time_ns() * QUEUED_REPLY_SIZE);
+    TEST_ASSERT_EQUAL(QUEUED_REPLY_SIZE, port.host_bytes_available());
+    port.host_read(&received[0], 6);
+    TEST_ASSERT_EQUAL(MSP_SET_RAW_RC, received[4]); // the deferred ACK is sent ahead of the queued replies
+}
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-explicit-virtual-functions,cppcoreguidelines-pro-bounds-constant-array-index,hicpp-use-override,misc-const-correctness,misc-non-private-member-variables-in-classes,modernize-use-override,readability-magic-numbers,readability-redundant-access-specifiers)
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_simulator_timing);
+    RUN_TEST(test_simulator_rx_overrun);
+    RUN_TEST(test_simulator_bit_errors);
+    RUN_TEST(test_simulator_link_benchmark);
+    RUN_TEST(test_link_statistics);
+    RUN_TEST(test_link_statistics_rates);
+    RUN_TEST(test_input_budget);
+    RUN_TEST(test_adaptive_interval);
+    RUN_TEST(test_tx_wait_policy);
+    RUN_TEST(test_tx_notification);
+    RUN_TEST(test_tx_wait_notify);
+    RUN_TEST(test_tx_coalescing);
+
+    UNITY_END();
+}
@@ -0,0 +1,164 @@
+#include <msp_snapshot.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <unity.h>
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-pro-bounds-constant-array-index,misc-const-correctness,readability-magic-numbers)
+struct attitude_t {
+    std::array<uint32_t, 15> values; // all equal to sequence in a consistent snapshot
+    uint32_t sequence;
+    uint8_t flags; // odd size, to check the final partial word
+};
+
+void test_msp_snapshot()
+{
+    static MspSnapshot<attitude_t> snapshot;
+
+    TEST_ASSERT_EQUAL(0, snapshot.get_publication_count());
+    attitude_t attitude {};
+    attitude.values.fill(7);
+    attitude.sequence = 7;
+    attitude.flags = 0xA5;
+    snapshot.publish(attitude);
+    TEST_ASSERT_EQUAL(1, snapshot.get_publication_count());
+
+    attitude_t read {};
+    TEST_ASSERT_TRUE(snapshot.try_read(read));
+    TEST_ASSERT_EQUAL(7, read.sequence);
+    TEST_ASSERT_EQUAL(7, read.values[14]);
+    TEST_ASSERT_EQUAL(0xA5, read.flags);
+
+    attitude.sequence = 8;
+    snapshot.publish(attitude);
+    TEST_ASSERT_EQUAL(8, snapshot.read().sequence);
+    TEST_ASSERT_EQUAL(2, snapshot.get_publication_count());
+}
+
+static std::array<uint32_t, MspSnapshot<attitude_t>::WORD_COUNT> attitude_words(uint32_t sequence)
+{
+    attitude_t attitude {};
+    attitude.values.fill(sequence);
+    attitude.sequence = sequence;
+    attitude.flags = static_cast<uint8_t>(sequence);
+    std::array<uint32_t, MspSnapshot<attitude_t>::WORD_COUNT> words {};
+    std::memcpy(&words[0], &attitude, sizeof(attitude));
+    return words;
+}
+
+void test_msp_snapshot_read_during_publication()
+{
+    static MspSnapshot<attitude_t> snapshot;
+    constexpr size_t HALF = MspSnapshot<attitude_t>::WORD_COUNT / 2;
+    std::array<uint32_t, MspSnapshot<attitude_t>::WORD_COUNT> words {};
+
+    snapshot.publish(attitude_t { .values = {}, .sequence = 1, .flags = 1 });
+
+    // the read starts while publication 2 is in progress, so reads publication 1
+    uint32_t writer_sequence = snapshot.begin_publish();
+    uint32_t sequence = snapshot.begin_read();
+    TEST_ASSERT_EQUAL(1, sequence & 1U);
+    snapshot.read_words(sequence, words, 0, HALF);
+    // publication 2 completes, which does not touch publication 1's buffer
+    snapshot.write_words(writer_sequence, attitude_words(2));
+    snapshot.end_publish(writer_sequence);
+    snapshot.read_words(sequence, words, HALF, words.size());
+    TEST_ASSERT_TRUE(snapshot.end_read(sequence));
+
+    // the read starts while publication 3 is in progress, so reads publication 2,
+    // then publication 3 completes and publication 4 starts, overwriting publication 2's buffer while it is being read
+    writer_sequence = snapshot.begin_publish();
+    sequence = snapshot.begin_read();
+    TEST_ASSERT_EQUAL(1, sequence & 1U);
+    snapshot.read_words(sequence, words, 0, HALF);
+    snapshot.write_words(writer_sequence, attitude_words(3));
+    snapshot.end_publish(writer_sequence);
+    writer_sequence = snapshot.begin_publish();
+    snapshot.write_words(writer_sequence, attitude_words(4));
+    snapshot.read_words(sequence, words, HALF, words.size());
+    TEST_ASSERT_FALSE(snapshot.end_read(sequence));
+    snapshot.end_publish(writer_sequence);
+    TEST_ASSERT_EQUAL(4, snapshot.read().sequence);
+}
+
+void test_msp_snapshot_contention()
+{
+    static MspSnapshot<attitude_t> snapshot;
+
+    enum { READER_COUNT = 3, PUBLICATION_COUNT = 2000000 };
+    std::atomic<bool> done { false };
+    std::atomic<uint32_t> torn_count { 0 };
+    std::array<uint32_t, READER_COUNT> read_counts {};
+    std::array<uint32_t, READER_COUNT> retry_counts {};
+
+    std::vector<std::thread> readers;
+    for (size_t ii = 0; ii < READER_COUNT; ++ii) {
+        readers.emplace_back([&, ii]() {
+            uint32_t previous = 0;
+            attitude_t attitude {};
+            while (!done.load(std::memory_order_relaxed)) {
+                if (!snapshot.try_read(attitude)) {
+                    ++retry_counts[ii];
+                    continue;
+                }
+                ++read_counts[ii];
+                bool consistent = attitude.sequence >= previous && attitude.flags == static_cast<uint8_t>(attitude.sequence);
+                for (uint32_t value : attitude.values) {
+                    consistent = consistent && value == attitude.sequence;
+                }
+                if (!consistent) {
+                    torn_count.fetch_add(1);
+                }
+                previous = attitude.sequence;
+            }
+        });
+    }
+
+    // the writer never waits for the readers
+    attitude_t attitude {};
+    for (uint32_t sequence = 1; sequence <= PUBLICATION_COUNT; ++sequence) {
+        attitude.values.fill(sequence);
+        attitude.sequence = sequence;
+        attitude.flags = static_cast<uint8_t>(sequence);
+        snapshot.publish(attitude);
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    uint32_t reads = 0;
+    uint32_t retries = 0;
+    for (size_t ii = 0; ii < READER_COUNT; ++ii) {
+        reads += read_counts[ii];
+        retries += retry_counts[ii];
+    }
+    std::array<char, 128> message {};
+    std::snprintf(&message[0], message.size(), "%u publications, %u consistent reads, %u retries", PUBLICATION_COUNT, reads, retries);
+    TEST_MESSAGE(&message[0]);
+
+    TEST_ASSERT_EQUAL(0, torn_count.load());
+    TEST_ASSERT_EQUAL(PUBLICATION_COUNT, snapshot.read().sequence);
+}
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers,cppcoreguidelines-pro-bounds-constant-array-index,misc-const-correctness,readability-magic-numbers)
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_msp_snapshot);
+    RUN_TEST(test_msp_snapshot_read_during_publication);
+    RUN_TEST(test_msp_snapshot_contention);
+
+    UNITY_END();
+}